@@ -0,0 +1,261 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <immintrin.h>
+
+#include "cache_tests.h"
+
+/**
+ * Each kernel moves at least nb_reads lines of LINE_SIZE bytes for
+ * each size of the sweep, so that bandwidths and latencies are
+ * measured over comparable numbers of accesses.
+ */
+#define LINE_SIZE 64
+
+/**
+ * Sink of the values loaded by the read kernels, so that the loads
+ * are not optimized out.
+ */
+static volatile uint64_t bandwidth_sink;
+
+/**
+ * Defines the read, write, non-temporal write and copy kernels of an
+ * instruction set, each one processing size bytes of memory with four
+ * vectors per iteration. The read kernel ORs the vectors in four
+ * independent accumulators, so that it is only limited by the loads.
+ * The copy kernel copies src to dst. This file is compiled with
+ * optimizations so that the kernels are made of vector loads and
+ * stores only, and each kernel is compiled for its own instruction set
+ * so that the binary runs on any x86-64 processor.
+ */
+#define DEFINE_KERNELS(ISA, TARGET, VEC, ZERO, LOAD, STORE, STREAM, OR, LOW64) \
+  __attribute__((target(TARGET)))					\
+  static void read_##ISA(void *dst, const void *src, size_t size) {	\
+    const VEC *p = src;							\
+    VEC a0 = ZERO(), a1 = ZERO(), a2 = ZERO(), a3 = ZERO();		\
+    for (size_t i = 0; i < size / sizeof(VEC); i += 4) {		\
+      a0 = OR(a0, LOAD(p + i));						\
+      a1 = OR(a1, LOAD(p + i + 1));					\
+      a2 = OR(a2, LOAD(p + i + 2));					\
+      a3 = OR(a3, LOAD(p + i + 3));					\
+    }									\
+    bandwidth_sink += LOW64(OR(OR(a0, a1), OR(a2, a3)));		\
+  }									\
+									\
+  __attribute__((target(TARGET)))					\
+  static void write_##ISA(void *dst, const void *src, size_t size) {	\
+    VEC *p = dst;							\
+    VEC v = ZERO();							\
+    for (size_t i = 0; i < size / sizeof(VEC); i += 4) {		\
+      STORE(p + i, v);							\
+      STORE(p + i + 1, v);						\
+      STORE(p + i + 2, v);						\
+      STORE(p + i + 3, v);						\
+    }									\
+  }									\
+									\
+  __attribute__((target(TARGET)))					\
+  static void write_nt_##ISA(void *dst, const void *src, size_t size) { \
+    VEC *p = dst;							\
+    VEC v = ZERO();							\
+    for (size_t i = 0; i < size / sizeof(VEC); i += 4) {		\
+      STREAM(p + i, v);							\
+      STREAM(p + i + 1, v);						\
+      STREAM(p + i + 2, v);						\
+      STREAM(p + i + 3, v);						\
+    }									\
+    _mm_sfence();							\
+  }									\
+									\
+  __attribute__((target(TARGET)))					\
+  static void copy_##ISA(void *dst, const void *src, size_t size) {	\
+    VEC *d = dst;							\
+    const VEC *s = src;							\
+    for (size_t i = 0; i < size / sizeof(VEC); i += 4) {		\
+      STORE(d + i, LOAD(s + i));					\
+      STORE(d + i + 1, LOAD(s + i + 1));				\
+      STORE(d + i + 2, LOAD(s + i + 2));				\
+      STORE(d + i + 3, LOAD(s + i + 3));				\
+    }									\
+  }
+
+#define LOW64_SSE2(V) _mm_cvtsi128_si64(V)
+#define LOW64_AVX2(V) _mm_cvtsi128_si64(_mm256_castsi256_si128(V))
+#define LOW64_AVX512(V) _mm_cvtsi128_si64(_mm512_castsi512_si128(V))
+
+DEFINE_KERNELS(sse2, "sse2", __m128i, _mm_setzero_si128, _mm_load_si128,
+	       _mm_store_si128, _mm_stream_si128, _mm_or_si128, LOW64_SSE2)
+DEFINE_KERNELS(avx2, "avx2", __m256i, _mm256_setzero_si256, _mm256_load_si256,
+	       _mm256_store_si256, _mm256_stream_si256, _mm256_or_si256, LOW64_AVX2)
+DEFINE_KERNELS(avx512, "avx512f", __m512i, _mm512_setzero_si512, _mm512_load_si512,
+	       _mm512_store_si512, _mm512_stream_si512, _mm512_or_si512, LOW64_AVX512)
+
+typedef void (*kernel_func)(void *dst, const void *src, size_t size);
+
+/**
+ * Kernels of an instruction set, used when the processor supports it.
+ */
+struct isa_kernels {
+  const char *name;
+  int supported;
+  kernel_func read;
+  kernel_func write;
+  kernel_func write_nt;
+  kernel_func copy;
+};
+
+/**
+ * Columns of the bandwidth table: reads with each instruction set,
+ * then writes, non-temporal writes and copies with the widest one.
+ */
+#define NB_ISAS 3
+#define NB_COLUMNS (NB_ISAS + 3)
+
+/**
+ * Returns the bandwidth in GB/s of the given kernel over size bytes,
+ * counting bytes_per_pass bytes moved by each call. The kernel first
+ * runs once untimed to bring the memory in the caches it fits in.
+ */
+static double measure_bandwidth(kernel_func kernel, void *dst, const void *src, size_t size,
+				size_t bytes_per_pass, size_t nb_reads) {
+  size_t nb_passes = nb_reads * LINE_SIZE / bytes_per_pass;
+  if (nb_passes == 0) {
+    nb_passes = 1;
+  }
+  kernel(dst, src, size);
+  struct timespec start, end;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+  for (size_t pass = 0; pass < nb_passes; pass++) {
+    kernel(dst, src, size);
+  }
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end);
+  return (double)bytes_per_pass * nb_passes / ellapsed_ns(&start, &end);
+}
+
+/**
+ * Prints the bandwidth measured at the largest size of the sweep
+ * fitting in half of each cache level, and at the last size if it does
+ * not fit in the last level.
+ */
+static void print_levels(const size_t *sizes, double (*rows)[NB_COLUMNS + 1], int nb_rows,
+			 const char **columns, const int *printed) {
+  const char *names[] = {"L1", "L2", "L3", "Memory"};
+  size_t capacities[] = {cache_size(1), cache_size(2), cache_size(3), 0};
+  printf("\n%-10s %-10s", "Level", "Size (KiB)");
+  for (int c = 0; c <= NB_COLUMNS; c++) {
+    if (printed[c]) {
+      printf(" %-12s", columns[c]);
+    }
+  }
+  printf("\n");
+  size_t last_capacity = 0;
+  for (int level = 0; level < 4; level++) {
+    int row = -1;
+    for (int r = 0; r < nb_rows; r++) {
+      if (capacities[level] != 0 && sizes[r] <= capacities[level] / 2 && sizes[r] > last_capacity) {
+	row = r;
+      } else if (capacities[level] == 0 && last_capacity != 0 && sizes[r] > 2 * last_capacity) {
+	row = r;
+      }
+    }
+    if (capacities[level] != 0) {
+      last_capacity = capacities[level];
+    }
+    if (row == -1) {
+      continue;
+    }
+    printf("%-10s %-10zu", names[level], sizes[row] / 1024);
+    for (int c = 0; c <= NB_COLUMNS; c++) {
+      if (printed[c]) {
+	printf(" %-12.3f", rows[row][c]);
+      }
+    }
+    printf("\n");
+  }
+}
+
+void run_bandwidth(const struct sweep_params *params) {
+
+  __builtin_cpu_init();
+  struct isa_kernels isas[NB_ISAS] = {
+    {"SSE2", 1, read_sse2, write_sse2, write_nt_sse2, copy_sse2},
+    {"AVX2", __builtin_cpu_supports("avx2"), read_avx2, write_avx2, write_nt_avx2, copy_avx2},
+    {"AVX-512", __builtin_cpu_supports("avx512f"), read_avx512, write_avx512, write_nt_avx512, copy_avx512}
+  };
+  struct isa_kernels *widest = &isas[0];
+  for (int i = 0; i < NB_ISAS; i++) {
+    if (isas[i].supported) {
+      widest = &isas[i];
+    }
+  }
+  printf("Using %s for writes and copies\n\n", widest->name);
+
+  /**
+   * First column is the latency of a single chain, followed by the
+   * bandwidth columns in GB/s.
+   */
+  const char *columns[NB_COLUMNS + 1] = {
+    "Lat (ns)", "Rd SSE2", "Rd AVX2", "Rd AVX-512", "Write", "Write NT", "Copy"
+  };
+  int printed[NB_COLUMNS + 1];
+  for (int c = 0; c <= NB_COLUMNS; c++) {
+    printed[c] = c == 0 || c > NB_ISAS || isas[c - 1].supported;
+  }
+  printf("%-10s", "Size (KiB)");
+  for (int c = 0; c <= NB_COLUMNS; c++) {
+    if (printed[c]) {
+      printf(" %-12s", columns[c]);
+    }
+  }
+  printf("\n");
+
+  size_t elem_size = (params->npad + 1) * sizeof(uint64_t);
+  int nb_rows = 0;
+  for (size_t size = 1024; size <= params->max_size; size = step(size)) {
+    nb_rows++;
+  }
+  size_t *sizes = malloc(nb_rows * sizeof(size_t));
+  double (*rows)[NB_COLUMNS + 1] = calloc(nb_rows, sizeof(*rows));
+  assert(sizes);
+  assert(rows);
+
+  int row = 0;
+  for (size_t size = 1024; size <= params->max_size; size = step(size), row++) {
+    sizes[row] = size;
+    void *memory;
+    assert(posix_memalign(&memory, LINE_SIZE, size) == 0);
+    memset(memory, 0, size);
+
+    if (size >= elem_size) {
+      rows[row][0] = measure_latency(memory, size, params);
+    }
+    for (int i = 0; i < NB_ISAS; i++) {
+      if (isas[i].supported) {
+	rows[row][1 + i] = measure_bandwidth(isas[i].read, NULL, memory, size, size, params->nb_reads);
+      }
+    }
+    rows[row][NB_ISAS + 1] = measure_bandwidth(widest->write, memory, NULL, size, size, params->nb_reads);
+    rows[row][NB_ISAS + 2] = measure_bandwidth(widest->write_nt, memory, NULL, size, size, params->nb_reads);
+
+    /**
+     * Copies count both the bytes read and written, the working set
+     * being size bytes as for the other kernels.
+     */
+    rows[row][NB_ISAS + 3] = measure_bandwidth(widest->copy, memory, (char *)memory + size / 2, size / 2, size, params->nb_reads);
+
+    printf("%-10zu", size / 1024);
+    for (int c = 0; c <= NB_COLUMNS; c++) {
+      if (printed[c]) {
+	printf(" %-12.3f", rows[row][c]);
+      }
+    }
+    printf("\n");
+    free(memory);
+  }
+
+  print_levels(sizes, rows, nb_rows, columns, printed);
+  free(rows);
+  free(sizes);
+}
@@ -1,4 +1,5 @@
 #include "mem_alloc.h"
+#include "cache_tests.h"
 #include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -28,6 +29,18 @@
 #define	HUNDRED_ASM FIFTY_ASM FIFTY_ASM
 
 
+/**
+ * Benchmarks run over the sweep of memory sizes.
+ */
+enum bench_t {
+  bench_latency,
+  bench_mlp,
+  bench_bandwidth,
+  bench_hierarchy,
+  bench_geometry,
+  bench_tlb
+};
+
 size_t step(size_t k) {
   if (k < 1024) {
     k = k * 2;
@@ -41,8 +54,14 @@ size_t step(size_t k) {
   return k;
 }
 
+uint64_t ellapsed_ns(const struct timespec *start, const struct timespec *end) {
+  return (end->tv_sec * 1E9 + end->tv_nsec) - (start->tv_sec * 1E9 + start->tv_nsec);
+}
 
-unsigned int l1, l2, l3;
+/**
+ * Data (or unified) caches reported by cpuid, indexed by level.
+ */
+static struct cache_info caches[MAX_CACHE_LEVEL + 1];
 
 void i386_cpuid_caches () {
     int i;
@@ -115,18 +134,89 @@ void i386_cpuid_caches () {
             , cache_is_fully_associative ? "true" : "false"
             , cache_is_self_initializing ? "true" : "false"
         );
-	if (cache_level == 1 && cache_type == 1) {
-	  l1 = cache_total_size;
-	} else if (cache_level == 2) {
-	  l2 = cache_total_size;
-	} else if (cache_level == 3) {
-	  l3 = cache_total_size;
+	if (cache_type != 2 && cache_level <= MAX_CACHE_LEVEL) {
+	  caches[cache_level].size = cache_total_size;
+	  caches[cache_level].line_size = cache_coherency_line_size;
+	  caches[cache_level].ways = cache_ways_of_associativity;
+	  caches[cache_level].sets = cache_sets;
 	}
     }
 }
 
+size_t cache_size(int level) {
+  return cache_info(level)->size;
+}
+
+const struct cache_info *cache_info(int level) {
+  static const struct cache_info unknown;
+  if (level < 1 || level > MAX_CACHE_LEVEL) {
+    return &unknown;
+  }
+  return &caches[level];
+}
+
+double chase_latency(uint64_t *start_elem, size_t nb_reads) {
+  struct timespec start, end;
+  register long remaining = nb_reads;
+#ifdef ASM
+  uint64_t *p = start_elem;
+#else
+  register uint64_t *p = start_elem;
+#endif
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+#ifdef ASM
+  asm("movq %0, %%rbx;"
+      :
+      :"r" (p)
+      :"%rbx");
+#endif
+  while (remaining > 0) {
+#ifdef ASM
+    HUNDRED_ASM
+#else
+    HUNDRED
+#endif
+    remaining -= 100;
+  }
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end);
+  return ellapsed_ns(&start, &end) / (double)nb_reads;
+}
+
+double measure_latency(uint64_t *memory, size_t size, const struct sweep_params *params) {
+  fill_memory_params(memory, size, params->access_mode, params->npad, &params->fill_params);
+  return chase_latency(memory, params->nb_reads);
+}
+
+/**
+ * Latency bench: for each size of the sweep, follows a single chain
+ * and prints the time per load.
+ */
+static void run_latency(const struct sweep_params *params) {
+  size_t elem_size = (params->npad + 1) * sizeof(uint64_t);
+  printf("%-10s %-10s", "Size (KiB)", "Time (ns)\n");
+  for (size_t size = 1024; size <= params->max_size; size = step(size)) {
+    if (size < elem_size) {
+      continue;
+    }
+    uint64_t *memory = malloc(size);
+    assert(memory);
+    double latency = measure_latency(memory, size, params);
+    printf("%-10zu %-10f %-10f\n", size / 1024, latency, 8 * 1E3 / latency);
+    free(memory);
+  }
+}
+
 void usage(const char *prog_name) {
-  printf ("Usage %s: max_size_KiB nb_reads mode (where mode is either seq or rand)\n", prog_name);
+  printf ("Usage %s: [-b bench] [-k max_chains] [-p npad] max_size_KiB nb_reads pattern\n"
+	  "\t pattern: " ACCESS_PATTERN_HELP
+	  "\t -b: the bench to run, latency (default), mlp to follow several independent chains at once,\n"
+	  "\t     or bandwidth to read, write and copy memory with the widest SIMD instructions available,\n"
+	  "\t     or hierarchy to find the cache levels from the latency curve, refining sizes near each knee,\n"
+	  "\t     or geometry to measure the line size, associativity and number of sets of each level,\n"
+	  "\t     or tlb to find the TLB reach and page walk penalty with 4 KiB, transparent huge and hugetlb pages\n"
+	  "\t -k: the maximum number of independent chains followed by the mlp bench (default is 16)\n"
+	  "\t -p: the number of padding words following each pointer (7 for one element per cache line, 511 for one per page)\n",
+	  prog_name);
 }
 
 int main(int argc, char **argv) {
@@ -134,27 +224,60 @@ int main(int argc, char **argv) {
  /**
   * Check and get arguments.
   */
-  if (argc != 4) {
+  struct sweep_params params;
+  params.npad = 0;
+  fill_params_init(&params.fill_params);
+  enum bench_t bench = bench_latency;
+  unsigned int max_chains = 16;
+  int opt;
+  while ((opt = getopt(argc, argv, "b:k:p:")) != -1) {
+    switch (opt) {
+    case 'b':
+      if (!strcmp(optarg, "latency")) {
+	bench = bench_latency;
+      } else if (!strcmp(optarg, "mlp")) {
+	bench = bench_mlp;
+      } else if (!strcmp(optarg, "bandwidth")) {
+	bench = bench_bandwidth;
+      } else if (!strcmp(optarg, "hierarchy")) {
+	bench = bench_hierarchy;
+      } else if (!strcmp(optarg, "geometry")) {
+	bench = bench_geometry;
+      } else if (!strcmp(optarg, "tlb")) {
+	bench = bench_tlb;
+      } else {
+	printf("Unknown bench %s\n", optarg);
+	usage(argv[0]);
+	return -1;
+      }
+      break;
+    case 'k':
+      max_chains = atoi(optarg);
+      break;
+    case 'p':
+      params.npad = atol(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return -1;
+    }
+  }
+  if (argc - optind != 3) {
     usage(argv[0]);
     return -1;
   }
-  size_t max_size = atol(argv[1]) * 1024;
-  size_t nb_reads = atol(argv[2]);
-  enum access_mode_t access_mode;
-  if (!strcmp(argv[3], "seq")) {
-    access_mode = access_seq;
-  } else if (!strcmp(argv[3], "rand")) {
-    access_mode = access_rand;
-  } else {
-    printf("Unknown access_mode %s\n", argv[3]);
+  params.max_size = atol(argv[optind]) * 1024;
+  params.nb_reads = atol(argv[optind + 1]);
+  if (parse_access_pattern(argv[optind + 2], &params.access_mode, &params.fill_params)) {
+    printf("Unknown access pattern %s\n", argv[optind + 2]);
     usage(argv[0]);
     return -1;
   }
 
   i386_cpuid_caches();
-  printf("L1 = %u\n", l1);
-  printf("L2 = %u\n", l2);
-  printf("L3 = %u\n\n", l3);
+  printf("L1 = %zu\n", cache_size(1));
+  printf("L2 = %zu\n", cache_size(2));
+  printf("L3 = %zu\n\n", cache_size(3));
 
   /**
    * Measure time to measure time :-)
@@ -204,37 +327,27 @@ int main(int argc, char **argv) {
   printf("Time for gettimeofday = %" PRIu64 " nanoseconds (ellapsed = %ld)\n\n", ellapsed / nb_rep, ellapsed);
 
   /**
-   * Perform memory accesse
+   * Perform memory accesses
    */
-  printf("%-10s %-10s", "Size (KiB)", "Time (ns)\n");
-  for (size_t size = 1024; size <= max_size; size = step(size)) {
-    uint64_t *memory = malloc(size);
-    assert(memory);
-    fill_memory(memory, size, access_mode);
-    register long remaining = nb_reads;
-#ifdef ASM
-    uint64_t *p = memory;
-#else
-    register uint64_t *p = memory;
-#endif
-    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
-#ifdef ASM
-    asm("movq %0, %%rbx;"
-	:
-	:"r" (p)
-	:"%rbx");
-#endif
-    while (remaining > 0) {
-#ifdef ASM
-      HUNDRED_ASM
-#else
-      HUNDRED
-#endif
-      remaining -= 100;
-    }
-    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end);
-    ellapsed = (end.tv_sec * 1E9 + end.tv_nsec) - (start.tv_sec * 1E9 + start.tv_nsec);
-    printf("%-10zu %-10f %-10f\n", size / 1024, ellapsed / (float)nb_reads, (float)nb_reads *1E9 *8/ ellapsed / 1E6);
+  switch (bench) {
+  case bench_latency:
+    run_latency(&params);
+    break;
+  case bench_mlp:
+    run_mlp(&params, max_chains);
+    break;
+  case bench_bandwidth:
+    run_bandwidth(&params);
+    break;
+  case bench_hierarchy:
+    run_hierarchy(&params);
+    break;
+  case bench_geometry:
+    run_geometry(&params);
+    break;
+  case bench_tlb:
+    run_tlb(&params);
+    break;
   }
   return 0;
 }
@@ -0,0 +1,112 @@
+#ifndef CACHE_TESTS_H
+#define CACHE_TESTS_H
+
+#include <stddef.h>
+#include <time.h>
+
+#include "mem_alloc.h"
+
+/**
+ * Parameters of a sweep over memory sizes: sizes from 1 KiB up to
+ * max_size bytes, each of them read nb_reads times following chains
+ * filled with the given access mode and element padding.
+ */
+struct sweep_params {
+  size_t max_size;
+  size_t nb_reads;
+  enum access_mode_t access_mode;
+  size_t npad;
+  struct fill_params fill_params;
+};
+
+/**
+ * Returns the size following k in the sweep over memory sizes.
+ */
+size_t step(size_t k);
+
+/**
+ * Geometry of a data or unified cache level as decoded from cpuid leaf
+ * 4, all fields being 0 when the level is unknown.
+ */
+#define MAX_CACHE_LEVEL 4
+
+struct cache_info {
+  size_t size;
+  unsigned int line_size;
+  unsigned int ways;
+  unsigned int sets;
+};
+
+/**
+ * Returns the number of nanoseconds between start and end.
+ */
+uint64_t ellapsed_ns(const struct timespec *start, const struct timespec *end);
+
+/**
+ * Returns the size in bytes of the given data cache level as reported
+ * by cpuid, 0 if unknown.
+ */
+size_t cache_size(int level);
+
+/**
+ * Returns the geometry of the given data cache level as reported by
+ * cpuid.
+ */
+const struct cache_info *cache_info(int level);
+
+/**
+ * Follows the chain going through start for nb_reads loads and returns
+ * the average time of each load in nanoseconds.
+ */
+double chase_latency(uint64_t *start, size_t nb_reads);
+
+/**
+ * Fills memory, of the given size, as described by params and returns
+ * the average time in nanoseconds of each of the params->nb_reads
+ * loads following the chain from its first element.
+ */
+double measure_latency(uint64_t *memory, size_t size, const struct sweep_params *params);
+
+/**
+ * Memory-level parallelism bench: for each size of the sweep, follows
+ * 1 up to max_chains independent chains interleaved in the same loop
+ * and prints the time per load for each number of chains, along with
+ * the effective number of outstanding loads.
+ */
+void run_mlp(const struct sweep_params *params, unsigned int max_chains);
+
+/**
+ * Bandwidth bench: for each size of the sweep, prints the latency of a
+ * single chain next to the bandwidth in GB/s of SIMD reads with each
+ * instruction set supported by the processor (SSE2, AVX2, AVX-512),
+ * and of regular writes, non-temporal writes and copies with the
+ * widest one. Ends with a summary per cache level.
+ */
+void run_bandwidth(const struct sweep_params *params);
+
+/**
+ * Hierarchy bench: measures the latency of power of two sizes up to
+ * max_size, refines sizes where the latency jumps, then prints the
+ * capacity and latency of each plateau of the curve next to the
+ * sizes reported by cpuid.
+ */
+void run_hierarchy(const struct sweep_params *params);
+
+/**
+ * Geometry bench: measures the line size, then chases sets of
+ * addresses at power of two strides to find the associativity and the
+ * number of sets of each level, and prints them next to the values
+ * decoded from cpuid.
+ */
+void run_geometry(const struct sweep_params *params);
+
+/**
+ * TLB bench: for 4 KiB, transparent huge and hugetlb pages, chases one
+ * line per page over an increasing number of pages, subtracts the
+ * latency of as many lines packed in a few pages, and prints the reach
+ * of the L1 DTLB and STLB along with the STLB hit and page walk
+ * penalties.
+ */
+void run_tlb(const struct sweep_params *params);
+
+#endif
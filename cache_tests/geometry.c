@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/mman.h>
+
+#include "cache_tests.h"
+
+/**
+ * Two latencies differing by more than this ratio are served by
+ * different levels.
+ */
+#define KNEE_THRESHOLD 0.15
+
+/**
+ * Largest line size looked for, and number of pairs of accesses of the
+ * line size measurement.
+ */
+#define MAX_LINE_SIZE 512
+#define NB_LINE_BLOCKS 512
+
+/**
+ * Largest number of conflicting addresses chased, bounding the
+ * associativity that can be measured.
+ */
+#define MAX_ADDRS 64
+
+/**
+ * Each latency is the minimum over this number of measures, to filter
+ * out interruptions.
+ */
+#define NB_REPEATS 5
+
+#define MAX_JUMPS 4
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+static uint64_t xorshift64(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+/**
+ * Sets perm to a pseudo-random permutation of 0..n-1.
+ */
+static void shuffle(unsigned int *perm, unsigned int n, uint64_t *state) {
+  for (unsigned int i = 0; i < n; i++) {
+    perm[i] = i;
+  }
+  for (unsigned int i = n - 1; i > 0; i--) {
+    unsigned int j = xorshift64(state) % (i + 1);
+    unsigned int tmp = perm[i];
+    perm[i] = perm[j];
+    perm[j] = tmp;
+  }
+}
+
+static double min_latency(uint64_t *start, size_t nb_reads) {
+  double best = chase_latency(start, nb_reads);
+  for (int r = 1; r < NB_REPEATS; r++) {
+    double latency = chase_latency(start, nb_reads);
+    if (latency < best) {
+      best = latency;
+    }
+  }
+  return best;
+}
+
+/**
+ * Chains blocks of 2 * MAX_LINE_SIZE bytes in pseudo-random order,
+ * visiting offsets 0 and distance of each block. While distance is
+ * below the line size, the second access of each block hits the line
+ * brought by the first one, so the average latency drops compared to
+ * larger distances. There are enough blocks not to fit in L1, and
+ * few enough to fit in L2. Returns the line size, or 0 if no jump was
+ * seen.
+ */
+static unsigned int measure_line_size(char *memory, size_t nb_reads, uint64_t *state) {
+  unsigned int perm[NB_LINE_BLOCKS];
+  double first_latency = 0;
+  printf("%-15s %-10s\n", "Distance (B)", "Time (ns)");
+  for (unsigned int distance = sizeof(uint64_t); distance <= MAX_LINE_SIZE; distance *= 2) {
+    shuffle(perm, NB_LINE_BLOCKS, state);
+    for (unsigned int i = 0; i < NB_LINE_BLOCKS; i++) {
+      char *block = memory + (size_t)perm[i] * 2 * MAX_LINE_SIZE;
+      char *next = memory + (size_t)perm[(i + 1) % NB_LINE_BLOCKS] * 2 * MAX_LINE_SIZE;
+      *(uint64_t *)block = (uint64_t)(block + distance);
+      *(uint64_t *)(block + distance) = (uint64_t)next;
+    }
+    double latency = min_latency((uint64_t *)memory, nb_reads);
+    printf("%-15u %-10.3f\n", distance, latency);
+    if (distance == sizeof(uint64_t)) {
+      first_latency = latency;
+    } else if (latency > first_latency * (1 + KNEE_THRESHOLD)) {
+      return distance;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Chases nb_addrs addresses stride bytes apart in pseudo-random order
+ * and returns the latency of each load.
+ */
+static double measure_conflicts(char *memory, size_t stride, unsigned int nb_addrs,
+				size_t nb_reads, uint64_t *state) {
+  unsigned int perm[MAX_ADDRS];
+  shuffle(perm, nb_addrs, state);
+  for (unsigned int i = 0; i < nb_addrs; i++) {
+    *(uint64_t *)(memory + perm[i] * stride) = (uint64_t)(memory + perm[(i + 1) % nb_addrs] * stride);
+  }
+  return min_latency((uint64_t *)memory, nb_reads);
+}
+
+/**
+ * Measures the latency of chasing 1 up to MAX_ADDRS addresses at the
+ * given stride and stores in jumps the numbers of addresses at which
+ * the latency steps up from the previous number, the step being
+ * confirmed by the two following numbers. Gradual ramps, as when a
+ * level with an adaptive replacement policy overflows, are not
+ * jumps. Returns the number of jumps.
+ */
+static int find_jumps(char *memory, size_t stride, size_t nb_reads, uint64_t *state,
+		      unsigned int *jumps) {
+  double latencies[MAX_ADDRS + 1];
+  for (unsigned int n = 1; n <= MAX_ADDRS; n++) {
+    latencies[n] = measure_conflicts(memory, stride, n, nb_reads, state);
+  }
+  int nb_jumps = 0;
+  unsigned int last_jump = 0;
+  for (unsigned int n = 2; n + 2 <= MAX_ADDRS && nb_jumps < MAX_JUMPS; n++) {
+    double threshold = latencies[n - 1] * (1 + KNEE_THRESHOLD);
+    if (n > last_jump + 2 && latencies[n] > threshold
+	&& latencies[n + 1] > threshold && latencies[n + 2] > threshold) {
+      jumps[nb_jumps++] = n;
+      last_jump = n;
+    }
+  }
+  return nb_jumps;
+}
+
+/**
+ * Returns whether one of the given jumps is close to expected, close
+ * enough to absorb the noise of a virtualized host.
+ */
+static int has_jump(const unsigned int *jumps, int nb_jumps, unsigned int expected) {
+  unsigned int tolerance = 1 + expected / 8;
+  for (int j = 0; j < nb_jumps; j++) {
+    if (jumps[j] + tolerance >= expected && jumps[j] <= expected + tolerance) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Returns the cpuid level with the given number of ways and sets, or
+ * else the one with the closest capacity, 0 if cpuid reports none.
+ */
+static int match_level(unsigned int ways, size_t sets, unsigned int line_size) {
+  int best = 0;
+  double best_distance = 0;
+  for (int level = 1; level <= MAX_CACHE_LEVEL; level++) {
+    const struct cache_info *info = cache_info(level);
+    if (info->size == 0) {
+      continue;
+    }
+    if (info->ways == ways && info->sets == sets) {
+      return level;
+    }
+    double ratio = (double)ways * sets * line_size / info->size;
+    double distance = ratio > 1 ? ratio : 1 / ratio;
+    if (best == 0 || distance < best_distance) {
+      best = level;
+      best_distance = distance;
+    }
+  }
+  return best;
+}
+
+void run_geometry(const struct sweep_params *params) {
+  size_t max_stride = params->max_size / MAX_ADDRS;
+  size_t size = MAX_ADDRS * max_stride;
+  if (size < 2 * MAX_LINE_SIZE * NB_LINE_BLOCKS) {
+    size = 2 * MAX_LINE_SIZE * NB_LINE_BLOCKS;
+  }
+
+  /**
+   * Caches past L1 are physically indexed: huge pages keep strides
+   * up to their size physically contiguous.
+   */
+  void *memory;
+  assert(posix_memalign(&memory, HUGE_PAGE_SIZE, size) == 0);
+  madvise(memory, size, MADV_HUGEPAGE);
+  memset(memory, 0, size);
+  uint64_t state = params->fill_params.seed ? params->fill_params.seed : FILL_DEFAULT_SEED;
+
+  unsigned int line_size = measure_line_size(memory, params->nb_reads, &state);
+  if (line_size == 0) {
+    printf("No line size found, assuming 64 bytes\n");
+    line_size = 64;
+  }
+  printf("Line size: %u bytes (cpuid: %u bytes)\n", line_size, cache_info(1)->line_size);
+
+  /**
+   * For each stride, the latency jumps once the addresses conflicting
+   * in a set outnumber the ways of a level. From the way size of the
+   * level on (its number of sets times the line size), all the
+   * addresses fall in the same set and the jump no longer moves with
+   * the stride.
+   */
+  int nb_strides = 0;
+  for (size_t stride = line_size; stride <= max_stride; stride *= 2) {
+    nb_strides++;
+  }
+  if (nb_strides == 0) {
+    printf("max_size too small to measure conflicts\n");
+    free(memory);
+    return;
+  }
+  size_t strides[nb_strides];
+  unsigned int jumps[nb_strides][MAX_JUMPS];
+  int nb_jumps[nb_strides];
+  printf("\n%-12s %s\n", "Stride (B)", "Addresses at which latency jumps");
+  for (int s = 0; s < nb_strides; s++) {
+    strides[s] = (size_t)line_size << s;
+    nb_jumps[s] = find_jumps(memory, strides[s], params->nb_reads, &state, jumps[s]);
+    printf("%-12zu", strides[s]);
+    for (int j = 0; j < nb_jumps[s]; j++) {
+      printf(" %u", jumps[s][j]);
+    }
+    printf("\n");
+  }
+
+  /**
+   * Jumps seen on at least two of the three largest strides are kept,
+   * to filter out noise. They are not necessarily one per cache level
+   * (e.g. way predictors or TLBs add some), so each one is matched to
+   * the cpuid level it looks like.
+   */
+  printf("\n%-6s %-8s %-8s %-15s %-22s\n", "Jump", "Ways", "Sets", "Capacity (KiB)", "cpuid level (ways, sets)");
+  int last = nb_strides - 1;
+  int first_checked = last >= 2 ? last - 2 : 0;
+  int min_count = last - first_checked + 1 >= 2 ? 2 : 1;
+  unsigned int refs[3 * MAX_JUMPS];
+  int nb_refs = 0;
+  for (int s = first_checked; s <= last; s++) {
+    for (int j = 0; j < nb_jumps[s]; j++) {
+      int count = 0;
+      for (int t = first_checked; t <= last; t++) {
+	count += has_jump(jumps[t], nb_jumps[t], jumps[s][j]);
+      }
+      if (count >= min_count && !has_jump(refs, nb_refs, jumps[s][j])) {
+	int r = nb_refs++;
+	for (; r > 0 && refs[r - 1] > jumps[s][j]; r--) {
+	  refs[r] = refs[r - 1];
+	}
+	refs[r] = jumps[s][j];
+      }
+    }
+  }
+
+  for (int j = 0; j < nb_refs; j++) {
+    int first = last;
+    while (first > 0 && has_jump(jumps[first - 1], nb_jumps[first - 1], refs[j])) {
+      first--;
+    }
+    unsigned int ways = refs[j] - 1;
+    size_t sets = strides[first] / line_size;
+    char sets_str[32];
+    /**
+     * When the smallest stride already conflicts, the level may have
+     * fewer sets.
+     */
+    snprintf(sets_str, sizeof(sets_str), first == 0 ? "<=%zu" : "%zu", sets);
+    printf("%-6d %-8u %-8s %-15zu", j + 1, ways, sets_str, ways * sets * line_size / 1024);
+    int level = match_level(ways, sets, line_size);
+    if (level == 0) {
+      printf(" -\n");
+      continue;
+    }
+    const struct cache_info *info = cache_info(level);
+    printf(" L%d (%u, %u)%s\n", level, info->ways, info->sets,
+	   (ways != info->ways || sets != info->sets) ? " mismatch" : "");
+  }
+  if (nb_refs == 0) {
+    printf("No conflict found: use a larger max_size\n");
+  }
+  printf("\nLevels with more than %d ways, more sets than the largest stride allows, or with\n"
+	 "hashed set indexes (e.g. sliced L3) cannot be measured.\n", MAX_ADDRS - 1);
+  free(memory);
+}
@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "cache_tests.h"
+
+/**
+ * Latencies of two sizes a factor of two apart are on the same plateau
+ * of the curve if they differ by less than this ratio.
+ */
+#define KNEE_THRESHOLD 0.15
+
+/**
+ * The capacity of each level is refined until the uncertainty is
+ * below 1 / KNEE_RESOLUTION of the capacity (or 1 KiB).
+ */
+#define KNEE_RESOLUTION 16
+
+#define MAX_SAMPLES 64
+#define MAX_LEVELS 8
+
+struct sample {
+  size_t size;
+  double latency;
+};
+
+/**
+ * Plateau of the latency curve: sizes from min_size up to capacity
+ * bytes are all read with about the same latency.
+ */
+struct level {
+  size_t min_size;
+  size_t capacity;
+  double latency;
+};
+
+static double measure_size(size_t size, const struct sweep_params *params) {
+  uint64_t *memory = malloc(size);
+  assert(memory);
+  double latency = measure_latency(memory, size, params);
+  free(memory);
+  return latency;
+}
+
+static int is_flat(double a, double b) {
+  return b <= a * (1 + KNEE_THRESHOLD) && a <= b * (1 + KNEE_THRESHOLD);
+}
+
+/**
+ * Measures the latency of power of two sizes from the smallest
+ * multiple of 1 KiB holding an element up to max_size, which is always
+ * measured. Returns the number of samples.
+ */
+static int sample_curve(const struct sweep_params *params, struct sample *samples) {
+  size_t elem_size = (params->npad + 1) * sizeof(uint64_t);
+  size_t size = 1024;
+  while (size < elem_size) {
+    size *= 2;
+  }
+  int nb_samples = 0;
+  for (; size <= params->max_size && nb_samples < MAX_SAMPLES - 1; size *= 2) {
+    samples[nb_samples].size = size;
+    samples[nb_samples].latency = measure_size(size, params);
+    nb_samples++;
+  }
+  if (nb_samples == 0 || samples[nb_samples - 1].size != params->max_size) {
+    samples[nb_samples].size = params->max_size;
+    samples[nb_samples].latency = measure_size(params->max_size, params);
+    nb_samples++;
+  }
+  return nb_samples;
+}
+
+/**
+ * Returns the largest size between low and high, read within
+ * KNEE_THRESHOLD of the given latency, by bisection: low is known to
+ * be and high not to be. Increments nb_measures for each size
+ * measured.
+ */
+static size_t refine_capacity(size_t low, size_t high, double latency,
+			      const struct sweep_params *params, int *nb_measures) {
+  while (high - low > 1024 && (high - low) * KNEE_RESOLUTION > low) {
+    size_t middle = (low + (high - low) / 2) & ~(size_t)1023;
+    if (middle <= low) {
+      middle = low + 1024;
+    }
+    (*nb_measures)++;
+    if (measure_size(middle, params) <= latency * (1 + KNEE_THRESHOLD)) {
+      low = middle;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+/**
+ * Splits the samples in plateaus, each made of at least two
+ * consecutive samples with about the same latency, the samples in
+ * between being transitions from one level to the next. Then refines
+ * the capacity of each plateau but the last one in the interval
+ * following it. Returns the number of levels found.
+ */
+static int find_levels(const struct sample *samples, int nb_samples, struct level *levels,
+		       const struct sweep_params *params, int *nb_measures) {
+  int nb_levels = 0;
+  int i = 0;
+  while (i + 1 < nb_samples && nb_levels < MAX_LEVELS) {
+    if (!is_flat(samples[i].latency, samples[i + 1].latency)) {
+      i++;
+      continue;
+    }
+    struct level *level = &levels[nb_levels];
+    double sum = 0;
+    int nb_plateau = 0;
+    level->min_size = samples[i].size;
+    do {
+      sum += samples[i].latency;
+      nb_plateau++;
+      i++;
+    } while (i < nb_samples && is_flat(samples[i - 1].latency, samples[i].latency));
+    level->latency = sum / nb_plateau;
+    level->capacity = samples[i - 1].size;
+    if (i < nb_samples) {
+      level->capacity = refine_capacity(level->capacity, samples[i].size, samples[i - 1].latency,
+					params, nb_measures);
+    }
+    nb_levels++;
+  }
+  return nb_levels;
+}
+
+void run_hierarchy(const struct sweep_params *params) {
+  struct sample samples[MAX_SAMPLES];
+  int nb_samples = sample_curve(params, samples);
+  printf("%-10s %-10s\n", "Size (KiB)", "Time (ns)");
+  for (int i = 0; i < nb_samples; i++) {
+    printf("%-10zu %-10f\n", samples[i].size / 1024, samples[i].latency);
+  }
+
+  struct level levels[MAX_LEVELS];
+  int nb_measures = nb_samples;
+  int nb_levels = find_levels(samples, nb_samples, levels, params, &nb_measures);
+  int nb_sweep_sizes = 0;
+  for (size_t size = 1024; size <= params->max_size; size = step(size)) {
+    nb_sweep_sizes++;
+  }
+  printf("\n%d sizes measured (%d for the full sweep)\n\n", nb_measures, nb_sweep_sizes);
+
+  /**
+   * The last plateau is memory when it lasts up to the largest size
+   * measured, its capacity being unknown. Levels are matched to the
+   * cpuid ones in order, which does not hold when an other effect
+   * (e.g. TLB misses) adds a plateau to the curve.
+   */
+  printf("%-8s %-15s %-12s %-15s %-10s\n", "Level", "Capacity (KiB)", "Time (ns)", "cpuid (KiB)", "Ratio");
+  for (int l = 0; l < nb_levels; l++) {
+    if (l > 0 && l == nb_levels - 1 && levels[l].capacity == params->max_size) {
+      printf("%-8s %-15s %-12.3f\n", "Memory", "-", levels[l].latency);
+      continue;
+    }
+    char name[8];
+    snprintf(name, sizeof(name), "L%d", l + 1);
+    size_t cpuid_size = cache_size(l + 1);
+    if (cpuid_size != 0) {
+      printf("%-8s %-15zu %-12.3f %-15zu %-10.3f\n", name, levels[l].capacity / 1024, levels[l].latency,
+	     cpuid_size / 1024, levels[l].capacity / (double)cpuid_size);
+    } else {
+      printf("%-8s %-15zu %-12.3f %-15s %-10s\n", name, levels[l].capacity / 1024, levels[l].latency, "-", "-");
+    }
+  }
+}
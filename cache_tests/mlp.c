@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <assert.h>
+
+#include "cache_tests.h"
+
+#define MAX_CHAINS 16
+
+/**
+ * Defines chase_K, following K independent chains from the given
+ * heads during nb_steps steps, and storing back where each chain
+ * ended. This file is compiled with optimizations so that the chain
+ * pointers live in registers and each step of a chain is a single
+ * load depending on the previous one. Past 13 chains, x86-64 runs out
+ * of registers and a few chains are spilled to the stack, adding a
+ * store forwarding delay of a few cycles to their steps: this only
+ * matters while the memory fits in L1.
+ */
+#define DEFINE_CHASE(K)						\
+  static void chase_##K(uint64_t **heads, long nb_steps) {	\
+    uint64_t *p[K];						\
+    _Pragma("GCC unroll 16")					\
+    for (int c = 0; c < K; c++) {				\
+      p[c] = heads[c];						\
+    }								\
+    for (long i = 0; i < nb_steps; i++) {			\
+      _Pragma("GCC unroll 16")					\
+      for (int c = 0; c < K; c++) {				\
+	p[c] = (uint64_t *)*p[c];				\
+      }								\
+    }								\
+    _Pragma("GCC unroll 16")					\
+    for (int c = 0; c < K; c++) {				\
+      heads[c] = p[c];						\
+    }								\
+  }
+
+DEFINE_CHASE(1)
+DEFINE_CHASE(2)
+DEFINE_CHASE(3)
+DEFINE_CHASE(4)
+DEFINE_CHASE(5)
+DEFINE_CHASE(6)
+DEFINE_CHASE(7)
+DEFINE_CHASE(8)
+DEFINE_CHASE(9)
+DEFINE_CHASE(10)
+DEFINE_CHASE(11)
+DEFINE_CHASE(12)
+DEFINE_CHASE(13)
+DEFINE_CHASE(14)
+DEFINE_CHASE(15)
+DEFINE_CHASE(16)
+
+static void (*const chase_funcs[MAX_CHAINS + 1])(uint64_t **, long) = {
+  NULL, chase_1, chase_2, chase_3, chase_4, chase_5, chase_6, chase_7, chase_8,
+  chase_9, chase_10, chase_11, chase_12, chase_13, chase_14, chase_15, chase_16
+};
+
+/**
+ * Sets heads to nb_chains elements evenly spread along the chain
+ * going through memory, so that the chains followed from them never
+ * meet. Returns the number of chains actually set, which is lower
+ * than nb_chains when the chain is shorter.
+ */
+static unsigned int spread_heads(uint64_t *memory, unsigned int nb_chains, uint64_t **heads) {
+  uint64_t length = 0;
+  uint64_t *p = memory;
+  do {
+    p = (uint64_t *)*p;
+    length++;
+  } while (p != memory);
+  if (nb_chains > length) {
+    nb_chains = length;
+  }
+
+  uint64_t pos = 0;
+  for (unsigned int c = 0; c < nb_chains; c++) {
+    for (; pos < length * c / nb_chains; pos++) {
+      p = (uint64_t *)*p;
+    }
+    heads[c] = p;
+  }
+  return nb_chains;
+}
+
+void run_mlp(const struct sweep_params *params, unsigned int max_chains) {
+
+  if (max_chains < 1 || max_chains > MAX_CHAINS) {
+    fprintf(stderr, "number of chains = %u must be between 1 and %d\n", max_chains, MAX_CHAINS);
+    exit(-1);
+  }
+  size_t elem_size = (params->npad + 1) * sizeof(uint64_t);
+
+  printf("%-10s", "Size (KiB)");
+  for (unsigned int k = 1; k <= max_chains; k++) {
+    char column[16];
+    snprintf(column, sizeof(column), "K=%u (ns)", k);
+    printf(" %-10s", column);
+  }
+  printf(" %-10s %-10s\n", "MLP", "Best K");
+
+  for (size_t size = 1024; size <= params->max_size; size = step(size)) {
+    if (size < elem_size) {
+      continue;
+    }
+    uint64_t *memory = malloc(size);
+    assert(memory);
+    fill_memory_params(memory, size, params->access_mode, params->npad, &params->fill_params);
+
+    /**
+     * Time per load with k chains: the same total number of loads
+     * split between the chains.
+     */
+    double ns_per_load[MAX_CHAINS + 1];
+    unsigned int best = 1;
+    unsigned int max_used = max_chains;
+    for (unsigned int k = 1; k <= max_used; k++) {
+      uint64_t *heads[MAX_CHAINS];
+      unsigned int nb_chains = spread_heads(memory, k, heads);
+      if (nb_chains < k) {
+	max_used = nb_chains; // The chain is too short for more chains
+	break;
+      }
+      long nb_steps = params->nb_reads / nb_chains;
+      if (nb_steps < 1) {
+	nb_steps = 1; // At least one load per chain when reading less than k times
+      }
+      struct timespec start, end;
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+      chase_funcs[nb_chains](heads, nb_steps);
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end);
+      ns_per_load[k] = ellapsed_ns(&start, &end) / (double)(nb_steps * nb_chains);
+      if (ns_per_load[k] < ns_per_load[best]) {
+	best = k;
+      }
+    }
+
+    /**
+     * By Little's law, the number of loads in flight is the latency of
+     * one load times the throughput of loads: the latency with a
+     * single chain over the time per load with several ones. The
+     * columns of more chains than the chain has elements are left out.
+     */
+    printf("%-10zu", size / 1024);
+    for (unsigned int k = 1; k <= max_chains; k++) {
+      if (k <= max_used) {
+	printf(" %-10.3f", ns_per_load[k]);
+      } else {
+	printf(" %-10s", "-");
+      }
+    }
+    printf(" %-10.2f %-10u\n", ns_per_load[1] / ns_per_load[best], best);
+    free(memory);
+  }
+}
@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "cache_tests.h"
+
+/**
+ * A TLB penalty differing from the mean of a plateau by more than
+ * this ratio, and by more than PENALTY_NOISE nanoseconds, is on an
+ * other level of the TLB hierarchy.
+ */
+#define KNEE_THRESHOLD 0.3
+#define PENALTY_NOISE 0.5
+
+/**
+ * A plateau must span at least this ratio of numbers of pages, shorter
+ * ones being part of the ramp from one level to the next.
+ */
+#define MIN_PLATEAU_SPAN 1.5
+
+#define LINE_BYTES 64
+#define MAX_SAMPLES 256
+#define MAX_LEVELS 4
+
+/**
+ * Latency of chasing one line per page over nb_pages pages, and of
+ * chasing the same number of lines packed in as few pages as possible,
+ * the difference being the cost of the TLB.
+ */
+struct tlb_sample {
+  size_t nb_pages;
+  double latency;
+  double baseline;
+};
+
+struct tlb_level {
+  size_t nb_pages;
+  double penalty;
+};
+
+static double penalty(const struct tlb_sample *sample) {
+  return sample->latency - sample->baseline;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static int is_flat(double mean, double value) {
+  double diff = value > mean ? value - mean : mean - value;
+  return diff <= PENALTY_NOISE || diff <= (mean > 0 ? mean : -mean) * KNEE_THRESHOLD;
+}
+
+/**
+ * Returns the number of pages following n: four steps per power of
+ * two.
+ */
+static size_t next_nb_pages(size_t n) {
+  size_t power = 1;
+  while (power * 2 <= n) {
+    power *= 2;
+  }
+  return n + (power >= 4 ? power / 4 : 1);
+}
+
+/**
+ * Measures the latency of one line per page of the given type over an
+ * increasing number of pages, up to params->max_size bytes. Returns
+ * the number of samples, 0 if the pages cannot be allocated.
+ */
+static int sample_tlb(const struct sweep_params *params, enum page_type_t page_type,
+		      struct tlb_sample *samples) {
+  size_t page_size = page_type_size(page_type);
+  size_t max_pages = params->max_size / page_size;
+  if (max_pages == 0) {
+    return 0;
+  }
+  uint64_t *memory = alloc_memory(max_pages * page_size, page_type);
+  if (memory == NULL) {
+    return 0;
+  }
+  uint64_t *packed = alloc_memory(max_pages * LINE_BYTES, page_thp);
+  assert(packed);
+
+  struct fill_params tlb_params = params->fill_params;
+  tlb_params.page_size = page_size;
+  int nb_samples = 0;
+  for (size_t n = 1; n <= max_pages && nb_samples < MAX_SAMPLES; n = next_nb_pages(n)) {
+    struct tlb_sample *sample = &samples[nb_samples++];
+    sample->nb_pages = n;
+    fill_memory_params(memory, n * page_size, access_tlb, 0, &tlb_params);
+    sample->latency = chase_latency(memory, params->nb_reads);
+    fill_memory_params(packed, n * LINE_BYTES, access_rand, LINE_BYTES / sizeof(uint64_t) - 1, &params->fill_params);
+    sample->baseline = chase_latency(packed, params->nb_reads);
+  }
+  free_memory(packed, max_pages * LINE_BYTES, page_thp);
+  free_memory(memory, max_pages * page_size, page_type);
+  return nb_samples;
+}
+
+/**
+ * Splits the TLB penalty curve in plateaus: runs of samples whose
+ * penalty is close to the mean of the run, a single outlier being
+ * tolerated, and spanning a factor of at least MIN_PLATEAU_SPAN in
+ * number of pages. The samples in between are transitions. The last
+ * number of pages of a plateau is the reach of a TLB level. Returns the
+ * number of levels.
+ */
+static int find_tlb_levels(const struct tlb_sample *samples, int nb_samples, struct tlb_level *levels) {
+  int nb_levels = 0;
+  int i = 0;
+  while (i < nb_samples && nb_levels < MAX_LEVELS) {
+    double sum = penalty(&samples[i]);
+    int nb_plateau = 1;
+    int last = i;
+    for (int j = i + 1; j < nb_samples; j++) {
+      double mean = sum / nb_plateau;
+      if (is_flat(mean, penalty(&samples[j]))) {
+	sum += penalty(&samples[j]);
+	nb_plateau++;
+	last = j;
+      } else if (j > last + 1 || j + 1 == nb_samples || !is_flat(mean, penalty(&samples[j + 1]))) {
+	/* Single outliers are skipped. */
+	break;
+      }
+    }
+    if (samples[last].nb_pages >= samples[i].nb_pages * MIN_PLATEAU_SPAN || last + 1 == nb_samples) {
+      levels[nb_levels].nb_pages = samples[last].nb_pages;
+      levels[nb_levels].penalty = sum / nb_plateau;
+      nb_levels++;
+      i = last + 1;
+    } else {
+      i++;
+    }
+  }
+  return nb_levels;
+}
+
+static void run_page_type(const struct sweep_params *params, enum page_type_t page_type) {
+  size_t page_size = page_type_size(page_type);
+  printf("%s pages (%zu KiB):\n", page_type_name(page_type), page_size / 1024);
+  struct tlb_sample samples[MAX_SAMPLES];
+  int nb_samples = sample_tlb(params, page_type, samples);
+  if (nb_samples == 0) {
+    printf("  cannot allocate %s pages%s\n\n", page_type_name(page_type),
+	   page_type == page_hugetlb ? ", reserve some in /proc/sys/vm/nr_hugepages" : "");
+    return;
+  }
+  printf("  %-10s %-12s %-14s %-14s\n", "Pages", "Time (ns)", "Baseline (ns)", "Penalty (ns)");
+  for (int i = 0; i < nb_samples; i++) {
+    printf("  %-10zu %-12.3f %-14.3f %-14.3f\n", samples[i].nb_pages, samples[i].latency,
+	   samples[i].baseline, penalty(&samples[i]));
+  }
+
+  /**
+   * The first plateau is the L1 DTLB and the second one the STLB. Past
+   * the STLB reach, the page walk penalty keeps growing as the page
+   * table entries fall out of the caches: it is taken as the median
+   * penalty between twice and four times the STLB reach.
+   */
+  struct tlb_level levels[MAX_LEVELS];
+  int nb_levels = find_tlb_levels(samples, nb_samples, levels);
+  size_t last_pages = samples[nb_samples - 1].nb_pages;
+  if (nb_levels < 2) {
+    printf("  L1 DTLB reach: more than %zu entries, use a larger max_size\n\n", last_pages);
+    return;
+  }
+  printf("  L1 DTLB reach: %zu entries (%zu KiB)\n", levels[0].nb_pages, levels[0].nb_pages * page_size / 1024);
+  if (nb_levels < 3) {
+    printf("  STLB reach: more than %zu entries, use a larger max_size\n", last_pages);
+  } else {
+    printf("  STLB reach: %zu entries (%zu KiB)\n", levels[1].nb_pages, levels[1].nb_pages * page_size / 1024);
+  }
+  printf("  STLB hit penalty: %.3f ns\n", levels[1].penalty - levels[0].penalty);
+  if (nb_levels < 3) {
+    printf("\n");
+    return;
+  }
+  double walk_penalties[MAX_SAMPLES];
+  int nb_walks = 0;
+  for (int i = 0; i < nb_samples; i++) {
+    if (samples[i].nb_pages > 2 * levels[1].nb_pages && samples[i].nb_pages <= 4 * levels[1].nb_pages) {
+      walk_penalties[nb_walks++] = penalty(&samples[i]);
+    }
+  }
+  if (nb_walks == 0) {
+    printf("  Page walk penalty: unknown, use a larger max_size\n");
+  } else {
+    qsort(walk_penalties, nb_walks, sizeof(double), compare_doubles);
+    printf("  Page walk penalty: %.3f ns\n", walk_penalties[nb_walks / 2] - levels[0].penalty);
+  }
+  printf("\n");
+}
+
+void run_tlb(const struct sweep_params *params) {
+  run_page_type(params, page_small);
+  run_page_type(params, page_thp);
+  run_page_type(params, page_hugetlb);
+}
@@ -0,0 +1,310 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#define LINE_SIZE 64
+#define DEFAULT_NB_ROUND_TRIPS 20000
+#define DEFAULT_NB_REPEATS 5
+#define SYSFS_CPU "/sys/devices/system/cpu/cpu%d/"
+
+/**
+ * How close two cpus are, from the closest to the farthest.
+ */
+enum group_t {group_smt, group_llc, group_die, group_cross_die, group_cross_socket, nb_groups};
+
+static const char *group_names[] = {"SMT", "same LLC", "same die", "cross-die", "cross-socket"};
+static const char group_letters[] = {'S', 'L', 'D', 'X', 'P'};
+
+/**
+ * Topology of a cpu as reported by sysfs, llc being the list of the cpus
+ * sharing its last level cache.
+ */
+struct cpu_topology {
+  int cpu;
+  int core;
+  int die;
+  int package;
+  char llc[256];
+};
+
+/**
+ * The cache line bounced between the two cpus: the ping thread writes
+ * odd values, the pong thread answers with the next even value.
+ */
+struct line {
+  volatile uint64_t value;
+  char padding[LINE_SIZE - sizeof(uint64_t)];
+} __attribute__((aligned(LINE_SIZE)));
+
+struct pong_args {
+  int cpu;
+  int nb_round_trips;
+  struct line *line;
+  pthread_barrier_t *barrier;
+};
+
+/**
+ * Reads the first line of the file at the path built from format and
+ * cpu in buffer, without its newline. Returns -1 if there is no such
+ * file.
+ */
+static int read_sysfs(char *buffer, size_t size, const char *format, int cpu, const char *file) {
+  char path[256];
+  snprintf(path, sizeof(path), format, cpu);
+  strncat(path, file, sizeof(path) - strlen(path) - 1);
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    return -1;
+  }
+  if (fgets(buffer, size, f) == NULL) {
+    buffer[0] = '\0';
+  }
+  buffer[strcspn(buffer, "\n")] = '\0';
+  fclose(f);
+  return 0;
+}
+
+static int read_sysfs_int(int cpu, const char *file) {
+  char buffer[64];
+  if (read_sysfs(buffer, sizeof(buffer), SYSFS_CPU, cpu, file)) {
+    return -1;
+  }
+  return atoi(buffer);
+}
+
+static void read_topology(int cpu, struct cpu_topology *topology) {
+  topology->cpu = cpu;
+  topology->core = read_sysfs_int(cpu, "topology/core_id");
+  topology->die = read_sysfs_int(cpu, "topology/die_id");
+  topology->package = read_sysfs_int(cpu, "topology/physical_package_id");
+  topology->llc[0] = '\0';
+
+  /**
+   * The last level cache is the highest level data or unified cache.
+   */
+  int llc_level = 0;
+  for (int index = 0; ; index++) {
+    char file[64], type[32];
+    snprintf(file, sizeof(file), "cache/index%d/type", index);
+    if (read_sysfs(type, sizeof(type), SYSFS_CPU, cpu, file)) {
+      break;
+    }
+    snprintf(file, sizeof(file), "cache/index%d/level", index);
+    int level = read_sysfs_int(cpu, file);
+    if (strcmp(type, "Instruction") && level > llc_level) {
+      llc_level = level;
+      snprintf(file, sizeof(file), "cache/index%d/shared_cpu_list", index);
+      read_sysfs(topology->llc, sizeof(topology->llc), SYSFS_CPU, cpu, file);
+    }
+  }
+}
+
+static enum group_t group_of(const struct cpu_topology *a, const struct cpu_topology *b) {
+  if (a->package != b->package) {
+    return group_cross_socket;
+  }
+  if (a->die != b->die) {
+    return group_cross_die;
+  }
+  if (a->core == b->core) {
+    return group_smt;
+  }
+  if (a->llc[0] != '\0' && !strcmp(a->llc, b->llc)) {
+    return group_llc;
+  }
+  return group_die;
+}
+
+static void pin_on_cpu(int cpu) {
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  CPU_SET(cpu, &mask);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask)) {
+    fprintf(stderr, "Cannot pin on cpu %d\n", cpu);
+    exit(-1);
+  }
+}
+
+static void *pong(void *arg) {
+  struct pong_args *args = arg;
+  pin_on_cpu(args->cpu);
+  struct line *line = args->line;
+  pthread_barrier_wait(args->barrier);
+  for (uint64_t i = 0; i < args->nb_round_trips; i++) {
+    while (line->value != 2 * i + 1) {
+    }
+    line->value = 2 * i + 2;
+  }
+  return NULL;
+}
+
+/**
+ * Bounces a line nb_round_trips times between the calling thread,
+ * pinned on ping_cpu, and a thread pinned on pong_cpu. Returns the
+ * average one way latency in nanoseconds.
+ */
+static double ping_pong(int ping_cpu, int pong_cpu, int nb_round_trips) {
+  struct line *line;
+  assert(posix_memalign((void **)&line, LINE_SIZE, sizeof(struct line)) == 0);
+  line->value = 0;
+  pthread_barrier_t barrier;
+  pthread_barrier_init(&barrier, NULL, 2);
+  struct pong_args args = {pong_cpu, nb_round_trips, line, &barrier};
+  pthread_t thread;
+  assert(pthread_create(&thread, NULL, pong, &args) == 0);
+
+  pin_on_cpu(ping_cpu);
+  pthread_barrier_wait(&barrier);
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (uint64_t i = 0; i < nb_round_trips; i++) {
+    line->value = 2 * i + 1;
+    while (line->value != 2 * i + 2) {
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  pthread_join(thread, NULL);
+  pthread_barrier_destroy(&barrier);
+  free(line);
+  double ns = (end.tv_sec * 1E9 + end.tv_nsec) - (start.tv_sec * 1E9 + start.tv_nsec);
+  return ns / (2.0 * nb_round_trips);
+}
+
+void usage(const char *prog_name) {
+  printf("Usage: %s [-n <nb_round_trips>] [-r <nb_repeats>]\n"
+	 "\t -n: the number of round trips of the line between each pair of cpus (default is %d)\n"
+	 "\t -r: the number of times each pair is measured, the lowest latency being kept (default is %d)\n",
+	 prog_name, DEFAULT_NB_ROUND_TRIPS, DEFAULT_NB_REPEATS);
+}
+
+int main(int argc, char **argv) {
+  int nb_round_trips = DEFAULT_NB_ROUND_TRIPS;
+  int nb_repeats = DEFAULT_NB_REPEATS;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+    switch (opt) {
+    case 'n':
+      nb_round_trips = atoi(optarg);
+      break;
+    case 'r':
+      nb_repeats = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return -1;
+    }
+  }
+  if (nb_round_trips <= 0 || nb_repeats <= 0) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  /**
+   * The cpus the process may run on.
+   */
+  cpu_set_t allowed;
+  assert(sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+  int nb_cpus = CPU_COUNT(&allowed);
+  if (nb_cpus < 2) {
+    fprintf(stderr, "At least two cpus are needed\n");
+    return -1;
+  }
+  struct cpu_topology *cpus = malloc(nb_cpus * sizeof(struct cpu_topology));
+  double *latencies = malloc(nb_cpus * nb_cpus * sizeof(double));
+  assert(cpus);
+  assert(latencies);
+  int c = 0;
+  for (int cpu = 0; c < nb_cpus; cpu++) {
+    if (CPU_ISSET(cpu, &allowed)) {
+      read_topology(cpu, &cpus[c++]);
+    }
+  }
+
+  for (int i = 0; i < nb_cpus; i++) {
+    for (int j = 0; j < nb_cpus; j++) {
+      latencies[i * nb_cpus + j] = 0;
+      if (i == j) {
+	continue;
+      }
+      fprintf(stderr, "\rcpu %d -> cpu %d   ", cpus[i].cpu, cpus[j].cpu);
+      for (int r = 0; r < nb_repeats; r++) {
+	double latency = ping_pong(cpus[i].cpu, cpus[j].cpu, nb_round_trips);
+	if (r == 0 || latency < latencies[i * nb_cpus + j]) {
+	  latencies[i * nb_cpus + j] = latency;
+	}
+      }
+    }
+  }
+  fprintf(stderr, "\n");
+
+  printf("One way latency (ns)\n%-6s", "cpu");
+  for (int j = 0; j < nb_cpus; j++) {
+    printf(" %-7d", cpus[j].cpu);
+  }
+  printf("\n");
+  for (int i = 0; i < nb_cpus; i++) {
+    printf("%-6d", cpus[i].cpu);
+    for (int j = 0; j < nb_cpus; j++) {
+      if (i == j) {
+	printf(" %-7s", "-");
+      } else {
+	printf(" %-7.1f", latencies[i * nb_cpus + j]);
+      }
+    }
+    printf("\n");
+  }
+
+  printf("\nGroups (");
+  for (int g = 0; g < nb_groups; g++) {
+    printf("%s%c: %s", g == 0 ? "" : ", ", group_letters[g], group_names[g]);
+  }
+  printf(")\n%-6s", "cpu");
+  for (int j = 0; j < nb_cpus; j++) {
+    printf(" %-3d", cpus[j].cpu);
+  }
+  printf("\n");
+  for (int i = 0; i < nb_cpus; i++) {
+    printf("%-6d", cpus[i].cpu);
+    for (int j = 0; j < nb_cpus; j++) {
+      printf(" %-3c", i == j ? '-' : group_letters[group_of(&cpus[i], &cpus[j])]);
+    }
+    printf("\n");
+  }
+
+  printf("\n%-14s %-8s %-10s %-10s %-10s\n", "Group", "Pairs", "Min (ns)", "Avg (ns)", "Max (ns)");
+  for (int g = 0; g < nb_groups; g++) {
+    int nb_pairs = 0;
+    double min = 0, max = 0, sum = 0;
+    for (int i = 0; i < nb_cpus; i++) {
+      for (int j = 0; j < nb_cpus; j++) {
+	if (i == j || group_of(&cpus[i], &cpus[j]) != g) {
+	  continue;
+	}
+	double latency = latencies[i * nb_cpus + j];
+	if (nb_pairs == 0 || latency < min) {
+	  min = latency;
+	}
+	if (nb_pairs == 0 || latency > max) {
+	  max = latency;
+	}
+	sum += latency;
+	nb_pairs++;
+      }
+    }
+    if (nb_pairs > 0) {
+      printf("%-14s %-8d %-10.1f %-10.1f %-10.1f\n", group_names[g], nb_pairs, min, sum / nb_pairs, max);
+    }
+  }
+
+  free(latencies);
+  free(cpus);
+  return 0;
+}
@@ -1,82 +1,447 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <math.h>
+#include <unistd.h>
+#include <time.h> // For clock_gettime
+#include <pthread.h>
+#include <sys/sysinfo.h> // For get_nprocs()
+#include <sys/mman.h> // For mmap and madvise
 
 #include "mem_alloc.h"
 
 /**
- * Fills the pointer's array of the given size with each element points
- * to the next element.
+ * Number of rounds of the Feistel network used to shuffle the
+ * elements, and minimum number of elements given to each thread
+ * building a chain.
  */
-static void fill_memory_seq_npad(uint64_t *memory, size_t size, unsigned char npad) {
+#define FEISTEL_ROUNDS 4
+#define MIN_ELEMS_PER_THREAD (1 << 20)
 
-  size_t pointer_size = sizeof(char *);
-  if (size % pointer_size != 0) {
-    fprintf(stderr, "size = %zu must be a multiple of pointer_size = %zu\n", size, pointer_size);
-    exit(-1);
+/**
+ * Default parameters of the access patterns, and fraction of the
+ * elements visited by Zipf chains.
+ */
+#define DEFAULT_STRIDE 8
+#define DEFAULT_BLOCK_SIZE 64 * KiB
+#define DEFAULT_ZIPF_EXPONENT 0.99
+#define ZIPF_VISITED_FRACTION 4
+
+/**
+ * Cache line size used to spread the elements of access_tlb chains
+ * over the cache sets, and page sizes used when the system does not
+ * report them.
+ */
+#define LINE_SIZE 64
+#define DEFAULT_HUGE_PAGE_SIZE 2 * MiB
+
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+/**
+ * Pseudo-random permutation of [0, n) computed element by element,
+ * without any table: a balanced Feistel network over the smallest
+ * even number of bits covering n, restricted to [0, n) by cycle
+ * walking. Each call costs a few multiplications, so the permutation
+ * of billions of elements needs no scratch memory and can be computed
+ * by several threads at the same time.
+ */
+struct rand_perm {
+  uint64_t n;
+  unsigned int half_bits;
+  uint64_t half_mask;
+  uint64_t keys[FEISTEL_ROUNDS];
+};
+
+/**
+ * splitmix64 finalizer, used to derive round keys from the seed.
+ */
+static uint64_t mix64(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+/**
+ * Feistel round function: multiplicative hashing of the half block
+ * with the round key, keeping the high bits of the product which
+ * depend on all the bits of the input.
+ */
+static uint64_t round_function(const struct rand_perm *perm, uint64_t half, uint64_t key) {
+  return ((half ^ key) * 0x9e3779b97f4a7c15ULL + key) >> (64 - perm->half_bits);
+}
+
+static void rand_perm_init(struct rand_perm *perm, uint64_t n, uint64_t seed) {
+  unsigned int bits = n <= 4 ? 2 : 64 - __builtin_clzll(n - 1);
+  perm->n = n;
+  perm->half_bits = (bits + 1) / 2;
+  perm->half_mask = (1ULL << perm->half_bits) - 1;
+  for (int r = 0; r < FEISTEL_ROUNDS; r++) {
+    perm->keys[r] = mix64(seed + (r + 1) * 0x9e3779b97f4a7c15ULL);
   }
-  size_t nb_elems = size / pointer_size;
-  int i;
-  for(i = 0; i < nb_elems - 1; i++) {
-    memory[i] = (uint64_t)&memory[i+1];
+}
+
+static uint64_t rand_perm_get(const struct rand_perm *perm, uint64_t x) {
+  do {
+    uint64_t left = x >> perm->half_bits;
+    uint64_t right = x & perm->half_mask;
+    for (int r = 0; r < FEISTEL_ROUNDS; r++) {
+      uint64_t tmp = left ^ round_function(perm, right, perm->keys[r]);
+      left = right;
+      right = tmp;
+    }
+    x = (left << perm->half_bits) | right;
+  } while (x >= perm->n);
+  return x;
+}
+
+/**
+ * Order in which the elements of a memory region are chained. Element
+ * i starts at memory[i * elem_words], its first word holding the
+ * pointer to the next element and the remaining ones being padding.
+ *
+ * The chain visits length elements among the nb_elems elements of the
+ * region: all of them for most access modes, only whole pages for
+ * access_cross_page, a fraction of them for access_zipf and one per
+ * page for access_tlb.
+ */
+struct chain {
+  uint64_t *memory;
+  size_t elem_words;
+  uint64_t nb_elems;
+  uint64_t length;
+  enum access_mode_t access_mode;
+  uint64_t seed;
+
+  /* access_stride: each of the gcd(stride, nb_elems) cycles of
+     cycle_length elements is visited after the other */
+  uint64_t stride;
+  uint64_t cycle_length;
+
+  /* access_page_rand, access_block_rand, access_cross_page,
+     access_zipf and access_tlb: the region is split in blocks of
+     block_elems elements */
+  uint64_t block_elems;
+  uint64_t nb_blocks;
+
+  /* access_tlb: number of elements per cache line, the element of
+     block i being on its i-th line */
+  uint64_t line_elems;
+
+  /* access_rand: order of the elements, access_cross_page: order of
+     the slots within pages, access_zipf: order of the visits,
+     access_tlb: order of the pages */
+  struct rand_perm perm;
+
+  /* access_zipf: blocks by decreasing popularity, prefix sums of the
+     number of visits of the blocks in this order, and element visited
+     first, swapped with element 0 so that the chain goes through the
+     start of the region like for the other access modes */
+  struct rand_perm rank_perm;
+  uint64_t *zipf_visits;
+  uint64_t zipf_first;
+};
+
+static uint64_t gcd(uint64_t a, uint64_t b) {
+  while (b != 0) {
+    uint64_t tmp = a % b;
+    a = b;
+    b = tmp;
+  }
+  return a;
+}
+
+/**
+ * Returns the index in [0, n) of x in the pseudo-random permutation of
+ * [0, n) derived from seed and tweak, used to shuffle each block with
+ * its own permutation.
+ */
+static uint64_t derived_perm_get(uint64_t n, uint64_t seed, uint64_t tweak, uint64_t x) {
+  struct rand_perm perm;
+  rand_perm_init(&perm, n, seed ^ mix64(tweak + 1));
+  return rand_perm_get(&perm, x);
+}
+
+/**
+ * Returns the rank of the block hosting the given visit of a Zipf
+ * chain, from the prefix sums of the visits of each rank.
+ */
+static uint64_t zipf_rank(const struct chain *chain, uint64_t visit) {
+  uint64_t low = 0;
+  uint64_t high = chain->nb_blocks;
+  while (high - low > 1) {
+    uint64_t middle = low + (high - low) / 2;
+    if (chain->zipf_visits[middle] <= visit) {
+      low = middle;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+/**
+ * Returns the index of the element at the given position in the
+ * chain.
+ */
+static uint64_t chain_elem(const struct chain *chain, uint64_t pos) {
+  uint64_t block, first, slot;
+  switch (chain->access_mode) {
+  case access_seq:
+    return pos;
+  case access_reverse:
+    return chain->nb_elems - 1 - pos;
+  case access_rand:
+    return rand_perm_get(&chain->perm, pos);
+  case access_stride:
+    return (pos / chain->cycle_length + (unsigned __int128)(pos % chain->cycle_length) * chain->stride) % chain->nb_elems;
+  case access_page_rand:
+  case access_block_rand:
+    block = pos / chain->block_elems;
+    first = block * chain->block_elems;
+    slot = derived_perm_get(chain->nb_elems - first < chain->block_elems ? chain->nb_elems - first : chain->block_elems,
+			    chain->seed, block, pos - first);
+    return first + slot;
+  case access_cross_page:
+    slot = rand_perm_get(&chain->perm, pos / chain->nb_blocks);
+    block = derived_perm_get(chain->nb_blocks, chain->seed, pos / chain->nb_blocks, pos % chain->nb_blocks);
+    return block * chain->block_elems + slot;
+  case access_zipf:
+    pos = rand_perm_get(&chain->perm, pos);
+    uint64_t rank = zipf_rank(chain, pos);
+    block = rand_perm_get(&chain->rank_perm, rank);
+    slot = derived_perm_get(chain->block_elems, chain->seed, block, pos - chain->zipf_visits[rank]);
+    first = block * chain->block_elems + slot;
+    if (first == chain->zipf_first) {
+      return 0;
+    }
+    return first == 0 ? chain->zipf_first : first;
+  case access_tlb:
+    block = rand_perm_get(&chain->perm, pos);
+    return block * chain->block_elems + (block * chain->line_elems) % chain->block_elems;
+  default:
+    assert(NULL);
+  }
+  return 0;
+}
+
+/**
+ * Splits the visits of a Zipf chain between its blocks: the block of
+ * rank r gets a share of the visits proportional to 1 / r^exponent,
+ * capped to its number of elements, the visits it cannot take being
+ * spread over the following ranks. Returns the number of visits.
+ */
+static uint64_t zipf_split_visits(struct chain *chain, double exponent) {
+  uint64_t nb_blocks = chain->nb_blocks;
+  chain->zipf_visits = malloc((nb_blocks + 1) * sizeof(uint64_t));
+  assert(chain->zipf_visits);
+  double remaining_weight = 0;
+  for (uint64_t rank = 0; rank < nb_blocks; rank++) {
+    remaining_weight += pow(rank + 1, -exponent);
+  }
+  uint64_t remaining = nb_blocks * chain->block_elems / ZIPF_VISITED_FRACTION;
+  if (remaining == 0) {
+    remaining = 1;
+  }
+  uint64_t nb_visits = 0;
+  for (uint64_t rank = 0; rank < nb_blocks; rank++) {
+    double weight = pow(rank + 1, -exponent);
+    uint64_t visits = llround(remaining * weight / remaining_weight);
+    if (visits > remaining || rank == nb_blocks - 1) {
+      visits = remaining;
+    }
+    if (visits > chain->block_elems) {
+      visits = chain->block_elems;
+    }
+    chain->zipf_visits[rank] = nb_visits;
+    nb_visits += visits;
+    remaining -= visits;
+    remaining_weight -= weight;
   }
-  memory[i] = (uint64_t)&memory[0];
+  chain->zipf_visits[nb_blocks] = nb_visits;
+  return nb_visits;
 }
 
 /**
- * Structure used along with the following compar function to shuffle
- * an array of N elements.
+ * Part of the chain built by one thread: the elements at positions
+ * first up to last (excluded) in the chain are each made to point to
+ * the element following them. The element at the last position points
+ * to the one at the first position, closing the cycle.
  */
-struct rand_struct {
-  int index;
-  int rand;
+struct link_task {
+  const struct chain *chain;
+  uint64_t first;
+  uint64_t last;
 };
 
-static int compar(const void* a1, const void* a2) {
-  struct rand_struct *a = (struct rand_struct*) a1;
-  struct rand_struct *b = (struct rand_struct*) a2;
-  return a->rand - b->rand;
+static void *link_elems(void *arg) {
+  struct link_task *task = arg;
+  const struct chain *chain = task->chain;
+  uint64_t *memory = chain->memory;
+  size_t elem_words = chain->elem_words;
+  uint64_t current = chain_elem(chain, task->first);
+  for (uint64_t pos = task->first; pos < task->last; pos++) {
+    uint64_t next = chain_elem(chain, pos + 1 == chain->length ? 0 : pos + 1);
+    memory[current * elem_words] = (uint64_t)&memory[next * elem_words];
+    current = next;
+  }
+  return NULL;
+}
+
+static unsigned int get_nb_threads(unsigned int nb_threads, uint64_t nb_elems) {
+  if (nb_threads == 0) {
+    nb_threads = get_nprocs();
+    if (nb_threads > nb_elems / MIN_ELEMS_PER_THREAD) {
+      nb_threads = nb_elems / MIN_ELEMS_PER_THREAD;
+    }
+  }
+  if (nb_threads > nb_elems) {
+    nb_threads = nb_elems;
+  }
+  return nb_threads > 0 ? nb_threads : 1;
 }
 
 /**
- * Fills the pointer's array of the given size with each element
- * pointing to another pseudo-random element in the array. All the
- * elements of the array are pointed to exactly by one other
- * element. The last element always points to the first one.
+ * Links all the elements of the chain, splitting the chain in as many
+ * parts as threads, the calling thread taking care of the first part.
  */
-static void fill_memory_rand_npad(uint64_t *memory, size_t size, unsigned char npad) {
+static void link_chain(const struct chain *chain, unsigned int nb_threads) {
+  uint64_t length = chain->length;
+  nb_threads = get_nb_threads(nb_threads, length);
+  struct link_task *tasks = malloc(nb_threads * sizeof(struct link_task));
+  pthread_t *threads = malloc(nb_threads * sizeof(pthread_t));
+  unsigned char *started = calloc(nb_threads, sizeof(unsigned char));
+  assert(tasks);
+  assert(threads);
+  assert(started);
+  for (unsigned int t = 0; t < nb_threads; t++) {
+    tasks[t].chain = chain;
+    tasks[t].first = length / nb_threads * t;
+    tasks[t].last = t == nb_threads - 1 ? length : length / nb_threads * (t + 1);
+  }
+  for (unsigned int t = 1; t < nb_threads; t++) {
+    started[t] = pthread_create(&threads[t], NULL, link_elems, &tasks[t]) == 0;
+  }
+  link_elems(&tasks[0]);
+  for (unsigned int t = 1; t < nb_threads; t++) {
+    if (started[t]) {
+      pthread_join(threads[t], NULL);
+    } else {
+      link_elems(&tasks[t]);
+    }
+  }
+  free(started);
+  free(threads);
+  free(tasks);
+}
 
-  size_t pointer_size = sizeof(void *);
-  if (size % pointer_size != 0) {
-    fprintf(stderr, "size = %zu must be a multiple of pointer_size = %zu\n", size, pointer_size);
-    exit(0);
+/**
+ * Names of the access patterns, as given to parse_access_pattern.
+ */
+static const struct {
+  const char *name;
+  enum access_mode_t access_mode;
+} access_patterns[] = {
+  {"seq", access_seq},
+  {"rand", access_rand},
+  {"reverse", access_reverse},
+  {"stride", access_stride},
+  {"page", access_page_rand},
+  {"pages", access_cross_page},
+  {"block", access_block_rand},
+  {"zipf", access_zipf},
+  {"tlb", access_tlb}
+};
+
+#define NB_ACCESS_PATTERNS (sizeof(access_patterns) / sizeof(access_patterns[0]))
+
+const char *access_mode_name(enum access_mode_t access_mode) {
+  for (int i = 0; i < NB_ACCESS_PATTERNS; i++) {
+    if (access_patterns[i].access_mode == access_mode) {
+      return access_patterns[i].name;
+    }
   }
-  size_t nb_elems = size / pointer_size;
+  return "undef";
+}
+
+int parse_access_pattern(const char *spec, enum access_mode_t *access_mode, struct fill_params *params) {
+  char name[32];
+  size_t name_len = strcspn(spec, ":@");
+  if (name_len >= sizeof(name)) {
+    return -1;
+  }
+  memcpy(name, spec, name_len);
+  name[name_len] = '\0';
 
-  /**
-   * Creates another array and shuffle it.
-   */
-  size_t rand_memory_size = nb_elems * sizeof(struct rand_struct);
-  struct rand_struct *rand_memory = malloc(rand_memory_size);
-  memset(rand_memory, 0, rand_memory_size);
-  assert(rand_memory);
-  unsigned int seed = 1;
-  for (int i = 0; i < nb_elems; i++) {
-    rand_memory[i].index = i;
-    rand_memory[i].rand = rand_r(&seed);
+  *access_mode = access_undef;
+  for (int i = 0; i < NB_ACCESS_PATTERNS; i++) {
+    if (!strcmp(access_patterns[i].name, name)) {
+      *access_mode = access_patterns[i].access_mode;
+    }
+  }
+  if (*access_mode == access_undef) {
+    return -1;
   }
-  qsort(&rand_memory[1], nb_elems - 1, sizeof(*rand_memory), compar);
 
-  /**
-   * Fills the array with pointers to a next random element using the
-   * shuffled memory array.
-   */
-  int i;
-  for(i = 0; i < nb_elems - 1; i++) {
-    memory[i] = (uint64_t)&memory[rand_memory[i + 1].index];
+  const char *arg = spec[name_len] == ':' ? spec + name_len + 1 : NULL;
+  const char *seed = strchr(spec, '@');
+  if (arg != NULL) {
+    char *end;
+    uint64_t count = 1;
+    switch (*access_mode) {
+    case access_stride:
+      params->stride = count = strtoull(arg, &end, 0);
+      break;
+    case access_block_rand:
+      count = strtoull(arg, &end, 0);
+      if (count > SIZE_MAX / KiB) {
+	return -1;
+      }
+      params->block_size = count * KiB;
+      break;
+    case access_zipf:
+      params->zipf_exponent = strtod(arg, &end);
+      if (!isfinite(params->zipf_exponent)) {
+	return -1;
+      }
+      break;
+    case access_tlb:
+      count = strtoull(arg, &end, 0);
+      if (count > SIZE_MAX / KiB || (count & (count - 1)) != 0) {
+	return -1; // Page sizes are powers of two
+      }
+      params->page_size = count * KiB;
+      break;
+    default:
+      return -1;
+    }
+
+    // Numbers of elements and sizes are neither negative nor zero
+    if (end == arg || (*end != '\0' && *end != '@') || count == 0 || arg[0] == '-') {
+      return -1;
+    }
+  }
+  if (seed != NULL) {
+    char *end;
+    params->seed = strtoull(seed + 1, &end, 0);
+    if (end == seed + 1 || *end != '\0') {
+      return -1;
+    }
   }
-  memory[i] = (uint64_t)&memory[0];
-  free(rand_memory);
+  return 0;
+}
+
+void fill_params_init(struct fill_params *params) {
+  params->seed = FILL_DEFAULT_SEED;
+  params->nb_threads = 0;
+  params->stride = DEFAULT_STRIDE;
+  params->block_size = DEFAULT_BLOCK_SIZE;
+  params->zipf_exponent = DEFAULT_ZIPF_EXPONENT;
+  params->page_size = sysconf(_SC_PAGESIZE);
 }
 
 /**
@@ -88,14 +453,17 @@ static void fill_memory_rand_npad(uint64_t *memory, size_t size, unsigned char n
  *
  * If random, fills the pointer's array of the given size with each
  * element pointing to another pseudo-random element in the array. All
- * the elements of the array are pointed to exactly by one other
- * element. The last element always points to the first one.
+ * the elements of the array form a single cycle, so following the
+ * pointers from any element visits every element exactly once before
+ * coming back to it.
  *
  * Calling this function is the same as calling fill_memory_npad with
  * npad=0.
+ *
+ * Returns the time spent filling the memory, in seconds.
  */
-void fill_memory(uint64_t *memory, size_t size, enum access_mode_t access_mode) {
-  fill_memory_npad(memory, size, access_mode, 0);
+double fill_memory(uint64_t *memory, size_t size, enum access_mode_t access_mode) {
+  return fill_memory_npad(memory, size, access_mode, 0);
 }
 
 /**
@@ -103,17 +471,206 @@ void fill_memory(uint64_t *memory, size_t size, enum access_mode_t access_mode)
  * specify the size of each element in the filled memory
  * region. Usefull to play with when one wants to understand
  * prefecthing effects.
+ *
+ * Each element is made of the pointer to the next element followed by
+ * npad padding words, so that elements are (npad + 1) * 8 bytes
+ * apart: npad=7 gives one element per cache line and npad=511 one
+ * element per 4 KiB page. Sequential chains then walk memory with a
+ * fixed stride of one element. Bytes at the end of the region which
+ * do not fit a whole element are left untouched.
  */
-void fill_memory_npad(uint64_t *memory, size_t size, enum access_mode_t access_mode, unsigned char npad) {
+double fill_memory_npad(uint64_t *memory, size_t size, enum access_mode_t access_mode, size_t npad) {
+  struct fill_params params;
+  fill_params_init(&params);
+  return fill_memory_params(memory, size, access_mode, npad, &params);
+}
+
+/**
+ * Same as above, but with explicit parameters instead of the default
+ * ones. Elements are chained in the order given by the access mode,
+ * the last one in this order pointing to the first one: like with
+ * Sattolo's algorithm, the visited elements form a single cycle.
+ */
+double fill_memory_params(uint64_t *memory, size_t size, enum access_mode_t access_mode, size_t npad, const struct fill_params *params) {
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  size_t pointer_size = sizeof(void *);
+  if (size % pointer_size != 0) {
+    fprintf(stderr, "size = %zu must be a multiple of pointer_size = %zu\n", size, pointer_size);
+    exit(-1);
+  }
+  size_t elem_size = (npad + 1) * pointer_size;
+  struct chain chain;
+  memset(&chain, 0, sizeof(chain));
+  chain.memory = memory;
+  chain.elem_words = npad + 1;
+  chain.nb_elems = size / elem_size;
+  chain.length = chain.nb_elems;
+  chain.access_mode = access_mode;
+  chain.seed = params->seed;
+  if (chain.nb_elems == 0) {
+    fprintf(stderr, "size = %zu must be at least the element size = %zu\n", size, elem_size);
+    exit(-1);
+  }
+
+  size_t block_size = sysconf(_SC_PAGESIZE);
+  if (access_mode == access_block_rand) {
+    block_size = params->block_size;
+  } else if (access_mode == access_tlb) {
+    block_size = params->page_size;
+  }
+  chain.block_elems = block_size > elem_size ? block_size / elem_size : 1;
+  if (chain.block_elems > chain.nb_elems) {
+    chain.block_elems = chain.nb_elems;
+  }
+  chain.nb_blocks = chain.nb_elems / chain.block_elems;
 
   switch (access_mode) {
   case access_seq:
-    fill_memory_seq_npad(memory, size, npad);
+  case access_reverse:
+  case access_page_rand:
+  case access_block_rand:
     break;
   case access_rand:
-    fill_memory_rand_npad(memory, size, npad);
+    rand_perm_init(&chain.perm, chain.nb_elems, params->seed);
+    break;
+  case access_stride:
+    chain.stride = params->stride % chain.nb_elems;
+    if (chain.stride == 0) {
+      chain.stride = 1;
+    }
+    chain.cycle_length = chain.nb_elems / gcd(chain.stride, chain.nb_elems);
+    break;
+  case access_cross_page:
+    chain.length = chain.nb_blocks * chain.block_elems;
+    rand_perm_init(&chain.perm, chain.block_elems, params->seed);
+    break;
+  case access_zipf:
+    chain.length = zipf_split_visits(&chain, params->zipf_exponent);
+    rand_perm_init(&chain.perm, chain.length, params->seed);
+    rand_perm_init(&chain.rank_perm, chain.nb_blocks, ~params->seed);
+    chain.zipf_first = chain_elem(&chain, 0);
+    break;
+  case access_tlb:
+    chain.length = chain.nb_blocks;
+    chain.line_elems = LINE_SIZE > elem_size ? (LINE_SIZE + elem_size - 1) / elem_size : 1;
+    rand_perm_init(&chain.perm, chain.nb_blocks, params->seed);
     break;
   default:
     assert(NULL);
   }
+  link_chain(&chain, params->nb_threads);
+  free(chain.zipf_visits);
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1E9;
+}
+
+/**
+ * Returns the value in bytes of the given key of a kernel file made of
+ * "key value unit" lines, or 0 if not found. Values in kB are
+ * converted to bytes.
+ */
+static size_t read_size(const char *path, const char *key) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    return 0;
+  }
+  char *linep = NULL;
+  size_t n = 0;
+  size_t size = 0;
+  while (getline(&linep, &n, f) > 0) {
+    if (strstr(linep, key) != linep) {
+      continue;
+    }
+    char *end;
+    size = strtoull(linep + strlen(key), &end, 0);
+    if (strstr(end, "kB") != NULL) {
+      size *= KiB;
+    }
+    break;
+  }
+  free(linep);
+  fclose(f);
+  return size;
+}
+
+size_t page_type_size(enum page_type_t page_type) {
+  size_t size = 0;
+  switch (page_type) {
+  case page_small:
+    return sysconf(_SC_PAGESIZE);
+  case page_thp:
+    size = read_size("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "");
+    break;
+  case page_hugetlb:
+    size = read_size("/proc/meminfo", "Hugepagesize:");
+    break;
+  case page_hugetlb_1g:
+    return GiB;
+  }
+  return size != 0 ? size : DEFAULT_HUGE_PAGE_SIZE;
+}
+
+void *alloc_memory(size_t size, enum page_type_t page_type) {
+  size_t page_size = page_type_size(page_type);
+  size = (size + page_size - 1) / page_size * page_size;
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  char *memory;
+  switch (page_type) {
+  case page_small:
+    memory = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (memory != MAP_FAILED) {
+      madvise(memory, size, MADV_NOHUGEPAGE);
+    }
+    break;
+  case page_thp:
+    /**
+     * Over-allocate by one page, then unmap the unaligned head and the
+     * tail.
+     */
+    memory = mmap(NULL, size + page_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (memory != MAP_FAILED) {
+      size_t head = (page_size - (uintptr_t)memory % page_size) % page_size;
+      if (head != 0) {
+	munmap(memory, head);
+      }
+      munmap(memory + head + size, page_size - head);
+      memory += head;
+      madvise(memory, size, MADV_HUGEPAGE);
+    }
+    break;
+  case page_hugetlb:
+    memory = mmap(NULL, size, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+    break;
+  case page_hugetlb_1g:
+    memory = mmap(NULL, size, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB | MAP_HUGE_1GB, -1, 0);
+    break;
+  default:
+    return NULL;
+  }
+  return memory == MAP_FAILED ? NULL : memory;
+}
+
+void free_memory(void *memory, size_t size, enum page_type_t page_type) {
+  size_t page_size = page_type_size(page_type);
+  munmap(memory, (size + page_size - 1) / page_size * page_size);
+}
+
+static const char *page_type_names[] = {"4k", "thp", "hugetlb", "1g"};
+
+const char *page_type_name(enum page_type_t page_type) {
+  return page_type_names[page_type];
+}
+
+int parse_page_type(const char *name, enum page_type_t *page_type) {
+  for (int i = 0; i < sizeof(page_type_names) / sizeof(page_type_names[0]); i++) {
+    if (!strcmp(page_type_names[i], name)) {
+      *page_type = i;
+      return 0;
+    }
+  }
+  return -1;
 }
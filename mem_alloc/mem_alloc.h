@@ -8,12 +8,114 @@
 #define MiB KiB*1024
 #define GiB MiB*1024
 
+#define FILL_DEFAULT_SEED 1
+
+/**
+ * Order in which the elements of a filled memory region are chained:
+ *
+ * access_seq: in memory order.
+ * access_rand: pseudo-random order over the whole region.
+ * access_reverse: in reverse memory order.
+ * access_stride: stride elements apart, wrapping around the region.
+ * access_page_rand: pages in memory order, pseudo-random order
+ *   within each page.
+ * access_cross_page: one element per page, pages in pseudo-random
+ *   order, so that each access touches a different page (TLB
+ *   hostile). Bytes after the last whole page are not visited.
+ * access_block_rand: same as access_page_rand with blocks of
+ *   block_size bytes.
+ * access_zipf: hot/cold mix over pages, the page of rank r being
+ *   visited proportionally to 1 / r^zipf_exponent (at most once per
+ *   element). Hot pages are spread pseudo-randomly over the region
+ *   and visits are done in pseudo-random order. Only a quarter of the
+ *   elements are visited.
+ * access_tlb: a single element per page of page_size bytes, pages in
+ *   pseudo-random order. The element of the i-th page is on its i-th
+ *   cache line (or element, when larger than a line) modulo the page
+ *   size, so that the visited elements spread over all the cache sets
+ *   and only the TLB misses.
+ */
 enum access_mode_t {
   access_undef,
   access_seq,
-  access_rand
+  access_rand,
+  access_reverse,
+  access_stride,
+  access_page_rand,
+  access_cross_page,
+  access_block_rand,
+  access_zipf,
+  access_tlb
 };
 
+/**
+ * Pages backing a memory region allocated by alloc_memory:
+ *
+ * page_small: base pages, transparent huge pages being disabled for
+ *   the region.
+ * page_thp: transparent huge pages, the region being aligned on their
+ *   size (the kernel may still back parts of it with base pages).
+ * page_hugetlb: default size hugetlbfs pages (MAP_HUGETLB), which must
+ *   have been reserved in /proc/sys/vm/nr_hugepages.
+ * page_hugetlb_1g: 1 GiB hugetlbfs pages.
+ */
+enum page_type_t {
+  page_small,
+  page_thp,
+  page_hugetlb,
+  page_hugetlb_1g
+};
+
+#define PAGE_TYPE_HELP "4k, thp, hugetlb or 1g\n"
+
+/**
+ * Syntax of the access patterns accepted by parse_access_pattern, to
+ * be printed in the usage of the programs using this library.
+ */
+#define ACCESS_PATTERN_HELP \
+  "name[:arg][@seed] with name one of seq, rand, reverse, stride[:elements], page,\n" \
+  "\t    pages, block[:KiB], zipf[:exponent], tlb[:page_KiB], e.g. rand@42, block:16 or zipf:1.2\n"
+
+/**
+ * Parameters used to fill a memory region.
+ *
+ * seed: seed of the pseudo-random fillers. A given seed always gives
+ * the same chain, whatever the number of threads used to build it.
+ *
+ * nb_threads: number of threads building the chain, 0 to use all the
+ * online cpus when the region is large enough to benefit from it.
+ *
+ * stride, block_size, zipf_exponent and page_size: parameters of the
+ * access_stride (in elements), access_block_rand (in bytes),
+ * access_zipf and access_tlb (in bytes) access modes.
+ */
+struct fill_params {
+  uint64_t seed;
+  unsigned int nb_threads;
+  uint64_t stride;
+  size_t block_size;
+  double zipf_exponent;
+  size_t page_size;
+};
+
+/**
+ * Sets the given parameters to their default values.
+ */
+void fill_params_init(struct fill_params *params);
+
+/**
+ * Parses an access pattern given by name as described by
+ * ACCESS_PATTERN_HELP, setting the access mode and, if given, its
+ * argument and seed in params. Returns 0 on success and -1 if the
+ * pattern is invalid.
+ */
+int parse_access_pattern(const char *spec, enum access_mode_t *access_mode, struct fill_params *params);
+
+/**
+ * Returns the name of the given access mode.
+ */
+const char *access_mode_name(enum access_mode_t access_mode);
+
 /**
  * Fills the given memory region either sequentially or pseudo
  * randomly.
@@ -23,20 +125,69 @@ enum access_mode_t {
  *
  * If random, fills the pointer's array of the given size with each
  * element pointing to another pseudo-random element in the array. All
- * the elements of the array are pointed to exactly by one other
- * element. The last element always points to the first one.
+ * the elements of the array form a single cycle, so following the
+ * pointers from any element visits every element exactly once before
+ * coming back to it.
  *
  * Calling this function is the same as calling fill_memory_npad with
  * npad=0.
+ *
+ * Returns the time spent filling the memory, in seconds.
  */
-void fill_memory(uint64_t *memory, size_t size, enum access_mode_t access_mode);
+double fill_memory(uint64_t *memory, size_t size, enum access_mode_t access_mode);
 
 /**
  * Same as above, but with additional npad parameter allowing to
  * specify the size of each element in the filled memory
  * region. Usefull to play with when one wants to understand
  * prefecthing effects.
+ *
+ * Each element is made of the pointer to the next element followed by
+ * npad padding words, so that elements are (npad + 1) * 8 bytes
+ * apart: npad=7 gives one element per cache line and npad=511 one
+ * element per 4 KiB page. Sequential chains then walk memory with a
+ * fixed stride of one element. Bytes at the end of the region which
+ * do not fit a whole element are left untouched.
+ */
+double fill_memory_npad(uint64_t *memory, size_t size, enum access_mode_t access_mode, size_t npad);
+
+/**
+ * Same as above, but with explicit parameters instead of the default
+ * ones, allowing to use any access mode. Elements are chained in the
+ * order given by the access mode, the last one in this order pointing
+ * to the first one: like with Sattolo's algorithm, the visited
+ * elements form a single cycle.
+ */
+double fill_memory_params(uint64_t *memory, size_t size, enum access_mode_t access_mode, size_t npad, const struct fill_params *params);
+
+/**
+ * Allocates size bytes backed by the given type of pages, rounded up
+ * to a whole number of pages. Returns NULL if the pages cannot be
+ * allocated, e.g. when no hugetlbfs page is reserved.
+ */
+void *alloc_memory(size_t size, enum page_type_t page_type);
+
+/**
+ * Frees memory allocated by alloc_memory with the same size and page
+ * type.
+ */
+void free_memory(void *memory, size_t size, enum page_type_t page_type);
+
+/**
+ * Returns the size in bytes of the given type of pages.
+ */
+size_t page_type_size(enum page_type_t page_type);
+
+/**
+ * Returns the name of the given type of pages, as accepted by
+ * parse_page_type.
+ */
+const char *page_type_name(enum page_type_t page_type);
+
+/**
+ * Parses a type of pages given by name as described by
+ * PAGE_TYPE_HELP. Returns 0 on success and -1 if the name is unknown.
  */
-void fill_memory_npad(uint64_t *memory, size_t size, enum access_mode_t access_mode, unsigned char npad);
+int parse_page_type(const char *name, enum page_type_t *page_type);
 
 #endif
@@ -0,0 +1,363 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#define LINE_SIZE 64
+#define DEFAULT_DURATION_MS 200
+
+/**
+ * Where the threads operate: all on the same variable (shared), each on
+ * its own variable next to the others' (packed, the variables sharing
+ * lines: false sharing), or each on its own line (padded).
+ */
+enum layout_t {layout_shared, layout_packed, layout_padded, nb_layouts};
+
+static const char *layout_names[] = {"shared", "packed", "padded"};
+
+/**
+ * Queue node of the MCS lock, one per thread.
+ */
+struct mcs_node {
+  struct mcs_node *volatile next;
+  volatile int locked;
+} __attribute__((aligned(LINE_SIZE)));
+
+struct ticket_lock {
+  volatile uint32_t next;
+  volatile uint32_t owner;
+  uint64_t counter;
+};
+
+struct mcs_lock {
+  struct mcs_node *volatile tail;
+  uint64_t counter;
+};
+
+struct mutex_lock {
+  pthread_mutex_t mutex;
+  uint64_t counter;
+};
+
+/**
+ * Load generator thread running one operation on state until stop is
+ * set.
+ */
+struct worker {
+  pthread_t thread;
+  int cpu;
+  void *state;
+  const struct operation *operation;
+  pthread_barrier_t *barrier;
+  uint64_t nb_ops;
+  double elapsed_ns;
+  struct mcs_node node;
+};
+
+static volatile int stop = 0;
+static volatile uint64_t sink;
+
+/**
+ * An operation works on state_size bytes, initialized by init, and its
+ * loop repeats it until stop is set, returning the number of times.
+ */
+struct operation {
+  const char *name;
+  size_t state_size;
+  void (*init)(void *state);
+  uint64_t (*loop)(void *state, struct worker *worker);
+};
+
+static void init_counter(void *state) {
+  *(uint64_t *)state = 0;
+}
+
+static uint64_t loop_xadd(void *state, struct worker *worker) {
+  uint64_t *counter = state;
+  uint64_t n = 0, sum = 0;
+  while (!stop) {
+    sum += __atomic_fetch_add(counter, 1, __ATOMIC_SEQ_CST);
+    n++;
+  }
+  sink = sum;
+  return n;
+}
+
+static uint64_t loop_cas(void *state, struct worker *worker) {
+  uint64_t *counter = state;
+  uint64_t n = 0;
+  while (!stop) {
+    uint64_t old = __atomic_load_n(counter, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(counter, &old, old + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+    }
+    n++;
+  }
+  return n;
+}
+
+static uint64_t loop_xchg(void *state, struct worker *worker) {
+  uint64_t *value = state;
+  uint64_t n = 0, sum = 0;
+  while (!stop) {
+    sum += __atomic_exchange_n(value, n, __ATOMIC_SEQ_CST);
+    n++;
+  }
+  sink = sum;
+  return n;
+}
+
+static void init_ticket(void *state) {
+  memset(state, 0, sizeof(struct ticket_lock));
+}
+
+static uint64_t loop_ticket(void *state, struct worker *worker) {
+  struct ticket_lock *lock = state;
+  uint64_t n = 0;
+  while (!stop) {
+    uint32_t ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+    while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+      asm volatile("pause");
+    }
+    lock->counter++;
+    __atomic_store_n(&lock->owner, ticket + 1, __ATOMIC_RELEASE);
+    n++;
+  }
+  return n;
+}
+
+static void init_mcs(void *state) {
+  memset(state, 0, sizeof(struct mcs_lock));
+}
+
+static uint64_t loop_mcs(void *state, struct worker *worker) {
+  struct mcs_lock *lock = state;
+  struct mcs_node *node = &worker->node;
+  uint64_t n = 0;
+  while (!stop) {
+    node->next = NULL;
+    node->locked = 1;
+    struct mcs_node *predecessor = __atomic_exchange_n(&lock->tail, node, __ATOMIC_ACQ_REL);
+    if (predecessor != NULL) {
+      __atomic_store_n(&predecessor->next, node, __ATOMIC_RELEASE);
+      while (__atomic_load_n(&node->locked, __ATOMIC_ACQUIRE)) {
+	asm volatile("pause");
+      }
+    }
+    lock->counter++;
+    struct mcs_node *successor = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+    if (successor == NULL) {
+      struct mcs_node *expected = node;
+      if (__atomic_compare_exchange_n(&lock->tail, &expected, NULL, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+	n++;
+	continue;
+      }
+      while ((successor = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) == NULL) {
+	asm volatile("pause");
+      }
+    }
+    __atomic_store_n(&successor->locked, 0, __ATOMIC_RELEASE);
+    n++;
+  }
+  return n;
+}
+
+static void init_mutex(void *state) {
+  struct mutex_lock *lock = state;
+  pthread_mutex_init(&lock->mutex, NULL);
+  lock->counter = 0;
+}
+
+static uint64_t loop_mutex(void *state, struct worker *worker) {
+  struct mutex_lock *lock = state;
+  uint64_t n = 0;
+  while (!stop) {
+    pthread_mutex_lock(&lock->mutex);
+    lock->counter++;
+    pthread_mutex_unlock(&lock->mutex);
+    n++;
+  }
+  return n;
+}
+
+static const struct operation operations[] = {
+  {"xadd", sizeof(uint64_t), init_counter, loop_xadd},
+  {"cas", sizeof(uint64_t), init_counter, loop_cas},
+  {"xchg", sizeof(uint64_t), init_counter, loop_xchg},
+  {"ticket", sizeof(struct ticket_lock), init_ticket, loop_ticket},
+  {"mcs", sizeof(struct mcs_lock), init_mcs, loop_mcs},
+  {"mutex", sizeof(struct mutex_lock), init_mutex, loop_mutex}
+};
+
+#define NB_OPERATIONS (sizeof(operations) / sizeof(operations[0]))
+
+static void *run_worker(void *arg) {
+  struct worker *worker = arg;
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  CPU_SET(worker->cpu, &mask);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask)) {
+    fprintf(stderr, "Cannot pin worker on cpu %d\n", worker->cpu);
+  }
+  pthread_barrier_wait(worker->barrier);
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  worker->nb_ops = worker->operation->loop(worker->state, worker);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  worker->elapsed_ns = (end.tv_sec * 1E9 + end.tv_nsec) - (start.tv_sec * 1E9 + start.tv_nsec);
+  return NULL;
+}
+
+/**
+ * Runs operation with nb_threads threads pinned on the first cpus for
+ * duration_ms in the given layout, and prints the throughput, the
+ * average latency of an operation seen by each thread and the fairness
+ * of the threads: the ratio of the fewest to the most operations, and
+ * Jain's index (1 when all the threads did as many operations).
+ */
+static void run_point(const struct operation *operation, enum layout_t layout, int nb_threads,
+		      const int *cpus, int nb_cpus, int duration_ms) {
+  size_t stride = operation->state_size;
+  if (layout == layout_padded) {
+    stride = (stride + LINE_SIZE - 1) / LINE_SIZE * LINE_SIZE;
+  }
+  char *states;
+  assert(posix_memalign((void **)&states, LINE_SIZE, nb_threads * stride) == 0);
+  struct worker *workers;
+  assert(posix_memalign((void **)&workers, LINE_SIZE, nb_threads * sizeof(struct worker)) == 0);
+  pthread_barrier_t barrier;
+  pthread_barrier_init(&barrier, NULL, nb_threads + 1);
+
+  for (int t = 0; t < (layout == layout_shared ? 1 : nb_threads); t++) {
+    operation->init(states + t * stride);
+  }
+  stop = 0;
+  for (int t = 0; t < nb_threads; t++) {
+    memset(&workers[t], 0, sizeof(struct worker));
+    workers[t].cpu = cpus[t % nb_cpus];
+    workers[t].state = states + (layout == layout_shared ? 0 : t * stride);
+    workers[t].operation = operation;
+    workers[t].barrier = &barrier;
+    assert(pthread_create(&workers[t].thread, NULL, run_worker, &workers[t]) == 0);
+  }
+  pthread_barrier_wait(&barrier);
+  struct timespec duration = {duration_ms / 1000, (duration_ms % 1000) * 1000000L};
+  nanosleep(&duration, NULL);
+  stop = 1;
+
+  uint64_t total = 0, min = UINT64_MAX, max = 0;
+  double squares = 0, elapsed = 0, latency_sum = 0;
+  for (int t = 0; t < nb_threads; t++) {
+    pthread_join(workers[t].thread, NULL);
+    uint64_t n = workers[t].nb_ops;
+    total += n;
+    squares += (double)n * n;
+    min = n < min ? n : min;
+    max = n > max ? n : max;
+    elapsed = workers[t].elapsed_ns > elapsed ? workers[t].elapsed_ns : elapsed;
+    latency_sum += n > 0 ? workers[t].elapsed_ns / n : 0;
+  }
+  printf("%-8d %-12.3f %-12.1f %-14.3f %-10.3f\n", nb_threads, total * 1E3 / elapsed, latency_sum / nb_threads,
+	 max > 0 ? (double)min / max : 0.0, squares > 0 ? (double)total * total / (nb_threads * squares) : 0.0);
+  fflush(stdout);
+
+  pthread_barrier_destroy(&barrier);
+  free(workers);
+  free(states);
+}
+
+void usage(const char *prog_name) {
+  printf("Usage: %s [-o <operations>] [-l <layouts>] [-t <max_threads>] [-d <duration_ms>]\n"
+	 "\t -o: comma separated operations among xadd, cas, xchg, ticket, mcs and mutex (default is all)\n"
+	 "\t -l: comma separated layouts among shared (one variable), packed (one variable per thread,\n"
+	 "\t     next to each other) and padded (one line per thread) (default is all)\n"
+	 "\t -t: the maximal number of threads, pinned on the allowed cpus in order (default is their number)\n"
+	 "\t -d: the duration in milliseconds of each measure (default is %d)\n",
+	 prog_name, DEFAULT_DURATION_MS);
+}
+
+/**
+ * Returns whether name is in the comma separated list, or list is NULL.
+ */
+static int in_list(const char *list, const char *name) {
+  if (list == NULL) {
+    return 1;
+  }
+  size_t length = strlen(name);
+  for (const char *p = list; p != NULL; p = strchr(p, ',') ? strchr(p, ',') + 1 : NULL) {
+    if (!strncmp(p, name, length) && (p[length] == ',' || p[length] == '\0')) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  const char *operations_list = NULL;
+  const char *layouts_list = NULL;
+  int max_threads = 0;
+  int duration_ms = DEFAULT_DURATION_MS;
+  int opt;
+  while ((opt = getopt(argc, argv, "o:l:t:d:")) != -1) {
+    switch (opt) {
+    case 'o':
+      operations_list = optarg;
+      break;
+    case 'l':
+      layouts_list = optarg;
+      break;
+    case 't':
+      max_threads = atoi(optarg);
+      break;
+    case 'd':
+      duration_ms = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return -1;
+    }
+  }
+
+  cpu_set_t allowed;
+  assert(sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+  int nb_cpus = CPU_COUNT(&allowed);
+  int *cpus = malloc(nb_cpus * sizeof(int));
+  assert(cpus);
+  int c = 0;
+  for (int cpu = 0; c < nb_cpus; cpu++) {
+    if (CPU_ISSET(cpu, &allowed)) {
+      cpus[c++] = cpu;
+    }
+  }
+  if (max_threads <= 0) {
+    max_threads = nb_cpus;
+  }
+  if (max_threads > nb_cpus) {
+    fprintf(stderr, "Warning: %d threads on %d cpus, spinning threads will share cpus\n", max_threads, nb_cpus);
+  }
+
+  for (int o = 0; o < NB_OPERATIONS; o++) {
+    if (!in_list(operations_list, operations[o].name)) {
+      continue;
+    }
+    for (int l = 0; l < nb_layouts; l++) {
+      if (!in_list(layouts_list, layout_names[l])) {
+	continue;
+      }
+      printf("%s, %s:\n", operations[o].name, layout_names[l]);
+      printf("%-8s %-12s %-12s %-14s %-10s\n", "Threads", "Mops/s", "ns/op", "Min/max ops", "Jain");
+      for (int t = 1; t <= max_threads; t++) {
+	run_point(&operations[o], l, t, cpus, nb_cpus, duration_ms);
+      }
+      printf("\n");
+    }
+  }
+
+  free(cpus);
+  return 0;
+}
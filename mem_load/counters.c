@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h> // For syscall
+#include <sys/ioctl.h> // For ioctl
+#include <sys/syscall.h> // For syscall
+
+#include "counters.h"
+
+#define HW_CACHE_CONFIG(cache, op, result) \
+  ((cache) | ((op) << 8) | ((result) << 16))
+
+/**
+ * Counters known by name, mapped to the generic events of the kernel.
+ */
+static const struct {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+} known_counters[] = {
+  {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+  {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+  {"llc-loads", PERF_TYPE_HW_CACHE,
+   HW_CACHE_CONFIG(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_ACCESS)},
+  {"llc-misses", PERF_TYPE_HW_CACHE,
+   HW_CACHE_CONFIG(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+  {"dtlb-loads", PERF_TYPE_HW_CACHE,
+   HW_CACHE_CONFIG(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_ACCESS)},
+  {"dtlb-misses", PERF_TYPE_HW_CACHE,
+   HW_CACHE_CONFIG(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+  {"l1d-misses", PERF_TYPE_HW_CACHE,
+   HW_CACHE_CONFIG(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)}
+};
+
+#define NB_KNOWN_COUNTERS (sizeof(known_counters) / sizeof(known_counters[0]))
+
+/**
+ * Named sets of counters.
+ */
+static const struct {
+  const char *name;
+  const char *counters;
+} known_sets[] = {
+  {"default", "cycles,instructions,llc-misses,dtlb-misses"},
+  {"tlb", "cycles,instructions,dtlb-loads,dtlb-misses"},
+  {"llc", "cycles,instructions,llc-loads,llc-misses"}
+};
+
+#define NB_KNOWN_SETS (sizeof(known_sets) / sizeof(known_sets[0]))
+
+static long perf_event_open(struct perf_event_attr *hw_event, pid_t pid, int cpu,
+			    int group_fd, unsigned long flags) {
+  return syscall(__NR_perf_event_open, hw_event, pid, cpu, group_fd, flags);
+}
+
+static int add_counter(struct counter_set *set, const char *name, uint32_t type, uint64_t config) {
+  if (set->nb_counters == MAX_COUNTERS) {
+    return -1;
+  }
+  struct perf_event_attr *attr = &set->attrs[set->nb_counters];
+  memset(attr, 0, sizeof(*attr));
+  attr->size = sizeof(*attr);
+  attr->type = type;
+  attr->config = config;
+  attr->exclude_kernel = 1;
+  attr->exclude_hv = 1;
+  attr->exclude_idle = 1;
+  attr->read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  snprintf(set->names[set->nb_counters], sizeof(set->names[0]), "%s", name);
+  set->fds[set->nb_counters] = -1;
+  set->nb_counters++;
+  return 0;
+}
+
+static int parse_counters(struct counter_set *set, const char *spec) {
+  char *copy = strdup(spec);
+  char *saveptr = NULL;
+  int ret = 0;
+  for (char *name = strtok_r(copy, ",", &saveptr); name != NULL && ret == 0; name = strtok_r(NULL, ",", &saveptr)) {
+    int found = 0;
+    for (int i = 0; i < NB_KNOWN_SETS && !found; i++) {
+      if (!strcmp(known_sets[i].name, name)) {
+	ret = parse_counters(set, known_sets[i].counters);
+	found = 1;
+      }
+    }
+    for (int i = 0; i < NB_KNOWN_COUNTERS && !found; i++) {
+      if (!strcmp(known_counters[i].name, name)) {
+	ret = add_counter(set, name, known_counters[i].type, known_counters[i].config);
+	found = 1;
+      }
+    }
+    if (!found && name[0] == 'r' && name[1] != '\0') {
+      char *end;
+      uint64_t config = strtoull(name + 1, &end, 16);
+      if (*end == '\0') {
+	ret = add_counter(set, name, PERF_TYPE_RAW, config);
+	found = 1;
+      }
+    }
+    if (!found && strcmp(name, "none")) {
+      ret = -1;
+    }
+  }
+  free(copy);
+  return ret;
+}
+
+int counter_set_parse(struct counter_set *set, const char *spec) {
+  set->nb_counters = 0;
+  return parse_counters(set, spec);
+}
+
+static int open_group(struct counter_set *set, int cpu) {
+  for (int c = 0; c < set->nb_counters; c++) {
+    int group_fd = c == 0 ? -1 : set->fds[0];
+    set->attrs[c].disabled = c == 0;
+    set->fds[c] = perf_event_open(&set->attrs[c], 0, cpu, group_fd, 0);
+    if (set->fds[c] == -1) {
+      fprintf(stderr, "perf_event_open failed for %s\n", set->names[c]);
+      counter_set_close(set);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Returns whether the group gets scheduled on the PMU when enabled for
+ * a short busy loop.
+ */
+static int group_is_scheduled(const struct counter_set *set) {
+  struct counter_values start, values;
+  if (counter_set_start(set, &start)) {
+    return 0;
+  }
+  for (volatile int i = 0; i < 1000000; i++) {
+  }
+  counter_set_stop(set);
+  return counter_set_read(set, &start, &values) == 0 && values.time_running > 0;
+}
+
+int counter_set_open(struct counter_set *set, int cpu) {
+  while (1) {
+    if (open_group(set, cpu)) {
+      return -1;
+    }
+    if (set->nb_counters <= 1 || group_is_scheduled(set)) {
+      return 0;
+    }
+    counter_set_close(set);
+    set->nb_counters--;
+    fprintf(stderr, "Counter group never scheduled, the PMU has fewer free counters than the set: dropping %s\n",
+	    set->names[set->nb_counters]);
+  }
+}
+
+void counter_set_close(struct counter_set *set) {
+  for (int c = 0; c < set->nb_counters; c++) {
+    if (set->fds[c] != -1) {
+      close(set->fds[c]);
+      set->fds[c] = -1;
+    }
+  }
+}
+
+/**
+ * Group read format: number of counters, time enabled, time running,
+ * then the value of each counter in the order they were opened.
+ */
+static int read_group(const struct counter_set *set, struct counter_values *values) {
+  uint64_t buffer[3 + MAX_COUNTERS];
+  size_t size = (3 + set->nb_counters) * sizeof(uint64_t);
+  if (read(set->fds[0], buffer, size) != size || buffer[0] != set->nb_counters) {
+    return -1;
+  }
+  values->time_enabled = buffer[1];
+  values->time_running = buffer[2];
+  for (int c = 0; c < set->nb_counters; c++) {
+    values->values[c] = buffer[3 + c];
+  }
+  return 0;
+}
+
+int counter_set_start(const struct counter_set *set, struct counter_values *start) {
+  memset(start, 0, sizeof(*start));
+  if (set->nb_counters == 0) {
+    return 0;
+  }
+  if (read_group(set, start)) {
+    return -1;
+  }
+  ioctl(set->fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  return 0;
+}
+
+void counter_set_stop(const struct counter_set *set) {
+  if (set->nb_counters > 0) {
+    ioctl(set->fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+  }
+}
+
+int counter_set_read(const struct counter_set *set, const struct counter_values *start,
+		     struct counter_values *values) {
+  memset(values, 0, sizeof(*values));
+  if (set->nb_counters == 0) {
+    return 0;
+  }
+
+  /**
+   * time_enabled and time_running are not reset along with the counts,
+   * so the ratio of this period only is given by their deltas.
+   */
+  if (read_group(set, values)) {
+    return -1;
+  }
+  values->time_enabled -= start->time_enabled;
+  values->time_running -= start->time_running;
+  for (int c = 0; c < set->nb_counters; c++) {
+    values->values[c] -= start->values[c];
+    values->scaled[c] = values->time_running == 0 ? 0 :
+      (double)values->values[c] * values->time_enabled / values->time_running;
+  }
+  return 0;
+}
+
+int counter_set_index(const struct counter_set *set, const char *name) {
+  for (int c = 0; c < set->nb_counters; c++) {
+    if (!strcmp(set->names[c], name)) {
+      return c;
+    }
+  }
+  return -1;
+}
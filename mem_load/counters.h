@@ -0,0 +1,88 @@
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <stdint.h>
+#include <linux/perf_event.h>
+
+#define MAX_COUNTERS 8
+
+/**
+ * Syntax of the counter sets accepted by counter_set_parse, to be
+ * printed in the usage.
+ */
+#define COUNTER_SET_HELP \
+  "comma separated counters or sets among default (cycles, instructions,\n" \
+  "\t    llc-misses, dtlb-misses), tlb, llc, cycles, instructions, llc-loads, llc-misses,\n" \
+  "\t    dtlb-loads, dtlb-misses (page walks, i.e. STLB misses on Intel), l1d-misses, or raw\n" \
+  "\t    events rXXXX as given by the processor manual, none to disable\n"
+
+/**
+ * Counters opened as a single perf group, so that they are all
+ * scheduled on the PMU at the same time and read at once along with
+ * the time the group was enabled and running.
+ */
+struct counter_set {
+  int nb_counters;
+  char names[MAX_COUNTERS][32];
+  struct perf_event_attr attrs[MAX_COUNTERS];
+  int fds[MAX_COUNTERS];
+};
+
+/**
+ * Counts read from a counter set since counter_set_start. When the PMU
+ * is shared with other counter sets (multiplexing), the group only runs
+ * time_running out of time_enabled nanoseconds and scaled holds the raw
+ * values extrapolated to the whole time.
+ */
+struct counter_values {
+  uint64_t time_enabled;
+  uint64_t time_running;
+  uint64_t values[MAX_COUNTERS];
+  double scaled[MAX_COUNTERS];
+};
+
+/**
+ * Sets set to the counters described by spec as described by
+ * COUNTER_SET_HELP. Returns 0 on success and -1 if a counter is
+ * unknown or there are more than MAX_COUNTERS counters.
+ */
+int counter_set_parse(struct counter_set *set, const char *spec);
+
+/**
+ * Opens the counters of set for the calling thread on the given cpu
+ * (-1 for any cpu), user space only. If the group is never scheduled,
+ * the PMU having fewer free counters than the set, the last counters
+ * are dropped with a warning until it is. Returns 0 on success, and -1
+ * with errno set if a counter cannot be opened, all the counters being
+ * then closed.
+ */
+int counter_set_open(struct counter_set *set, int cpu);
+
+void counter_set_close(struct counter_set *set);
+
+/**
+ * Enables all the counters at once, saving in start the counts and
+ * times counter_set_read subtracts. Returns 0 on success and -1 on
+ * failure.
+ */
+int counter_set_start(const struct counter_set *set, struct counter_values *start);
+
+/**
+ * Disables all the counters at once.
+ */
+void counter_set_stop(const struct counter_set *set);
+
+/**
+ * Reads all the counters at once, as counted since start, each counter
+ * being scaled by the share of that time the group was running.
+ * Returns 0 on success and -1 on failure.
+ */
+int counter_set_read(const struct counter_set *set, const struct counter_values *start,
+		     struct counter_values *values);
+
+/**
+ * Returns the index of the counter with the given name, or -1.
+ */
+int counter_set_index(const struct counter_set *set, const char *name);
+
+#endif
@@ -0,0 +1,56 @@
+#include <string.h>
+#include <inttypes.h>
+
+#include "histogram.h"
+
+void histogram_init(struct histogram *histogram) {
+  memset(histogram, 0, sizeof(*histogram));
+}
+
+uint64_t histogram_bucket_low(int bucket, uint64_t *width) {
+  if (bucket < HISTOGRAM_SUB_BUCKETS) {
+    *width = 1;
+    return bucket;
+  }
+  int shift = (bucket >> HISTOGRAM_SUB_BITS) - 1;
+  *width = (uint64_t)1 << shift;
+  return (uint64_t)(HISTOGRAM_SUB_BUCKETS + (bucket & (HISTOGRAM_SUB_BUCKETS - 1))) << shift;
+}
+
+double histogram_percentile(const struct histogram *histogram, double ratio) {
+  if (histogram->total == 0) {
+    return 0;
+  }
+  uint64_t rank = ratio * histogram->total;
+  if (rank >= histogram->total) {
+    rank = histogram->total - 1;
+  }
+  uint64_t cumulated = 0;
+  for (int b = 0; b < HISTOGRAM_NB_BUCKETS; b++) {
+    cumulated += histogram->counts[b];
+    if (cumulated > rank) {
+      uint64_t width;
+      uint64_t low = histogram_bucket_low(b, &width);
+      return low + (width - 1) / 2.0;
+    }
+  }
+  return 0;
+}
+
+void histogram_print(FILE *f, const struct histogram *histogram, double scale, const char *unit) {
+  char title[32];
+  snprintf(title, sizeof(title), "Range (%s)", unit);
+  fprintf(f, "%-24s %-14s %-12s\n", title, "Count", "Cumulated (%)");
+  uint64_t cumulated = 0;
+  for (int b = 0; b < HISTOGRAM_NB_BUCKETS; b++) {
+    if (histogram->counts[b] == 0) {
+      continue;
+    }
+    cumulated += histogram->counts[b];
+    uint64_t width;
+    uint64_t low = histogram_bucket_low(b, &width);
+    char range[32];
+    snprintf(range, sizeof(range), "%.2f - %.2f", low * scale, (low + width) * scale);
+    fprintf(f, "%-24s %-14" PRIu64 " %-12.3f\n", range, histogram->counts[b], cumulated * 100.0 / histogram->total);
+  }
+}
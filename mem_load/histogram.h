@@ -0,0 +1,60 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/**
+ * Log-linear histogram: values below 2^HISTOGRAM_SUB_BITS have their
+ * own bucket, and each power of two above is split in
+ * 2^HISTOGRAM_SUB_BITS linear buckets, so that a bucket is at most
+ * 1/16 of its values wide whatever their magnitude.
+ */
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_NB_BUCKETS (64 * HISTOGRAM_SUB_BUCKETS)
+
+struct histogram {
+  uint64_t counts[HISTOGRAM_NB_BUCKETS];
+  uint64_t total;
+  double sum;
+};
+
+static inline int histogram_bucket(uint64_t value) {
+  if (value < HISTOGRAM_SUB_BUCKETS) {
+    return value;
+  }
+  int shift = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BITS;
+  return ((shift + 1) << HISTOGRAM_SUB_BITS) + ((value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+/**
+ * Adds a value, cheap enough to be called between timed blocks.
+ */
+static inline void histogram_add(struct histogram *histogram, uint64_t value) {
+  histogram->counts[histogram_bucket(value)]++;
+  histogram->total++;
+  histogram->sum += value;
+}
+
+void histogram_init(struct histogram *histogram);
+
+/**
+ * Returns the lowest value of the given bucket, and its width in
+ * width.
+ */
+uint64_t histogram_bucket_low(int bucket, uint64_t *width);
+
+/**
+ * Returns the value under which the given ratio (in [0, 1]) of the
+ * values fall, taken in the middle of its bucket.
+ */
+double histogram_percentile(const struct histogram *histogram, double ratio);
+
+/**
+ * Prints the non empty buckets with their count and cumulative
+ * percentage, values being multiplied by scale.
+ */
+void histogram_print(FILE *f, const struct histogram *histogram, double scale, const char *unit);
+
+#endif
@@ -8,15 +8,16 @@
 #include <time.h> // For clock_gettime()
 #include <numa.h>
 #include <numaif.h>
-#include <sys/ioctl.h> // For ioctl
 #include <sys/sysinfo.h> // For get_nprocs()
 #include <sys/mman.h> // For madvise
 #include <sched.h> // For sched_setaffinity
-#include <linux/perf_event.h> // For perf_event_open
-#include <unistd.h> // For syscall
-#include <sys/syscall.h> // For syscall
+#include <unistd.h> // For getopt
+#include <pthread.h>
 
 #include "mem_alloc.h"
+#include "counters.h"
+#include "histogram.h"
+#include "stats.h"
 
 #define ONE      asm("movq (%%rbx), %%rbx;"	\
 		     :				\
@@ -33,171 +34,1037 @@
 #define SIXTYFOUR THIRTYTWO THIRTYTWO
 #define	HUNDRED	  FIFTY FIFTY
 
-#define MAX_NB_NUMA_NODES     16
+/**
+ * Dependent store and read-modify-write chases: each pointer is loaded
+ * then written back unchanged, so that the chain is left intact, either
+ * to the same line (STORE_SAME), to the same offset of a shadow buffer
+ * that is never read, shadow_offset bytes away (STORE_OTHER), or with a
+ * lock prefixed exchange and add of 0 (LOCK_RMW).
+ */
+#define STORE_SAME  asm("movq (%%rbx), %%rax; movq %%rax, (%%rbx); movq %%rax, %%rbx;" \
+			:					\
+			:					\
+			:"%rax", "%rbx", "memory");
+#define STORE_OTHER asm("movq (%%rbx), %%rax; movq %%rax, (%%rbx, %0); movq %%rax, %%rbx;" \
+			:					\
+			:"r" (shadow_offset)			\
+			:"%rax", "%rbx", "memory");
+#define LOCK_RMW    asm("xorl %%eax, %%eax; lock xaddq %%rax, (%%rbx); movq %%rax, %%rbx;" \
+			:					\
+			:					\
+			:"%rax", "%rbx", "memory");
+#define TIMES4(x)   x x x x
+#define TIMES64(x)  TIMES4(TIMES4(TIMES4(x)))
+
+enum chase_mode_t {chase_load, chase_store, chase_store_other, chase_lock};
+
+#define CHASE_MODE_HELP "load (default), store (to the same line), store-other (to another line) or lock\n"
+
+static const char *chase_mode_names[] = {"load", "store", "store-other", "lock"};
+
+static int parse_chase_mode(const char *name, enum chase_mode_t *mode) {
+  for (int i = 0; i < sizeof(chase_mode_names) / sizeof(chase_mode_names[0]); i++) {
+    if (!strcmp(chase_mode_names[i], name)) {
+      *mode = i;
+      return 0;
+    }
+  }
+  return -1;
+}
+
 #define DEFAULT_MEM_SIZE 64 * 1024 * 1024
 
-#define PROTECTION (PROT_READ | PROT_WRITE)
-#define FLAGS (MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB)
-
-static long perf_event_open(struct perf_event_attr *hw_event,
-			    pid_t pid,
-			    int cpu,
-			    int group_fd,
-			    unsigned long flags) {
-  int ret = syscall(__NR_perf_event_open, hw_event, pid, cpu,
-		    group_fd, flags);
-  return ret;
+/**
+ * Loaded latency: load generator threads read one word per line and
+ * publish their number of reads every LOADER_BATCH lines. Delays
+ * between reads, in pause instructions, go from MAX_LOADER_DELAY down
+ * to 0 by powers of two.
+ */
+#define LINE_SIZE 64
+#define LOADER_BATCH 64
+#define MAX_LOADER_DELAY 4096
+#define LOADER_IDLE -1
+
+/**
+ * Load generator thread, pinned on cpu, streaming over its own buffer
+ * with delay pause instructions between each line read. ready is set
+ * once its buffer is cleared, before its first read.
+ */
+struct loader {
+  pthread_t thread;
+  int cpu;
+  uint64_t *buffer;
+  size_t nb_lines;
+  volatile int ready;
+  volatile uint64_t nb_reads;
+  char padding[LINE_SIZE];
+};
+
+static volatile int loader_delay = LOADER_IDLE;
+static volatile int loaders_stop = 0;
+static volatile uint64_t loader_sink;
+
+static void *run_loader(void *arg) {
+  struct loader *loader = arg;
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  CPU_SET(loader->cpu, &mask);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask)) {
+    fprintf(stderr, "Cannot pin load generator on cpu %d\n", loader->cpu);
+  }
+  size_t words_per_line = LINE_SIZE / sizeof(uint64_t);
+  memset(loader->buffer, 0, loader->nb_lines * LINE_SIZE);
+  __sync_synchronize();
+  loader->ready = 1;
+  uint64_t sum = 0;
+  size_t line = 0;
+  while (!loaders_stop) {
+    int delay = loader_delay;
+    if (delay == LOADER_IDLE) {
+      asm volatile("pause");
+      continue;
+    }
+    for (int i = 0; i < LOADER_BATCH; i++) {
+      sum += loader->buffer[line * words_per_line];
+      if (++line == loader->nb_lines) {
+	line = 0;
+      }
+      for (int d = 0; d < delay; d++) {
+	asm volatile("pause");
+      }
+    }
+    loader->nb_reads += LOADER_BATCH;
+  }
+  loader_sink = sum;
+  return NULL;
 }
 
-static size_t get_hugepage_size() {
-  const char *key = "Hugepagesize:";
+/**
+ * Follows the chain starting at memory for nb_iter times 64 loads and
+ * returns the average latency of each load in nanoseconds, measured
+ * with the wall clock since other threads of the process are running.
+ */
+static double chase_wall(uint64_t *memory, int nb_iter) {
+  struct timespec start, end;
+  asm("movq %0, %%rbx;"
+      :
+      :"r" (memory)
+      :"%rbx");
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  int register i = 0;
+  while (i < nb_iter) {
+    i++;
+    SIXTYFOUR
+      }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return ((end.tv_sec * 1E9 + end.tv_nsec) - (start.tv_sec * 1E9 + start.tv_nsec)) / (nb_iter * 64.0);
+}
 
-  FILE *f = fopen("/proc/meminfo", "r");
-  assert(f);
+/**
+ * Starts the load generators, whose cpu, buffer and nb_lines are set,
+ * and waits until all of them have cleared their buffer, so that no
+ * write back of the clearing is left in a measure.
+ */
+static void start_loaders(struct loader *loaders, int nb_loaders) {
+  loaders_stop = 0;
+  for (int l = 0; l < nb_loaders; l++) {
+    loaders[l].nb_reads = 0;
+    loaders[l].ready = 0;
+    assert(pthread_create(&loaders[l].thread, NULL, run_loader, &loaders[l]) == 0);
+  }
+  for (int l = 0; l < nb_loaders; l++) {
+    while (!loaders[l].ready) {
+      sched_yield();
+    }
+  }
+}
 
-  char *linep = NULL;
-  size_t n = 0;
-  size_t size = 0;
-  while (getline(&linep, &n, f) > 0) {
-    if (strstr(linep, key) != linep)
+static void stop_loaders(struct loader *loaders, int nb_loaders) {
+  loaders_stop = 1;
+  for (int l = 0; l < nb_loaders; l++) {
+    pthread_join(loaders[l].thread, NULL);
+  }
+}
+
+static uint64_t loaders_reads(const struct loader *loaders, int nb_loaders) {
+  uint64_t nb_reads = 0;
+  for (int l = 0; l < nb_loaders; l++) {
+    nb_reads += loaders[l].nb_reads;
+  }
+  return nb_reads;
+}
+
+/**
+ * Prints the loaded latency curve: the chase latency measured on the
+ * calling thread while nb_loaders load generators run on the cpus
+ * following core, each of them over buffer_size bytes, from idle to
+ * unthrottled. Bandwidths are the ones achieved by the load generators.
+ */
+static void run_loaded_latency(uint64_t *memory, int nb_iter, int core, int nb_loaders, size_t buffer_size) {
+  struct loader *loaders = calloc(nb_loaders, sizeof(struct loader));
+  assert(loaders);
+  int nb_cpus = get_nprocs();
+  for (int l = 0; l < nb_loaders; l++) {
+    loaders[l].cpu = (core + 1 + l) % nb_cpus;
+    loaders[l].nb_lines = buffer_size / LINE_SIZE;
+    assert(posix_memalign((void **)&loaders[l].buffer, LINE_SIZE, loaders[l].nb_lines * LINE_SIZE) == 0);
+  }
+  loader_delay = LOADER_IDLE;
+  start_loaders(loaders, nb_loaders);
+
+  printf("%-10s %-18s %-12s\n", "Delay", "Bandwidth (GB/s)", "Latency (ns)");
+  /**
+   * Idle first, then from the largest delay down to no delay at all.
+   */
+  int delay = LOADER_IDLE;
+  while (1) {
+    loader_delay = delay;
+    chase_wall(memory, nb_iter / 10 + 1);
+
+    struct timespec start, end;
+    uint64_t reads_start = loaders_reads(loaders, nb_loaders);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    double latency = chase_wall(memory, nb_iter);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t reads = loaders_reads(loaders, nb_loaders) - reads_start;
+    double ns = (end.tv_sec * 1E9 + end.tv_nsec) - (start.tv_sec * 1E9 + start.tv_nsec);
+    if (delay == LOADER_IDLE) {
+      printf("%-10s %-18.3f %-12.3f\n", "idle", reads * LINE_SIZE / ns, latency);
+    } else {
+      printf("%-10d %-18.3f %-12.3f\n", delay, reads * LINE_SIZE / ns, latency);
+    }
+    fflush(stdout);
+    if (delay == 0) {
+      break;
+    }
+    delay = delay == LOADER_IDLE ? MAX_LOADER_DELAY : delay / 2;
+  }
+
+  stop_loaders(loaders, nb_loaders);
+  for (int l = 0; l < nb_loaders; l++) {
+    free(loaders[l].buffer);
+  }
+  free(loaders);
+}
+
+static void pin_on_cpu(int cpu) {
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  CPU_SET(cpu, &mask);
+  if (sched_setaffinity(0, sizeof(mask), &mask) == -1) {
+    fprintf(stderr, "sched_setaffinity failed: %s\n", strerror(errno));
+    exit(-1);
+  }
+}
+
+/**
+ * Returns the cpus of the given node in cpus, which must hold
+ * numa_num_configured_cpus() entries, and their number.
+ */
+static int node_cpus(int node, int *cpus) {
+  int nb_cpus = numa_num_configured_cpus();
+  struct bitmask *mask = numa_allocate_cpumask();
+  int nb_node_cpus = 0;
+  if (numa_node_to_cpus(node, mask) == 0) {
+    for (int cpu = 0; cpu < nb_cpus; cpu++) {
+      if (numa_bitmask_isbitset(mask, cpu)) {
+	cpus[nb_node_cpus++] = cpu;
+      }
+    }
+  }
+  numa_bitmask_free(mask);
+  return nb_node_cpus;
+}
+
+static int is_node_configured(int node) {
+  return node >= 0 && node <= numa_max_node() && numa_bitmask_isbitset(numa_nodes_ptr, node);
+}
+
+/**
+ * Duration of each bandwidth measure of the NUMA matrix, after a warm
+ * up of a tenth of it.
+ */
+#define MATRIX_BANDWIDTH_NS 200000000L
+
+/**
+ * The load generators of the NUMA matrix stream over at least the last
+ * level cache size each, and MATRIX_LLC_MULTIPLE times it in total, so
+ * that they measure the bandwidth of memory whatever -m and the number
+ * of cpus of a node. MATRIX_DEFAULT_LLC_SIZE is used when the size of
+ * the last level cache is unknown.
+ */
+#define MATRIX_LLC_MULTIPLE 4
+#define MATRIX_DEFAULT_LLC_SIZE (64 * 1024 * 1024)
+
+/**
+ * Returns the size of the buffer the load generators of the NUMA matrix
+ * share on each memory node, for at most max_node_cpus generators and a
+ * chase over size bytes.
+ */
+static size_t matrix_loaders_size(size_t size, int max_node_cpus) {
+  long llc_size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+  if (llc_size <= 0) {
+    llc_size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  }
+  if (llc_size <= 0) {
+    llc_size = MATRIX_DEFAULT_LLC_SIZE;
+  }
+  size_t loaders_size = size;
+  if (loaders_size < max_node_cpus * (size_t)llc_size) {
+    loaders_size = max_node_cpus * (size_t)llc_size;
+  }
+  if (loaders_size < MATRIX_LLC_MULTIPLE * (size_t)llc_size) {
+    loaders_size = MATRIX_LLC_MULTIPLE * (size_t)llc_size;
+  }
+  return loaders_size;
+}
+
+/**
+ * Prints a matrix of the given values, rows being the cpu nodes and
+ * columns the memory nodes.
+ */
+static void print_matrix(const char *title, const double *values, const int *cpu_nodes, int nb_cpu_nodes,
+			 const int *mem_nodes, int nb_mem_nodes, const char *format) {
+  printf("%s\n%-10s", title, "cpu\\mem");
+  for (int m = 0; m < nb_mem_nodes; m++) {
+    printf(" %-10d", mem_nodes[m]);
+  }
+  printf("\n");
+  for (int c = 0; c < nb_cpu_nodes; c++) {
+    printf("%-10d", cpu_nodes[c]);
+    for (int m = 0; m < nb_mem_nodes; m++) {
+      printf(" ");
+      printf(format, values[c * nb_mem_nodes + m]);
+    }
+    printf("\n");
+  }
+  printf("\n");
+}
+
+/**
+ * NUMA matrix: for each node with memory, fills size bytes bound to it
+ * once, before pinning, then for each node with cpus measures the
+ * latency of the chase from its first cpu, and the bandwidth of load
+ * generators running on all its cpus, each one streaming over its own
+ * slice of another buffer bound to the node, so that the chain is never
+ * overwritten, sized by matrix_loaders_size. Prints the latency and bandwidth matrices next to
+ * the distances reported by the firmware.
+ */
+static void run_numa_matrix(enum access_mode_t access_mode, size_t npad, const struct fill_params *fill_params,
+			    size_t size, int nb_iter) {
+  int nb_nodes = numa_max_node() + 1;
+  int *cpu_nodes = malloc(nb_nodes * sizeof(int));
+  int *mem_nodes = malloc(nb_nodes * sizeof(int));
+  int *cpus = malloc(numa_num_configured_cpus() * sizeof(int));
+  assert(cpu_nodes);
+  assert(mem_nodes);
+  assert(cpus);
+  int nb_cpu_nodes = 0, nb_mem_nodes = 0, max_node_cpus = 0;
+  for (int node = 0; node < nb_nodes; node++) {
+    if (!is_node_configured(node)) {
       continue;
-    size = atol(linep + strlen(key)) * 1024;
-    break;
+    }
+    int nb_node_cpus = node_cpus(node, cpus);
+    if (nb_node_cpus > 0) {
+      cpu_nodes[nb_cpu_nodes++] = node;
+    }
+    if (nb_node_cpus > max_node_cpus) {
+      max_node_cpus = nb_node_cpus;
+    }
+    long long free_size;
+    if (numa_node_size64(node, &free_size) > 0) {
+      mem_nodes[nb_mem_nodes++] = node;
+    }
   }
-  fclose(f);
-  assert(size);
-  return size;
+
+  double *latencies = calloc(nb_cpu_nodes * nb_mem_nodes, sizeof(double));
+  double *bandwidths = calloc(nb_cpu_nodes * nb_mem_nodes, sizeof(double));
+  double *distances = calloc(nb_cpu_nodes * nb_mem_nodes, sizeof(double));
+  struct loader *loaders = calloc(numa_num_configured_cpus(), sizeof(struct loader));
+  assert(latencies);
+  assert(bandwidths);
+  assert(distances);
+  assert(loaders);
+  cpu_set_t all_cpus;
+  if (sched_getaffinity(0, sizeof(all_cpus), &all_cpus) == -1) {
+    fprintf(stderr, "sched_getaffinity failed: %s\n", strerror(errno));
+    exit(-1);
+  }
+
+  size_t loaders_size = matrix_loaders_size(size, max_node_cpus);
+  for (int m = 0; m < nb_mem_nodes; m++) {
+    uint64_t *memory = numa_alloc_onnode(size, mem_nodes[m]);
+    uint64_t *loaders_memory = numa_alloc_onnode(loaders_size, mem_nodes[m]);
+    if (memory == NULL || loaders_memory == NULL) {
+      fprintf(stderr, "Cannot allocate %zu and %zu bytes on node %d\n", size, loaders_size, mem_nodes[m]);
+      exit(-1);
+    }
+
+    /**
+     * The filling threads inherit the affinity of the calling thread,
+     * which is unpinned for them to run on all the cpus.
+     */
+    if (sched_setaffinity(0, sizeof(all_cpus), &all_cpus) == -1) {
+      fprintf(stderr, "sched_setaffinity failed: %s\n", strerror(errno));
+      exit(-1);
+    }
+    fill_memory_params(memory, size, access_mode, npad, fill_params);
+    for (int c = 0; c < nb_cpu_nodes; c++) {
+      fprintf(stderr, "\rcpu node %d, memory node %d   ", cpu_nodes[c], mem_nodes[m]);
+      int nb_node_cpus = node_cpus(cpu_nodes[c], cpus);
+      int cell = c * nb_mem_nodes + m;
+      distances[cell] = numa_distance(cpu_nodes[c], mem_nodes[m]);
+
+      pin_on_cpu(cpus[0]);
+      chase_wall(memory, nb_iter / 10 + 1);
+      latencies[cell] = chase_wall(memory, nb_iter);
+
+      size_t slice_lines = loaders_size / LINE_SIZE / nb_node_cpus;
+      for (int l = 0; l < nb_node_cpus; l++) {
+	loaders[l].cpu = cpus[l];
+	loaders[l].buffer = (uint64_t *)((char *)loaders_memory + l * slice_lines * LINE_SIZE);
+	loaders[l].nb_lines = slice_lines;
+      }
+      loader_delay = 0;
+      start_loaders(loaders, nb_node_cpus);
+      struct timespec pause = {0, MATRIX_BANDWIDTH_NS / 10};
+      nanosleep(&pause, NULL);
+      struct timespec start, end;
+      uint64_t reads_start = loaders_reads(loaders, nb_node_cpus);
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      pause.tv_sec = MATRIX_BANDWIDTH_NS / 1000000000L;
+      pause.tv_nsec = MATRIX_BANDWIDTH_NS % 1000000000L;
+      nanosleep(&pause, NULL);
+      uint64_t reads = loaders_reads(loaders, nb_node_cpus) - reads_start;
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      stop_loaders(loaders, nb_node_cpus);
+      bandwidths[cell] = reads * LINE_SIZE / ((end.tv_sec * 1E9 + end.tv_nsec) - (start.tv_sec * 1E9 + start.tv_nsec));
+    }
+    numa_free(loaders_memory, loaders_size);
+    numa_free(memory, size);
+  }
+  fprintf(stderr, "\n");
+
+  print_matrix("Idle latency (ns)", latencies, cpu_nodes, nb_cpu_nodes, mem_nodes, nb_mem_nodes, "%-10.3f");
+  print_matrix("Bandwidth (GB/s)", bandwidths, cpu_nodes, nb_cpu_nodes, mem_nodes, nb_mem_nodes, "%-10.3f");
+  print_matrix("numa_distance", distances, cpu_nodes, nb_cpu_nodes, mem_nodes, nb_mem_nodes, "%-10.0f");
+
+  free(loaders);
+  free(distances);
+  free(bandwidths);
+  free(latencies);
+  free(cpus);
+  free(mem_nodes);
+  free(cpu_nodes);
 }
 
-static unsigned char check_THP_never() {
+/**
+ * Returns the mean of the scaled value of counter c over the runs, 0 if
+ * the counter is not in the set.
+ */
+static double counter_mean(const struct running_stats *counts, int c) {
+  return c == -1 ? 0 : counts[c].mean;
+}
 
-  const char key = '[';
+/**
+ * Prints the mean and standard deviation of each counter over the runs,
+ * per run and per load, with the share of the time the group was
+ * actually counting, then the metrics derived from the counters of the
+ * set. All the counters of a group are scheduled together, so they
+ * share the same running time.
+ */
+static void print_counters(const struct counter_set *set, const struct running_stats *counts,
+			   uint64_t enabled, uint64_t running, uint64_t nb_loads) {
+  if (set->nb_counters == 0) {
+    return;
+  }
+  if (running == 0) {
+    fprintf(stderr, "Counters were never scheduled, the PMU may have fewer counters than the set\n");
+    return;
+  }
+  for (int c = 0; c < set->nb_counters; c++) {
+    double mean = counts[c].mean;
+    fprintf(stderr, "%-14s: average = %.0f (%.3f per load), standard deviation = %.3f%%, scheduled = %.1f%%\n",
+	    set->names[c], mean, mean / nb_loads, mean > 0 ? stats_deviation(&counts[c]) / mean * 100 : 0.0,
+	    running * 100.0 / enabled);
+  }
 
-  FILE *f = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
-  assert(f);
+  double cycles = counter_mean(counts, counter_set_index(set, "cycles"));
+  double instructions = counter_mean(counts, counter_set_index(set, "instructions"));
+  if (cycles > 0) {
+    fprintf(stderr, "Cycles per load: %.3f\n", cycles / nb_loads);
+  }
+  if (cycles > 0 && instructions > 0) {
+    fprintf(stderr, "IPC: %.3f\n", instructions / cycles);
+  }
+  if (instructions > 0) {
+    static const char *misses[] = {"llc-misses", "dtlb-misses", "l1d-misses"};
+    for (int m = 0; m < sizeof(misses) / sizeof(misses[0]); m++) {
+      int c = counter_set_index(set, misses[m]);
+      if (c != -1) {
+	fprintf(stderr, "%s MPKI: %.3f\n", misses[m], counter_mean(counts, c) * 1000 / instructions);
+      }
+    }
+  }
+  int llc_loads = counter_set_index(set, "llc-loads");
+  int llc_misses = counter_set_index(set, "llc-misses");
+  if (llc_loads != -1 && llc_misses != -1 && counter_mean(counts, llc_loads) > 0) {
+    fprintf(stderr, "LLC miss ratio: %.3f%%\n",
+	    counter_mean(counts, llc_misses) * 100 / counter_mean(counts, llc_loads));
+  }
+}
+
+#define MAX_PAGE_TYPES 4
+
+/**
+ * Runs of the chase: nb_runs of them, or, when target_ci is set, as
+ * many as needed for the 95% confidence interval of the latency to be
+ * within target_ci times its mean, with at least MIN_CONVERGED_RUNS of
+ * them, unless budget_s seconds are spent first.
+ */
+#define MIN_CONVERGED_RUNS 5
+#define DEFAULT_BUDGET_S 60
+
+struct run_control {
+  unsigned int nb_runs;
+  double target_ci;
+  double budget_s;
+};
+
+/**
+ * Latency histograms: the chase is timed by blocks of HISTOGRAM_BLOCK
+ * dependent loads (EIGHT) between serialized TSC reads, the overhead of
+ * the reads being measured on empty blocks and subtracted. The TSC
+ * frequency is calibrated against the wall clock for
+ * TSC_CALIBRATION_NS.
+ */
+#define HISTOGRAM_BLOCK 8
+#define TSC_CALIBRATION_NS 100000000L
+#define TSC_OVERHEAD_SAMPLES 10000
+#define NB_PERCENTILES 4
 
+static const double percentile_ratios[NB_PERCENTILES] = {0.5, 0.9, 0.99, 0.999};
+static const char *percentile_names[NB_PERCENTILES] = {"p50", "p90", "p99", "p99.9"};
+
+/**
+ * Reads the TSC once all the previous instructions are done, and before
+ * the following ones start.
+ */
+static inline uint64_t tsc_start() {
+  uint32_t low, high;
+  asm volatile("lfence; rdtsc; lfence" : "=a" (low), "=d" (high));
+  return ((uint64_t)high << 32) | low;
+}
+
+/**
+ * Reads the TSC once all the previous loads are done, and before the
+ * following instructions start.
+ */
+static inline uint64_t tsc_end() {
+  uint32_t low, high;
+  asm volatile("rdtscp; lfence" : "=a" (low), "=d" (high) : : "%rcx");
+  return ((uint64_t)high << 32) | low;
+}
+
+static double tsc_per_ns() {
+  struct timespec start, end;
+  struct timespec pause = {0, TSC_CALIBRATION_NS};
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  uint64_t tsc_begin = tsc_start();
+  nanosleep(&pause, NULL);
+  uint64_t tsc_finish = tsc_end();
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (tsc_finish - tsc_begin) / ((end.tv_sec * 1E9 + end.tv_nsec) - (start.tv_sec * 1E9 + start.tv_nsec));
+}
+
+static uint64_t tsc_overhead() {
+  uint64_t overhead = UINT64_MAX;
+  for (int i = 0; i < TSC_OVERHEAD_SAMPLES; i++) {
+    uint64_t start = tsc_start();
+    uint64_t end = tsc_end();
+    if (end - start < overhead) {
+      overhead = end - start;
+    }
+  }
+  return overhead;
+}
+
+/**
+ * Follows the chain starting at memory for nb_iter times 64 loads,
+ * adding the TSC ticks of each block of HISTOGRAM_BLOCK loads, less
+ * overhead, to histogram.
+ */
+static void chase_histogram(uint64_t *memory, int nb_iter, uint64_t overhead, struct histogram *histogram) {
+  asm("movq %0, %%rbx;"
+      :
+      :"r" (memory)
+      :"%rbx");
+  for (int i = 0; i < nb_iter * (64 / HISTOGRAM_BLOCK); i++) {
+    uint64_t start = tsc_start();
+    EIGHT
+    uint64_t ticks = tsc_end() - start;
+    histogram_add(histogram, ticks > overhead ? ticks - overhead : 0);
+  }
+}
+
+/**
+ * Averages of the chase over the runs on one page type, with the pages
+ * really backing the memory.
+ */
+struct chase_result {
+  int available;
+  char backing[32];
+  double time_avg;
+  double latency_avg;
+  double latency_deviation;
+  double latency_ci;
+  unsigned int nb_runs;
+  double counts[MAX_COUNTERS];
+  double percentiles[NB_PERCENTILES];
+};
+
+/**
+ * Parses a comma separated list of page types, or all, in page_types,
+ * which must hold MAX_PAGE_TYPES entries. Returns their number, or -1
+ * if a page type is unknown.
+ */
+static int parse_page_types(const char *spec, enum page_type_t *page_types) {
+  if (!strcmp(spec, "all")) {
+    page_types[0] = page_small;
+    page_types[1] = page_thp;
+    page_types[2] = page_hugetlb;
+    page_types[3] = page_hugetlb_1g;
+    return MAX_PAGE_TYPES;
+  }
+  char *copy = strdup(spec);
+  char *saveptr = NULL;
+  int nb_page_types = 0;
+  for (char *name = strtok_r(copy, ",", &saveptr); name != NULL; name = strtok_r(NULL, ",", &saveptr)) {
+    if (nb_page_types == MAX_PAGE_TYPES || parse_page_type(name, &page_types[nb_page_types])) {
+      nb_page_types = -1;
+      break;
+    }
+    nb_page_types++;
+  }
+  free(copy);
+  return nb_page_types;
+}
+
+/**
+ * Sets backing to the pages really backing the size bytes at memory, as
+ * reported by /proc/self/smaps for the mapping holding them: the page
+ * size of hugetlb mappings, or else the share of transparent huge
+ * pages, which the kernel may not have been able to provide.
+ */
+static void describe_backing(const void *memory, size_t size, char *backing, size_t backing_size) {
+  FILE *f = fopen("/proc/self/smaps", "r");
+  assert(f);
   char *linep = NULL;
   size_t n = 0;
-  getline(&linep, &n, f);
-  int i = 0;
-  int spaces = 0;
-  char current = linep[0];
-  while (current != key) {
-    if (current == ' ') {
-      spaces++;
+  int in_mapping = 0;
+  size_t kernel_page_size = 0, anon_huge = 0;
+  while (getline(&linep, &n, f) > 0) {
+    unsigned long start, end;
+    size_t value;
+    if (sscanf(linep, "%lx-%lx ", &start, &end) == 2) {
+      in_mapping = (uintptr_t)memory >= start && (uintptr_t)memory < end;
+    } else if (in_mapping && sscanf(linep, "KernelPageSize: %zu kB", &value) == 1) {
+      kernel_page_size = value * 1024;
+    } else if (in_mapping && sscanf(linep, "AnonHugePages: %zu kB", &value) == 1) {
+      anon_huge = value * 1024;
     }
-    i++;
-    current = linep[i];
   }
+  free(linep);
   fclose(f);
-  return spaces == 2;
+  if (kernel_page_size > sysconf(_SC_PAGESIZE)) {
+    snprintf(backing, backing_size, "hugetlb %zu KiB", kernel_page_size / 1024);
+  } else if (anon_huge == 0) {
+    snprintf(backing, backing_size, "%zu KiB", kernel_page_size / 1024);
+  } else {
+    snprintf(backing, backing_size, "%.0f%% thp", anon_huge > size ? 100.0 : anon_huge * 100.0 / size);
+  }
+}
+
+/**
+ * Follows the chain starting at memory for nb_iter times 64 loads per
+ * run, each one followed by a store as given by mode, shadow_offset
+ * being the distance in bytes to the shadow buffer of store-other,
+ * counting each run with counters, and as many runs as asked by
+ * control. Runs whose latency is an outlier among the last
+ * OUTLIER_WINDOW runs, by their median and median absolute deviation,
+ * are counted apart and left out of the statistics. Outliers are still
+ * part of the runs the next ones are tested against, so that a lasting
+ * shift of the latency is accepted once it holds for half of the window.
+ * Prints the details of the runs and returns their means in result.
+ */
+static void run_chase(uint64_t *memory, int nb_iter, enum chase_mode_t mode, intptr_t shadow_offset,
+		      const struct run_control *control, const struct counter_set *counters,
+		      struct chase_result *result) {
+  struct running_stats times, latencies, counts[MAX_COUNTERS];
+  struct value_window recent_latencies;
+  stats_init(&times);
+  stats_init(&latencies);
+  value_window_init(&recent_latencies);
+  for (int c = 0; c < counters->nb_counters; c++) {
+    stats_init(&counts[c]);
+  }
+  uint64_t enabled = 0, running = 0;
+  unsigned int nb_outliers = 0;
+  int converged = 0;
+  struct timespec begin, now;
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+
+  asm("movq %0, %%rbx;"
+      :
+      :"r" (memory)
+      :"%rbx");
+
+  unsigned int run = 0;
+  while (1) {
+
+    fprintf(stderr, "\rRun %u", run + 1);
+
+    /**
+     * Loop the specified number of time
+     */
+    struct timespec start, end;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+
+    struct counter_values counts_start;
+    if (counter_set_start(counters, &counts_start)) {
+      fprintf(stderr, "Cannot read the counters\n");
+      exit(-1);
+    }
+
+    int register i = 0;
+    switch (mode) {
+    case chase_load:
+      while (i < nb_iter) {
+	i++;
+	SIXTYFOUR
+	  }
+      break;
+    case chase_store:
+      while (i < nb_iter) {
+	i++;
+	TIMES64(STORE_SAME)
+	  }
+      break;
+    case chase_store_other:
+      while (i < nb_iter) {
+	i++;
+	TIMES64(STORE_OTHER)
+	  }
+      break;
+    case chase_lock:
+      while (i < nb_iter) {
+	i++;
+	TIMES64(LOCK_RMW)
+	  }
+      break;
+    }
+
+    counter_set_stop(counters);
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end);
+    double time = (end.tv_sec * 1E9 + end.tv_nsec) - (start.tv_sec * 1E9 + start.tv_nsec);
+    double latency = time / (nb_iter * 64.0);
+    struct counter_values values;
+    if (counter_set_read(counters, &counts_start, &values)) {
+      fprintf(stderr, "Cannot read the counters\n");
+      exit(-1);
+    }
+    run++;
+
+    int outlier = value_window_is_outlier(&recent_latencies, latency);
+    value_window_add(&recent_latencies, latency);
+    if (outlier) {
+      nb_outliers++;
+    } else {
+      stats_add(&times, time);
+      stats_add(&latencies, latency);
+      for (int c = 0; c < counters->nb_counters; c++) {
+	stats_add(&counts[c], values.scaled[c]);
+      }
+      enabled += values.time_enabled;
+      running += values.time_running;
+    }
+
+    if (control->target_ci > 0) {
+      if (latencies.n >= MIN_CONVERGED_RUNS && stats_ci95(&latencies) <= control->target_ci * latencies.mean) {
+	converged = 1;
+	break;
+      }
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      if ((now.tv_sec - begin.tv_sec) + (now.tv_nsec - begin.tv_nsec) / 1E9 >= control->budget_s) {
+	break;
+      }
+    } else if (run == control->nb_runs) {
+      break;
+    }
+  }
+
+  double time_deviation = stats_deviation(&times);
+  double latency_deviation = stats_deviation(&latencies);
+  double ci = stats_ci95(&latencies);
+
+  fprintf(stderr, "\nRuns: %u, outliers: %u", run, nb_outliers);
+  if (control->target_ci > 0) {
+    fprintf(stderr, ", %s", converged ? "converged" : "time budget exhausted before converging");
+  }
+  fprintf(stderr, "\nBench time:                   average = %.3f ms, standard deviation = %.3f%%\n", times.mean / 1E6, (time_deviation / times.mean) * 100);
+  fprintf(stderr, "Single memory access latency: average = %.3f ns, standard deviation = %.3f%%, 95%% CI = +/- %.3f%%\n",
+	  latencies.mean, (latency_deviation / latencies.mean) * 100, ci / latencies.mean * 100);
+
+  print_counters(counters, counts, enabled, running, 64 * (uint64_t)nb_iter);
+
+  result->nb_runs = run;
+  result->time_avg = times.mean;
+  result->latency_avg = latencies.mean;
+  result->latency_deviation = latency_deviation;
+  result->latency_ci = ci;
+  for (int c = 0; c < counters->nb_counters; c++) {
+    result->counts[c] = counter_mean(counts, c);
+  }
+}
+
+/**
+ * Times the chase starting at memory by blocks for nb_runs times
+ * nb_iter times 64 loads, prints the histogram of the latency per load
+ * and returns its percentiles in result. scale converts TSC ticks of a
+ * block to nanoseconds per load.
+ */
+static void run_histogram(uint64_t *memory, int nb_iter, unsigned int nb_runs, double scale, uint64_t overhead,
+			  struct chase_result *result) {
+  struct histogram *histogram = malloc(sizeof(struct histogram));
+  assert(histogram);
+  histogram_init(histogram);
+  for (int run = 0; run < nb_runs; run++) {
+    chase_histogram(memory, nb_iter, overhead, histogram);
+  }
+  histogram_print(stdout, histogram, scale, "ns per load");
+  for (int p = 0; p < NB_PERCENTILES; p++) {
+    result->percentiles[p] = histogram_percentile(histogram, percentile_ratios[p]) * scale;
+    printf("%s%s = %.3f ns", p == 0 ? "" : ", ", percentile_names[p], result->percentiles[p]);
+  }
+  printf("\n\n");
+  free(histogram);
+}
+
+/**
+ * Prints the results of the chase side by side, one column per page
+ * type, counters being given per load.
+ */
+static void print_results(const enum page_type_t *page_types, const struct chase_result *results, int nb_page_types,
+			  const struct counter_set *counters, uint64_t nb_loads, int with_percentiles) {
+  printf("%-18s", "Pages");
+  for (int t = 0; t < nb_page_types; t++) {
+    printf(" %-16s", page_type_name(page_types[t]));
+  }
+  printf("\n%-18s", "Backing");
+  for (int t = 0; t < nb_page_types; t++) {
+    printf(" %-16s", results[t].available ? results[t].backing : "unavailable");
+  }
+  printf("\n");
+  int nb_percentiles = with_percentiles ? NB_PERCENTILES : 0;
+  for (int row = -3; row < counters->nb_counters + nb_percentiles; row++) {
+    char title[48];
+    if (row == -3) {
+      snprintf(title, sizeof(title), "Latency (ns)");
+    } else if (row == -2) {
+      snprintf(title, sizeof(title), "Deviation (%%)");
+    } else if (row == -1) {
+      snprintf(title, sizeof(title), "95%% CI (+/- %%)");
+    } else if (row < counters->nb_counters) {
+      snprintf(title, sizeof(title), "%s/load", counters->names[row]);
+    } else {
+      snprintf(title, sizeof(title), "%s (ns)", percentile_names[row - counters->nb_counters]);
+    }
+    printf("%-18s", title);
+    for (int t = 0; t < nb_page_types; t++) {
+      const struct chase_result *result = &results[t];
+      if (!result->available) {
+	printf(" %-16s", "-");
+      } else if (row == -3) {
+	printf(" %-16.3f", result->latency_avg);
+      } else if (row == -2) {
+	printf(" %-16.3f", result->latency_deviation / result->latency_avg * 100);
+      } else if (row == -1) {
+	printf(" %-16.3f", result->latency_ci / result->latency_avg * 100);
+      } else if (row < counters->nb_counters) {
+	printf(" %-16.4f", result->counts[row] / nb_loads);
+      } else {
+	printf(" %-16.3f", result->percentiles[row - counters->nb_counters]);
+      }
+    }
+    printf("\n");
+  }
 }
 
 void usage(const char *prog_name) {
-  printf ("Usage: %s -a <access mode> -c <core> [-m <size>] [-n <node>] [-i <nb_iter>] [-r <nb_run>] [-s]\n"
-	  "\t -a: access mode is either seq or rand for sequential or random accesses\n"
+  printf ("Usage: %s -a <access mode> -c <core> [-m <size>] [-n <node>] [-i <nb_iter>] [-r <nb_run> | -C <ratio> [-T <seconds>]] [-p <npad>] [-f <nb_threads>] [-l <nb_threads>] [-e <counters>] [-t <page types>] [-w <chase mode>] [-H] [-x]\n"
+	  "\t -a: access pattern " ACCESS_PATTERN_HELP
 	  "\t -c: the core where the thread loading memory is pinned\n"
 	  "\t -m: memory size in bytes of allocated and accessed memory\n"
 	  "\t -n: the NUMA node where memory must be explicitely allocated (-1 for local allocation)\n"
 	  "\t -i: the number of time the iteration reading over 64 elements is done (-1 for infinite loop)\n"
 	  "\t -r: the number of time we repeat the bench to compute average and standard deviation (default is 1)\n"
-	  "\t -s: to remove the usage of huge pages\n",
-	  prog_name);
+	  "\t -C: instead of -r, to repeat the bench until the 95%% confidence interval of the latency is within\n"
+	  "\t     this ratio of its average (e.g. 0.01 for +/- 1%%), at least %d times\n"
+	  "\t -T: the time budget in seconds of -C for each page type (default is %d)\n"
+	  "\t -p: the number of padding words following each pointer (7 for one element per cache line, 511 for one per page)\n"
+	  "\t -f: the number of threads filling memory (default is all cpus for large memory sizes)\n"
+	  "\t -l: the number of load generator threads, pinned on the cores following -c, to print the latency\n"
+	  "\t     against the bandwidth they achieve, from idle to unthrottled (needs a finite -i)\n"
+	  "\t -e: hardware counters, read as a single group, " COUNTER_SET_HELP
+	  "\t -t: comma separated page types backing the memory, compared side by side, among all (default),\n"
+	  "\t     " PAGE_TYPE_HELP
+	  "\t -w: what follows each load of the averaged runs, -H, -l and -x only loading, among\n"
+	  "\t     " CHASE_MODE_HELP
+	  "\t -H: to also time the chase by blocks of %d loads with the TSC and print the histogram of the\n"
+	  "\t     latency per load with its percentiles\n"
+	  "\t -x: to print the idle latency and bandwidth from each cpu node to each memory node, -m being\n"
+	  "\t     well above the last level cache size for the latency (needs a finite -i, -c and -n are ignored)\n",
+	  prog_name, MIN_CONVERGED_RUNS, DEFAULT_BUDGET_S, HISTOGRAM_BLOCK);
 }
 
 int main(int argc, char **argv) {
 
-  // Assert THP is disabled
-  if (!check_THP_never()) {
-    fprintf(stderr, "THP must be disabled to run this bench:\n  write \"never\" to /sys/kernel/mm/transparent_hugepage/enabled\n");
-    return  -1;
-  }
-
-  //Get numa configuration
-  unsigned int nb_numa_nodes;
-  int numa_node_to_cpu[MAX_NB_NUMA_NODES];
-  int available = numa_available();
-  if (available == -1) {
-    nb_numa_nodes = -1;
-  } else {
-    nb_numa_nodes = numa_num_configured_nodes();
-    int nb_cpus = numa_num_configured_cpus();
-    struct bitmask *mask = numa_bitmask_alloc(nb_cpus);
-    for (int node = 0; node < nb_numa_nodes; node++) {
-      numa_node_to_cpus(node, mask);
-      numa_node_to_cpu[node] = -1;
-      for (int cpu = 0; cpu < nb_cpus; cpu++) {
-	if (*(mask->maskp) & (1 << cpu)) {
-	  numa_node_to_cpu[node] = cpu;
-	  break;
-	}
-      }
-      if (numa_node_to_cpu[node] == -1) {
-	nb_numa_nodes = -1; // to be handled properly
-      }
-    }
+  if (numa_available() == -1) {
+    fprintf(stderr, "NUMA is not available on this system\n");
+    return -1;
   }
 
   // Check and get arguments.
   size_t size_in_bytes = DEFAULT_MEM_SIZE;
-  char core = -1;
+  int core = -1;
   enum access_mode_t access_mode = access_undef;
-  char node = -1;
-  unsigned char huge_pages = 1;
+  struct fill_params fill_params;
+  fill_params_init(&fill_params);
+  const char *access_pattern = NULL;
+  int node = -1;
+  const char *page_types_spec = "all";
+  enum page_type_t page_types[MAX_PAGE_TYPES];
+  int nb_page_types = parse_page_types(page_types_spec, page_types);
   register int nb_iter = -1;
-  unsigned int nb_runs = 1;
-  for (int i = 1; i < argc; i+=2) {
-    if (!strcmp(argv[i], "-a")) {
-      if (!strcmp(argv[i+1], "seq")) {
-	access_mode = access_seq;
-      } else if (!strcmp(argv[i+1], "rand")) {
-	access_mode = access_rand;
-      } else {
-	printf("Unknown access_mode %s\n", argv[i+1]);
+  struct run_control control = {1, 0, DEFAULT_BUDGET_S};
+  size_t npad = 0;
+  int nb_loaders = -1;
+  unsigned char matrix = 0;
+  unsigned char histogram = 0;
+  enum chase_mode_t chase_mode = chase_load;
+  struct counter_set counters;
+  counter_set_parse(&counters, "default");
+  int opt;
+  while ((opt = getopt(argc, argv, "a:c:m:n:i:r:p:f:l:e:t:w:C:T:Hx")) != -1) {
+    switch (opt) {
+    case 'a':
+      access_pattern = optarg;
+      if (parse_access_pattern(access_pattern, &access_mode, &fill_params)) {
+	printf("Unknown access pattern %s\n", access_pattern);
 	usage(argv[0]);
 	return -1;
       }
-    }
-    if (!strcmp(argv[i], "-c")) {
-      core = atoi(argv[i+1]);
-      if (core >= get_nprocs()) {
+      break;
+    case 'c':
+      core = atoi(optarg);
+      if (core < 0 || core >= get_nprocs()) {
 	printf("Invalid core number %d, must be between 0 and %d\n", core, get_nprocs() - 1);
 	usage(argv[0]);
 	return -1;
       }
-    }
-    if (!strcmp(argv[i], "-m")) {
-      size_in_bytes = atol(argv[i+1]);
-    }
-    if (!strcmp(argv[i], "-n")) {
-      node = atoi(argv[i+1]);
-      if (node >= nb_numa_nodes) {
-	printf("Invalid numa node %d, must be between 0 and %d\n", node, nb_numa_nodes - 1);
+      break;
+    case 'm':
+      size_in_bytes = atol(optarg);
+      break;
+    case 'n':
+      node = atoi(optarg);
+      if (node != -1 && !is_node_configured(node)) {
+	printf("Invalid numa node %d, must be between 0 and %d\n", node, numa_max_node());
 	usage(argv[0]);
 	return -1;
       }
-    }
-    if (!strcmp(argv[i], "-i")) {
-      nb_iter = atoi(argv[i+1]);
-    }
-    if (!strcmp(argv[i], "-r")) {
-      nb_runs = atoi(argv[i+1]);
-    }
-    if (!strcmp(argv[i], "-s")) {
-      huge_pages = 0;
+      break;
+    case 'i':
+      nb_iter = atoi(optarg);
+      break;
+    case 'r':
+      control.nb_runs = atoi(optarg);
+      break;
+    case 'p':
+      npad = atol(optarg);
+      break;
+    case 'f':
+      fill_params.nb_threads = atoi(optarg);
+      break;
+    case 'l':
+      nb_loaders = atoi(optarg);
+      if (nb_loaders < 0 || nb_loaders >= get_nprocs()) {
+	printf("Invalid number of load generators %d, must be between 0 and %d\n", nb_loaders, get_nprocs() - 1);
+	usage(argv[0]);
+	return -1;
+      }
+      break;
+    case 'e':
+      if (counter_set_parse(&counters, optarg)) {
+	printf("Invalid counters %s, at most %d among known ones\n", optarg, MAX_COUNTERS);
+	usage(argv[0]);
+	return -1;
+      }
+      break;
+    case 't':
+      page_types_spec = optarg;
+      nb_page_types = parse_page_types(page_types_spec, page_types);
+      if (nb_page_types <= 0) {
+	printf("Invalid page types %s\n", page_types_spec);
+	usage(argv[0]);
+	return -1;
+      }
+      break;
+    case 'w':
+      if (parse_chase_mode(optarg, &chase_mode)) {
+	printf("Unknown chase mode %s\n", optarg);
+	usage(argv[0]);
+	return -1;
+      }
+      break;
+    case 'C':
+      control.target_ci = atof(optarg);
+      break;
+    case 'T':
+      control.budget_s = atof(optarg);
+      break;
+    case 'H':
+      histogram = 1;
+      break;
+    case 'x':
+      matrix = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return -1;
     }
   }
-  if (node == -1) {
-    node = numa_node_of_cpu(core);
-  }
   if (access_mode == access_undef) {
     usage(argv[0]);
     return -1;
   }
+  if ((nb_loaders != -1 || matrix) && nb_iter == -1) {
+    printf("Loaded latency and NUMA matrix need a finite number of iterations\n");
+    usage(argv[0]);
+    return -1;
+  }
+  if (matrix) {
+    run_numa_matrix(access_mode, npad, &fill_params, size_in_bytes, nb_iter);
+    return 0;
+  }
   if (core == -1) {
     usage(argv[0]);
     return -1;
   }
+  if (node == -1) {
+    node = numa_node_of_cpu(core);
+  }
 
   fprintf(stderr, "Benchmark parameters:\n"
 	  "  - access mode = %s\n"
@@ -205,200 +1072,130 @@ int main(int argc, char **argv) {
 	  "  - memory size = %zu bytes\n"
 	  "  - node = %d\n"
 	  "  - iterations = %d\n"
-	  "  - runs = %u\n"
-	  "  - huge pages (%" PRIu64 " Kb) = %s\n",
-	  access_mode == access_rand ? "rand" : "seq",
+	  "  - element size = %zu bytes\n"
+	  "  - page types = %s\n"
+	  "  - chase mode = %s\n",
+	  access_pattern,
 	  core,
 	  size_in_bytes,
           node,
           nb_iter,
-	  nb_runs,
-	  get_hugepage_size() / 1024,
-          huge_pages == 1 ? "yes" : "no");
-
-  // Allocate and fill memory
-  fprintf(stderr, "Allocating and filling memory ... ");
-  long unsigned int nodes = 0;
-  nodes += 1 << node;
-  assert(set_mempolicy(MPOL_BIND, &nodes, 8*sizeof(long unsigned int)) == 0);
-  uint64_t *memory;
-  if (huge_pages) {
-
-    /* assert(posix_memalign((void**)&memory, get_hugepage_size(), size_in_bytes) == 0); */
-    /* if(madvise(memory, size_in_bytes, MADV_HUGEPAGE)) { */
-    /*   fprintf(stderr, "Cannot use large pages.\n"); */
-    /* } */
-
-    memory = mmap(0, size_in_bytes, PROTECTION, FLAGS, 0, 0);
-    if (memory == MAP_FAILED) {
-      perror("mmap");
-      exit(1);
-    }
-
-
-    /* int fd = open("/mnt/huge/hugepagefile", O_CREAT | O_RDWR, 0755); */
-    /* if (fd < 0) { */
-    /*   perror("Open failed"); */
-    /*   exit(1); */
-    /* } */
-    /* memory = mmap(0, size_in_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0); */
-    /* if (memory == MAP_FAILED) { */
-    /*   perror("mmap"); */
-    /*   exit(1); */
-    /* } */
+	  (npad + 1) * sizeof(uint64_t),
+	  page_types_spec,
+	  chase_mode_names[chase_mode]);
+  if (control.target_ci > 0) {
+    fprintf(stderr, "  - runs = until the 95%% CI is within +/- %.3f%%, at most %.0f s\n",
+	    control.target_ci * 100, control.budget_s);
   } else {
-    assert(posix_memalign((void**)&memory, get_hugepage_size(), size_in_bytes) == 0);
-    /* if(madvise(memory, size_in_bytes, MADV_NOHUGEPAGE)) { */
-    /*   fprintf(stderr, "Cannot use large pages.\n"); */
-    /* } */
-  }
-  fill_memory(memory, size_in_bytes, access_mode);
-  fprintf(stderr, "done\n");
-
-  //sleep(50);
-
-  register uint64_t *p = memory;
-  asm("movq %0, %%rbx;"
-      :
-      :"r" (p)
-      :"%rbx");
-
-  /**
-   * Pin process on core CPU
-   */
-  cpu_set_t mask;
-  CPU_ZERO(&mask);
-  CPU_SET(core, &mask);
-  if (sched_setaffinity(0, sizeof(mask), &mask) == -1) {
-    printf("sched_setaffinity failed: %s\n", strerror(errno));
-    return -1;
+    fprintf(stderr, "  - runs = %u\n", control.nb_runs);
   }
 
   /**
-   * Stuff for counting the number of DTLB misses
+   * Allocate and fill memory on each page type before pinning, so that
+   * all the cpus fill it
    */
-  struct perf_event_attr pe_attr_cache;
-  memset(&pe_attr_cache, 0, sizeof(pe_attr_cache));
-  pe_attr_cache.size = sizeof(pe_attr_cache);
-  pe_attr_cache.type = PERF_TYPE_HW_CACHE;
-  pe_attr_cache.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
-  pe_attr_cache.disabled = 1;
-  pe_attr_cache.exclude_kernel = 1;
-  pe_attr_cache.exclude_hv = 1;
-  pe_attr_cache.exclude_idle = 1;
-  int dtlb_misses_fd = perf_event_open(&pe_attr_cache, 0, core, -1, 0);
-  if (dtlb_misses_fd == -1) {
-    fprintf(stderr, "perf_event_open failed for dtlb misses: %s\n", strerror(errno));
-    return -1;
+  struct bitmask *nodes = numa_allocate_nodemask();
+  numa_bitmask_setbit(nodes, node);
+  numa_set_membind(nodes);
+  numa_bitmask_free(nodes);
+  uint64_t *memories[MAX_PAGE_TYPES];
+  uint64_t *shadows[MAX_PAGE_TYPES];
+  struct chase_result results[MAX_PAGE_TYPES];
+  memset(results, 0, sizeof(results));
+  memset(shadows, 0, sizeof(shadows));
+  for (int t = 0; t < nb_page_types; t++) {
+    fprintf(stderr, "Allocating and filling memory on %s pages ... ", page_type_name(page_types[t]));
+    memories[t] = alloc_memory(size_in_bytes, page_types[t]);
+    if (memories[t] == NULL) {
+      fprintf(stderr, "cannot allocate them%s\n",
+	      page_types[t] >= page_hugetlb ? ", reserve some in /sys/kernel/mm/hugepages" : "");
+      continue;
+    }
+    if (chase_mode == chase_store_other) {
+      shadows[t] = alloc_memory(size_in_bytes, page_types[t]);
+      if (shadows[t] == NULL) {
+	fprintf(stderr, "cannot allocate the shadow buffer\n");
+	free_memory(memories[t], size_in_bytes, page_types[t]);
+	continue;
+      }
+      memset(shadows[t], 0, size_in_bytes);
+    }
+    double fill_time = fill_memory_params(memories[t], size_in_bytes, access_mode, npad, &fill_params);
+    results[t].available = 1;
+    describe_backing(memories[t], size_in_bytes, results[t].backing, sizeof(results[t].backing));
+    fprintf(stderr, "done in %.3f s, backed by %s\n", fill_time, results[t].backing);
   }
 
   /**
-   * Stuff for counting the number of cache misses 2
+   * Pin process on core CPU
    */
-  struct perf_event_attr pe_attr_cache2;
-  memset(&pe_attr_cache2, 0, sizeof(pe_attr_cache2));
-  pe_attr_cache2.size = sizeof(pe_attr_cache2);
-  pe_attr_cache2.type = PERF_TYPE_HARDWARE;
-  pe_attr_cache2.config = PERF_COUNT_HW_CACHE_MISSES;
-  pe_attr_cache2.disabled = 1;
-  pe_attr_cache2.exclude_kernel = 1;
-  pe_attr_cache2.exclude_hv = 1;
-  pe_attr_cache2.exclude_idle = 1;
-  int cache_misses_fd = perf_event_open(&pe_attr_cache2, 0, core, -1, 0);
-  if (cache_misses_fd == -1) {
-    fprintf(stderr, "perf_event_open failed for cache misses: %s\n", strerror(errno));
-    return -1;
-  }
+  pin_on_cpu(core);
 
   /**
    * Loop over memory either infinite or not
    */
   if (nb_iter == -1) {
-    // Infinite loop
-    while (1)
-      SIXTYFOUR
-	}
-
-
-  uint64_t *times = malloc(nb_runs * sizeof(uint64_t));
-  float *latencies = malloc(nb_runs * sizeof(float));
-  uint64_t *dtlb_misses = malloc(nb_runs * sizeof(uint64_t));
-  uint64_t *cache_misses = malloc(nb_runs * sizeof(uint64_t));
-  assert(times);
-  assert(latencies);
-  assert(dtlb_misses);
-  assert(cache_misses);
-
-  for (int run = 0; run < nb_runs; run++) {
-
-    fprintf(stderr, "\rRun %d", run + 1);
+    // Infinite loop over the first available page type
+    for (int t = 0; t < nb_page_types; t++) {
+      if (results[t].available) {
+	fprintf(stderr, "Chasing on %s pages\n", page_type_name(page_types[t]));
+	asm("movq %0, %%rbx;"
+	    :
+	    :"r" (memories[t])
+	    :"%rbx");
+	while (1)
+	  SIXTYFOUR
+	    }
+    }
+    return -1;
+  }
 
+  if (nb_loaders != -1) {
+    for (int t = 0; t < nb_page_types; t++) {
+      if (results[t].available) {
+	printf("%s pages (%s):\n", page_type_name(page_types[t]), results[t].backing);
+	run_loaded_latency(memories[t], nb_iter, core, nb_loaders, size_in_bytes);
+	printf("\n");
+      }
+    }
+  } else {
     /**
-     * Loop the specified number of time
+     * Counters of the chase, run without them if they are not available
      */
-    struct timespec start, end;
-    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
-
-    ioctl(cache_misses_fd, PERF_EVENT_IOC_RESET, 0);
-    ioctl(dtlb_misses_fd, PERF_EVENT_IOC_RESET, 0);
-    ioctl(cache_misses_fd, PERF_EVENT_IOC_ENABLE, 0);
-    ioctl(dtlb_misses_fd, PERF_EVENT_IOC_ENABLE, 0);
-
-    int register i = 0;
-    while (i < nb_iter) {
-      i++;
-      SIXTYFOUR
+    if (counter_set_open(&counters, core)) {
+      fprintf(stderr, "Cannot open the counters: %s, running without them\n", strerror(errno));
+      counters.nb_counters = 0;
+    }
+    double scale = 0;
+    uint64_t overhead = 0;
+    if (histogram) {
+      scale = 1 / (tsc_per_ns() * HISTOGRAM_BLOCK);
+      overhead = tsc_overhead();
+      fprintf(stderr, "TSC: %.3f GHz, read overhead = %" PRIu64 " ticks\n", 1 / (scale * HISTOGRAM_BLOCK), overhead);
+    }
+    for (int t = 0; t < nb_page_types; t++) {
+      if (results[t].available) {
+	fprintf(stderr, "%s pages:\n", page_type_name(page_types[t]));
+	intptr_t shadow_offset = (char *)shadows[t] - (char *)memories[t];
+	run_chase(memories[t], nb_iter, chase_mode, shadow_offset, &control, &counters, &results[t]);
+	if (histogram) {
+	  printf("%s pages (%s) latency histogram:\n", page_type_name(page_types[t]), results[t].backing);
+	  run_histogram(memories[t], nb_iter, results[t].nb_runs, scale, overhead, &results[t]);
 	}
+      }
+    }
+    counter_set_close(&counters);
+    print_results(page_types, results, nb_page_types, &counters, 64 * (uint64_t)nb_iter, histogram);
+  }
 
-    ioctl(dtlb_misses_fd, PERF_EVENT_IOC_DISABLE, 0);
-    ioctl(cache_misses_fd, PERF_EVENT_IOC_DISABLE, 0);
-
-    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end);
-    times[run] = (end.tv_sec * 1E9 + end.tv_nsec) - (start.tv_sec * 1E9 + start.tv_nsec);
-    latencies[run] = times[run] / (nb_iter * 64.0);
-    read(dtlb_misses_fd, &(dtlb_misses[run]), sizeof(dtlb_misses[run]));
-    read(cache_misses_fd, &(cache_misses[run]), sizeof(cache_misses[run]));
-  }
-
-  uint64_t time_sum = 0;
-  float latency_sum = 0;
-  uint64_t dtlb_misses_sum = 0;
-  uint64_t cache_misses_sum = 0;
-  for (int i = 0; i < nb_runs; i++) {
-    time_sum += times[i];
-    latency_sum += latencies[i];
-    dtlb_misses_sum += dtlb_misses[i];
-    cache_misses_sum += cache_misses[i];
-  }
-  float time_avg = time_sum / (float)nb_runs;
-  float latency_avg = latency_sum / (float)nb_runs;
-  float dtlb_misses_avg = dtlb_misses_sum / (float)nb_runs;
-  float cache_misses_avg = cache_misses_sum / (float)nb_runs;
-
-  uint64_t time_deviation_sum = 0;
-  float latency_deviation_sum = 0;
-  uint64_t dtlb_misses_deviation_sum = 0;
-  uint64_t cache_misses_deviation_sum = 0;
-  for (int i = 0; i < nb_runs; i++) {
-    time_deviation_sum += (times[i] - time_avg) * (times[i] - time_avg);
-    latency_deviation_sum += (latencies[i] - latency_avg) * (latencies[i] - latency_avg);
-    dtlb_misses_deviation_sum += (dtlb_misses[i] - dtlb_misses_avg) * (dtlb_misses[i] - dtlb_misses_avg);
-    cache_misses_deviation_sum += (cache_misses[i] - cache_misses_avg) * (cache_misses[i] - cache_misses_avg);
-  }
-  float time_deviation = sqrt(time_deviation_sum / (float)nb_runs);
-  float latency_deviation = sqrt(latency_deviation_sum / (float)nb_runs);
-  float dtlb_misses_deviation = sqrt(dtlb_misses_deviation_sum / (float)nb_runs);
-  float cache_misses_deviation = sqrt(cache_misses_deviation_sum / (float)nb_runs);
-
-  fprintf(stderr, "\nBench time:                   average = %.3f ms, standard deviation = %.3f%%\n", time_avg / 1E6, (time_deviation / time_avg) * 100);
-  fprintf(stderr, "Single memory access latency: average = %.3f ns, standard deviation = %.3f%%\n", latency_avg, (latency_deviation / latency_avg) * 100);
-  fprintf(stderr, "Data tlb misses %% (among all reads): average = %.3f, standard deviation = %.3f%%\n", (dtlb_misses_avg * 100) / (64.0 * nb_iter), (dtlb_misses_deviation / dtlb_misses_avg) * 100);
-  fprintf(stderr, "Cache misses %% (among all reads)   : average = %.3f, standard deviation = %.3f%%\n", (cache_misses_avg * 100) / (64.0 * nb_iter), (cache_misses_deviation / cache_misses_avg) * 100);
-
-  free(times);
-  free(latencies);
-  free(dtlb_misses);
-  free(cache_misses);
+  for (int t = 0; t < nb_page_types; t++) {
+    if (results[t].available) {
+      free_memory(memories[t], size_in_bytes, page_types[t]);
+    }
+    if (shadows[t] != NULL) {
+      free_memory(shadows[t], size_in_bytes, page_types[t]);
+    }
+  }
 
   return 0;
 }
@@ -0,0 +1,91 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+
+/**
+ * Two-sided 95% quantiles of Student's t distribution for 1 to 30
+ * degrees of freedom, the normal one being used above.
+ */
+static const double t95[] = {
+  12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+  2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+  2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
+#define NB_T95 (sizeof(t95) / sizeof(t95[0]))
+
+/**
+ * Ratio of the standard deviation to the median absolute deviation for
+ * normally distributed values.
+ */
+#define MAD_TO_SIGMA 1.4826
+
+void stats_init(struct running_stats *stats) {
+  stats->n = 0;
+  stats->mean = 0;
+  stats->m2 = 0;
+}
+
+void stats_add(struct running_stats *stats, double value) {
+  stats->n++;
+  double delta = value - stats->mean;
+  stats->mean += delta / stats->n;
+  stats->m2 += delta * (value - stats->mean);
+}
+
+double stats_deviation(const struct running_stats *stats) {
+  return stats->n < 2 ? 0 : sqrt(stats->m2 / (stats->n - 1));
+}
+
+void value_window_init(struct value_window *window) {
+  window->n = 0;
+}
+
+void value_window_add(struct value_window *window, double value) {
+  window->values[window->n % OUTLIER_WINDOW] = value;
+  window->n++;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * Sorts the n values and returns their median.
+ */
+static double median(double *values, int n) {
+  qsort(values, n, sizeof(double), compare_doubles);
+  return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+int value_window_is_outlier(const struct value_window *window, double value) {
+  if (window->n < OUTLIER_MIN_VALUES) {
+    return 0;
+  }
+  int n = window->n < OUTLIER_WINDOW ? window->n : OUTLIER_WINDOW;
+  double scratch[OUTLIER_WINDOW];
+  memcpy(scratch, window->values, n * sizeof(double));
+  double center = median(scratch, n);
+  for (int i = 0; i < n; i++) {
+    scratch[i] = fabs(scratch[i] - center);
+  }
+  double mad = median(scratch, n);
+
+  /**
+   * Without any spread, e.g. on a coarse clock, there is nothing to
+   * tell an outlier from.
+   */
+  return mad > 0 && fabs(value - center) > OUTLIER_SIGMAS * MAD_TO_SIGMA * mad;
+}
+
+double stats_ci95(const struct running_stats *stats) {
+  if (stats->n < 2) {
+    return INFINITY;
+  }
+  uint64_t df = stats->n - 1;
+  double t = df <= NB_T95 ? t95[df - 1] : 1.960;
+  return t * stats_deviation(stats) / sqrt(stats->n);
+}
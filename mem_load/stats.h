@@ -0,0 +1,61 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+/**
+ * A value further than OUTLIER_SIGMAS standard deviations from the
+ * median of the last OUTLIER_WINDOW values, when there are at least
+ * OUTLIER_MIN_VALUES of them, is an outlier, the standard deviation
+ * being estimated from the median absolute deviation so that the
+ * outliers themselves do not inflate it.
+ */
+#define OUTLIER_SIGMAS 3.0
+#define OUTLIER_MIN_VALUES 5
+#define OUTLIER_WINDOW 64
+
+/**
+ * Streaming mean and variance (Welford's algorithm), numerically stable
+ * without keeping the values.
+ */
+struct running_stats {
+  uint64_t n;
+  double mean;
+  double m2;
+};
+
+void stats_init(struct running_stats *stats);
+
+void stats_add(struct running_stats *stats, double value);
+
+/**
+ * Returns the sample standard deviation, 0 for less than two values.
+ */
+double stats_deviation(const struct running_stats *stats);
+
+/**
+ * The last OUTLIER_WINDOW values added, kept for order statistics in
+ * constant space and time.
+ */
+struct value_window {
+  uint64_t n;
+  double values[OUTLIER_WINDOW];
+};
+
+void value_window_init(struct value_window *window);
+
+void value_window_add(struct value_window *window, double value);
+
+/**
+ * Returns whether value is an outlier among the values of window, by
+ * their median and median absolute deviation.
+ */
+int value_window_is_outlier(const struct value_window *window, double value);
+
+/**
+ * Returns the half width of the 95% confidence interval of the mean,
+ * from Student's t distribution, infinite for less than two values.
+ */
+double stats_ci95(const struct running_stats *stats);
+
+#endif
@@ -1,54 +1,560 @@
- #define _GNU_SOURCE
+#define _GNU_SOURCE
 #include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <assert.h>
+#include <unistd.h>
 #include <sched.h>
+#include <time.h>
+#include <stdatomic.h>
 
-int a, b = 0;
-pthread_barrier_t barrier;
+#define LINE_SIZE 64
+#define MAX_THREADS 4
+#define MAX_OBSERVED 4
+#define DEFAULT_NB_ITERATIONS 1000000
 
-void *t1_f(void *p) {
-  pthread_barrier_wait(&barrier);
-  a = 1;
-  if (b == 0) {
-    printf("t1\n");
+/**
+ * Observed values are 0, 1 or 2, packed on OBSERVED_BITS bits each in
+ * the index of the outcome.
+ */
+#define OBSERVED_BITS 2
+#define NB_OUTCOMES (1 << (OBSERVED_BITS * MAX_OBSERVED))
+
+#define COMPILER_BARRIER asm volatile("" ::: "memory")
+
+/**
+ * Shared locations and per-thread registers, each on its own line.
+ */
+struct location {
+  volatile int value;
+  char padding[LINE_SIZE - sizeof(int)];
+} __attribute__((aligned(LINE_SIZE)));
+
+struct registers {
+  int r[2];
+  char padding[LINE_SIZE - 2 * sizeof(int)];
+} __attribute__((aligned(LINE_SIZE)));
+
+struct litmus_state {
+  struct location x;
+  struct location y;
+  struct registers regs[MAX_THREADS];
+};
+
+/**
+ * A litmus test: the code of each of its threads, run concurrently at
+ * each iteration, and the values observed once they are all done. The
+ * relaxed outcome is the one showing a reordering.
+ */
+struct litmus_test {
+  const char *name;
+  int nb_threads;
+  void (*code[MAX_THREADS])(struct litmus_state *state);
+  int nb_observed;
+  const char *observed_names[MAX_OBSERVED];
+  void (*observe)(const struct litmus_state *state, int *values);
+  int relaxed[MAX_OBSERVED];
+  const char *relaxed_note;
+};
+
+/**
+ * SB (store buffering): each thread stores to one location then loads
+ * the other one.
+ */
+static void sb_0(struct litmus_state *s) {
+  s->x.value = 1;
+  COMPILER_BARRIER;
+  s->regs[0].r[0] = s->y.value;
+}
+
+static void sb_1(struct litmus_state *s) {
+  s->y.value = 1;
+  COMPILER_BARRIER;
+  s->regs[1].r[0] = s->x.value;
+}
+
+static void observe_2_threads(const struct litmus_state *s, int *values) {
+  values[0] = s->regs[0].r[0];
+  values[1] = s->regs[1].r[0];
+}
+
+/**
+ * MP (message passing): data then flag, read back in the opposite
+ * order.
+ */
+static void mp_0(struct litmus_state *s) {
+  s->x.value = 1;
+  COMPILER_BARRIER;
+  s->y.value = 1;
+}
+
+static void mp_1(struct litmus_state *s) {
+  s->regs[1].r[0] = s->y.value;
+  COMPILER_BARRIER;
+  s->regs[1].r[1] = s->x.value;
+}
+
+static void observe_mp(const struct litmus_state *s, int *values) {
+  values[0] = s->regs[1].r[0];
+  values[1] = s->regs[1].r[1];
+}
+
+/**
+ * LB (load buffering): each thread loads one location then stores to
+ * the other one.
+ */
+static void lb_0(struct litmus_state *s) {
+  s->regs[0].r[0] = s->x.value;
+  COMPILER_BARRIER;
+  s->y.value = 1;
+}
+
+static void lb_1(struct litmus_state *s) {
+  s->regs[1].r[0] = s->y.value;
+  COMPILER_BARRIER;
+  s->x.value = 1;
+}
+
+/**
+ * IRIW (independent reads of independent writes): two writers, and two
+ * readers reading the locations in opposite orders.
+ */
+static void iriw_0(struct litmus_state *s) {
+  s->x.value = 1;
+}
+
+static void iriw_1(struct litmus_state *s) {
+  s->y.value = 1;
+}
+
+static void iriw_2(struct litmus_state *s) {
+  s->regs[2].r[0] = s->x.value;
+  COMPILER_BARRIER;
+  s->regs[2].r[1] = s->y.value;
+}
+
+static void iriw_3(struct litmus_state *s) {
+  s->regs[3].r[0] = s->y.value;
+  COMPILER_BARRIER;
+  s->regs[3].r[1] = s->x.value;
+}
+
+static void observe_iriw(const struct litmus_state *s, int *values) {
+  values[0] = s->regs[2].r[0];
+  values[1] = s->regs[2].r[1];
+  values[2] = s->regs[3].r[0];
+  values[3] = s->regs[3].r[1];
+}
+
+/**
+ * 2+2W: each thread stores 1 then 2 to the locations in opposite
+ * orders, the final values being observed.
+ */
+static void w22_0(struct litmus_state *s) {
+  s->x.value = 1;
+  COMPILER_BARRIER;
+  s->y.value = 2;
+}
+
+static void w22_1(struct litmus_state *s) {
+  s->y.value = 1;
+  COMPILER_BARRIER;
+  s->x.value = 2;
+}
+
+static void observe_final(const struct litmus_state *s, int *values) {
+  values[0] = s->x.value;
+  values[1] = s->y.value;
+}
+
+/**
+ * Variants of SB with a fence between the store and the load, to
+ * measure both whether it prevents the reordering and what it costs.
+ */
+#define SB_FENCED(name, fence)				\
+  static void name##_0(struct litmus_state *s) {	\
+    s->x.value = 1;					\
+    fence;						\
+    s->regs[0].r[0] = s->y.value;			\
+  }							\
+  static void name##_1(struct litmus_state *s) {	\
+    s->y.value = 1;					\
+    fence;						\
+    s->regs[1].r[0] = s->x.value;			\
+  }
+
+SB_FENCED(sb_mfence, asm volatile("mfence" ::: "memory"))
+SB_FENCED(sb_lock_add, asm volatile("lock addl $0, (%%rsp)" ::: "memory", "cc"))
+SB_FENCED(sb_sfence, asm volatile("sfence" ::: "memory"))
+SB_FENCED(sb_lfence, asm volatile("lfence" ::: "memory"))
+SB_FENCED(sb_relaxed, atomic_thread_fence(memory_order_relaxed))
+SB_FENCED(sb_consume, atomic_thread_fence(memory_order_consume))
+SB_FENCED(sb_acquire, atomic_thread_fence(memory_order_acquire))
+SB_FENCED(sb_release, atomic_thread_fence(memory_order_release))
+SB_FENCED(sb_acq_rel, atomic_thread_fence(memory_order_acq_rel))
+SB_FENCED(sb_seq_cst, atomic_thread_fence(memory_order_seq_cst))
+
+/**
+ * SB with the stores done by xchg, implicitly locked.
+ */
+static void sb_xchg_0(struct litmus_state *s) {
+  int one = 1;
+  asm volatile("xchg %0, %1" : "+r"(one), "+m"(s->x.value) :: "memory");
+  s->regs[0].r[0] = s->y.value;
+}
+
+static void sb_xchg_1(struct litmus_state *s) {
+  int one = 1;
+  asm volatile("xchg %0, %1" : "+r"(one), "+m"(s->y.value) :: "memory");
+  s->regs[1].r[0] = s->x.value;
+}
+
+#define SB_VARIANT(name, function, note)					\
+  {name, 2, {function##_0, function##_1}, 2, {"0:r0", "1:r0"}, observe_2_threads, {0, 0}, note}
+
+static const struct litmus_test tests[] = {
+  {"sb", 2, {sb_0, sb_1}, 2, {"0:r0", "1:r0"}, observe_2_threads, {0, 0},
+   "allowed on x86 (store buffer)"},
+  {"mp", 2, {mp_0, mp_1}, 2, {"1:r0", "1:r1"}, observe_mp, {1, 0},
+   "forbidden on x86"},
+  {"lb", 2, {lb_0, lb_1}, 2, {"0:r0", "1:r0"}, observe_2_threads, {1, 1},
+   "forbidden on x86"},
+  {"iriw", 4, {iriw_0, iriw_1, iriw_2, iriw_3}, 4, {"2:r0", "2:r1", "3:r0", "3:r1"}, observe_iriw, {1, 0, 1, 0},
+   "forbidden on x86 (multi-copy atomic)"},
+  {"2+2w", 2, {w22_0, w22_1}, 2, {"x", "y"}, observe_final, {1, 1},
+   "forbidden on x86"},
+  SB_VARIANT("sb+mfence", sb_mfence, "forbidden, mfence drains the store buffer"),
+  SB_VARIANT("sb+lock-add", sb_lock_add, "forbidden, locked instructions drain the store buffer"),
+  SB_VARIANT("sb+xchg", sb_xchg, "forbidden, xchg is implicitly locked"),
+  SB_VARIANT("sb+sfence", sb_sfence, "allowed, sfence only orders stores"),
+  SB_VARIANT("sb+lfence", sb_lfence, "allowed, lfence does not wait for stores"),
+  SB_VARIANT("sb+relaxed", sb_relaxed, "allowed, no fence"),
+  SB_VARIANT("sb+consume", sb_consume, "allowed, compiler barrier only on x86"),
+  SB_VARIANT("sb+acquire", sb_acquire, "allowed, compiler barrier only on x86"),
+  SB_VARIANT("sb+release", sb_release, "allowed, compiler barrier only on x86"),
+  SB_VARIANT("sb+acq_rel", sb_acq_rel, "allowed, compiler barrier only on x86"),
+  SB_VARIANT("sb+seq_cst", sb_seq_cst, "forbidden, a full fence on x86")
+};
+
+#define NB_TESTS (sizeof(tests) / sizeof(tests[0]))
+
+/**
+ * Sense-reversing spin barrier: the last thread to arrive resets the
+ * count and flips the sense the others are spinning on, so that it can
+ * be reused at once. When threads share a cpu, the waiting ones yield
+ * it instead, or else each crossing would last a time slice.
+ */
+struct spin_barrier {
+  volatile int count;
+  char padding[LINE_SIZE - sizeof(int)];
+  volatile int sense;
+  int nb_threads;
+  int yield;
+} __attribute__((aligned(LINE_SIZE)));
+
+static void spin_barrier_init(struct spin_barrier *barrier, int nb_threads, int yield) {
+  barrier->count = nb_threads;
+  barrier->sense = 0;
+  barrier->nb_threads = nb_threads;
+  barrier->yield = yield;
+}
+
+static void spin_barrier_wait(struct spin_barrier *barrier, int *local_sense) {
+  *local_sense = !*local_sense;
+  if (__atomic_sub_fetch(&barrier->count, 1, __ATOMIC_ACQ_REL) == 0) {
+    barrier->count = barrier->nb_threads;
+    __atomic_store_n(&barrier->sense, *local_sense, __ATOMIC_RELEASE);
+  } else {
+    while (__atomic_load_n(&barrier->sense, __ATOMIC_ACQUIRE) != *local_sense) {
+      if (barrier->yield) {
+	sched_yield();
+      } else {
+	asm volatile("pause");
+      }
+    }
+  }
+}
+
+/**
+ * Runs of a test: the threads stay alive for all the iterations, each
+ * one being released by the barrier, and thread 0 records the outcome
+ * and resets the state once they are all done.
+ */
+struct litmus_run {
+  const struct litmus_test *test;
+  struct litmus_state *state;
+  struct spin_barrier barrier;
+  int nb_iterations;
+  uint64_t *outcomes;
+};
+
+struct litmus_thread {
+  pthread_t thread;
+  int id;
+  int cpu;
+  struct litmus_run *run;
+  uint64_t ticks;
+};
+
+/**
+ * Summary of a run: how often the relaxed outcome showed up, and the TSC
+ * ticks taken by the code of a thread per iteration.
+ */
+struct litmus_result {
+  double relaxed_rate;
+  double ticks;
+};
+
+/**
+ * Reads the TSC once the previous instructions are done, and before the
+ * following ones start.
+ */
+static inline uint64_t tsc_start() {
+  uint32_t low, high;
+  asm volatile("lfence; rdtsc; lfence" : "=a" (low), "=d" (high));
+  return ((uint64_t)high << 32) | low;
+}
+
+/**
+ * Reads the TSC once all the previous instructions are done, and before
+ * the following ones start.
+ */
+static inline uint64_t tsc_end() {
+  uint32_t low, high;
+  asm volatile("rdtscp; lfence" : "=a" (low), "=d" (high) : : "%rcx");
+  return ((uint64_t)high << 32) | low;
+}
+
+static void pin_on_cpu(int cpu) {
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  CPU_SET(cpu, &mask);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask)) {
+    fprintf(stderr, "Cannot pin on cpu %d\n", cpu);
+    exit(-1);
+  }
+}
+
+static int outcome_index(const int *values, int nb_observed) {
+  int index = 0;
+  for (int v = 0; v < nb_observed; v++) {
+    index |= values[v] << (v * OBSERVED_BITS);
+  }
+  return index;
+}
+
+static void reset_state(struct litmus_state *state) {
+  state->x.value = 0;
+  state->y.value = 0;
+  for (int t = 0; t < MAX_THREADS; t++) {
+    state->regs[t].r[0] = 0;
+    state->regs[t].r[1] = 0;
   }
-  return NULL;
 }
 
-void *t2_f(void *p) {
-  pthread_barrier_wait(&barrier);
-  b = 1;
-  if (a == 0) {
-    printf("t2\n");
+static void *run_thread(void *arg) {
+  struct litmus_thread *thread = arg;
+  struct litmus_run *run = thread->run;
+  const struct litmus_test *test = run->test;
+  void (*code)(struct litmus_state *) = test->code[thread->id];
+  pin_on_cpu(thread->cpu);
+  int sense = 0;
+  thread->ticks = 0;
+  for (int i = 0; i < run->nb_iterations; i++) {
+    spin_barrier_wait(&run->barrier, &sense);
+    uint64_t start = tsc_start();
+    code(run->state);
+    thread->ticks += tsc_end() - start;
+    spin_barrier_wait(&run->barrier, &sense);
+    if (thread->id == 0) {
+      int values[MAX_OBSERVED];
+      test->observe(run->state, values);
+      run->outcomes[outcome_index(values, test->nb_observed)]++;
+      reset_state(run->state);
+    }
   }
   return NULL;
 }
 
-int main() {
+/**
+ * Runs test for nb_iterations iterations, its threads pinned on cpus,
+ * prints the outcomes with their frequencies and fills result.
+ */
+static void run_test(const struct litmus_test *test, int nb_iterations, const int *cpus,
+		     struct litmus_result *result) {
+  struct litmus_run *run;
+  assert(posix_memalign((void **)&run, LINE_SIZE, sizeof(struct litmus_run)) == 0);
+  assert(posix_memalign((void **)&run->state, LINE_SIZE, sizeof(struct litmus_state)) == 0);
+  run->outcomes = calloc(NB_OUTCOMES, sizeof(uint64_t));
+  assert(run->outcomes);
+  run->test = test;
+  run->nb_iterations = nb_iterations;
+  reset_state(run->state);
+  int shared = 0;
+  for (int t = 0; t < test->nb_threads; t++) {
+    for (int u = 0; u < t; u++) {
+      shared |= cpus[t] == cpus[u];
+    }
+  }
+  spin_barrier_init(&run->barrier, test->nb_threads, shared);
+
+  struct litmus_thread threads[MAX_THREADS];
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int t = 0; t < test->nb_threads; t++) {
+    threads[t].id = t;
+    threads[t].cpu = cpus[t];
+    threads[t].run = run;
+    int ret;
+    if ((ret = pthread_create(&threads[t].thread, NULL, run_thread, &threads[t]))) {
+      fprintf(stderr, "%s\n", strerror(ret));
+      exit(-1);
+    }
+  }
+  for (int t = 0; t < test->nb_threads; t++) {
+    pthread_join(threads[t].thread, NULL);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1E9;
+
+  printf("%s: %d iterations in %.3f s (%.3f M/s) on cpus", test->name, nb_iterations, seconds,
+	 nb_iterations / seconds / 1E6);
+  for (int t = 0; t < test->nb_threads; t++) {
+    printf("%s%d", t == 0 ? " " : ",", cpus[t]);
+  }
+  printf("\n%-32s %-12s %-10s\n", "Outcome", "Count", "%");
+  int relaxed = outcome_index(test->relaxed, test->nb_observed);
+  for (int o = 0; o < NB_OUTCOMES; o++) {
+    if (run->outcomes[o] == 0 && o != relaxed) {
+      continue;
+    }
+    char outcome[64] = "";
+    for (int v = 0; v < test->nb_observed; v++) {
+      char value[16];
+      snprintf(value, sizeof(value), "%s%s=%d", v == 0 ? "" : " ", test->observed_names[v],
+	       (o >> (v * OBSERVED_BITS)) & ((1 << OBSERVED_BITS) - 1));
+      strncat(outcome, value, sizeof(outcome) - strlen(outcome) - 1);
+    }
+    printf("%-32s %-12lu %-10.4f%s%s\n", outcome, run->outcomes[o], run->outcomes[o] * 100.0 / nb_iterations,
+	   o == relaxed ? " <- relaxed, " : "", o == relaxed ? test->relaxed_note : "");
+  }
+  result->relaxed_rate = (double)run->outcomes[relaxed] / nb_iterations;
+  result->ticks = 0;
+  for (int t = 0; t < test->nb_threads; t++) {
+    result->ticks += (double)threads[t].ticks / nb_iterations / test->nb_threads;
+  }
+  printf("Code of a thread: %.1f TSC ticks per iteration\n\n", result->ticks);
+
+  free(run->outcomes);
+  free(run->state);
+  free(run);
+}
+
+void usage(const char *prog_name) {
+  printf("Usage: %s [-t <tests>] [-n <nb_iterations>] [-c <cpus>]\n"
+	 "\t -t: comma separated litmus tests among sb, mp, lb, iriw, 2+2w and the fenced variants of sb,\n"
+	 "\t     sb+mfence, sb+lock-add, sb+xchg, sb+sfence, sb+lfence and sb+<order> for the C11\n"
+	 "\t     atomic_thread_fence of each memory order, relaxed to seq_cst (default is all)\n"
+	 "\t -n: the number of iterations of each test (default is %d)\n"
+	 "\t -c: comma separated cpus of the threads of the tests (default is the first allowed cpus)\n",
+	 prog_name, DEFAULT_NB_ITERATIONS);
+}
 
-  pthread_t t1, t2;
-  pthread_attr_t t1_attr, t2_attr;
-  pthread_attr_init(&t1_attr);
-  pthread_attr_init(&t2_attr);
-  cpu_set_t cpuset;
-  CPU_ZERO(&cpuset);
-  CPU_SET(1, &cpuset);
-  pthread_attr_setaffinity_np(&t1_attr, sizeof(cpuset), &cpuset);
-  CPU_ZERO(&cpuset);
-  CPU_SET(3, &cpuset);
-  pthread_attr_setaffinity_np(&t2_attr, sizeof(cpuset), &cpuset);
-  pthread_barrier_init(&barrier, NULL, 2);
-  int ret;
-  if ((ret = pthread_create(&t1, &t1_attr, t1_f, NULL))) {
-    fprintf (stderr, "%s", strerror (ret));
+/**
+ * Returns whether name is in the comma separated list, or list is NULL.
+ */
+static int in_list(const char *list, const char *name) {
+  if (list == NULL) {
+    return 1;
   }
-  if ((ret = pthread_create(&t2, &t2_attr, t2_f, NULL))) {
-    fprintf (stderr, "%s", strerror (ret));
+  size_t length = strlen(name);
+  for (const char *p = list; p != NULL; p = strchr(p, ',') ? strchr(p, ',') + 1 : NULL) {
+    if (!strncmp(p, name, length) && (p[length] == ',' || p[length] == '\0')) {
+      return 1;
+    }
   }
+  return 0;
+}
 
-  pthread_join(t1, NULL);
-  pthread_join(t2, NULL);
+int main(int argc, char **argv) {
+  const char *tests_list = NULL;
+  int nb_iterations = DEFAULT_NB_ITERATIONS;
+  int cpus[MAX_THREADS];
+  int nb_cpus = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "t:n:c:")) != -1) {
+    switch (opt) {
+    case 't':
+      tests_list = optarg;
+      break;
+    case 'n':
+      nb_iterations = atoi(optarg);
+      break;
+    case 'c':
+      for (char *cpu = strtok(optarg, ","); cpu != NULL && nb_cpus < MAX_THREADS; cpu = strtok(NULL, ",")) {
+	cpus[nb_cpus++] = atoi(cpu);
+      }
+      break;
+    default:
+      usage(argv[0]);
+      return -1;
+    }
+  }
 
+  /**
+   * Missing cpus are the first allowed ones not given yet.
+   */
+  cpu_set_t allowed;
+  assert(sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+  for (int cpu = 0; cpu < CPU_SETSIZE && nb_cpus < MAX_THREADS; cpu++) {
+    int given = 0;
+    for (int c = 0; c < nb_cpus; c++) {
+      given |= cpus[c] == cpu;
+    }
+    if (CPU_ISSET(cpu, &allowed) && !given) {
+      cpus[nb_cpus++] = cpu;
+    }
+  }
+  if (nb_cpus < MAX_THREADS) {
+    fprintf(stderr, "Warning: only %d cpus, threads of the tests will share them and yield at each iteration\n",
+	    nb_cpus);
+    for (int c = nb_cpus; c < MAX_THREADS; c++) {
+      cpus[c] = cpus[c % nb_cpus];
+    }
+  }
+
+  struct litmus_result results[NB_TESTS];
+  int ran[NB_TESTS];
+  for (int t = 0; t < NB_TESTS; t++) {
+    ran[t] = in_list(tests_list, tests[t].name);
+    if (ran[t]) {
+      run_test(&tests[t], nb_iterations, cpus, &results[t]);
+    }
+  }
+
+  /**
+   * Compares the SB variants that ran, the ticks added by each fence
+   * being relative to plain SB, test 0, when it ran too.
+   */
+  int nb_sb = 0;
+  for (int t = 0; t < NB_TESTS; t++) {
+    nb_sb += ran[t] && !strncmp(tests[t].name, "sb", 2);
+  }
+  if (nb_sb > 1) {
+    printf("%-14s %-14s %-14s %-14s\n", "SB variant", "Reordered (%)", "Ticks/iter", "Added ticks");
+    for (int t = 0; t < NB_TESTS; t++) {
+      if (!ran[t] || strncmp(tests[t].name, "sb", 2)) {
+	continue;
+      }
+      printf("%-14s %-14.4f %-14.1f ", tests[t].name, results[t].relaxed_rate * 100, results[t].ticks);
+      if (ran[0]) {
+	printf("%-14.1f\n", results[t].ticks - results[0].ticks);
+      } else {
+	printf("%-14s\n", "-");
+      }
+    }
+  }
   return 0;
 }
@@ -1,14 +1,15 @@
-#! /usr/bin/python
+#! /usr/bin/python3
+
+# Prints how often the store buffering outcome of SB shows up: the
+# iterations all run in a single mem_model process, on its first two
+# allowed cpus.
 
-import os
-import shutil
 import subprocess
 
-count = 0
-for i in range(100000):
-    proc = subprocess.Popen(['mem_model'], stdout=subprocess.PIPE, stderr=subprocess.PIPE)
-    out = proc.communicate()[0]
-    if out.count('\n') == 2:
-        count += 1
-        #print out,
-print 'count = ' + str(count)
+NB_ITER = '10000000'
+
+cmd = ['./mem_model', '-t', 'sb', '-n', NB_ITER]
+out = subprocess.run(cmd, stdout=subprocess.PIPE, universal_newlines=True, check=True).stdout
+for line in out.splitlines():
+    if 'relaxed' in line:
+        print('store buffering: ' + line.split()[2] + ' out of ' + NB_ITER + ' iterations')
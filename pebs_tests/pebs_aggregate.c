@@ -0,0 +1,193 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "pebs_aggregate.h"
+
+#define EMPTY_KEY UINT64_MAX
+#define INITIAL_CAPACITY 4096
+
+const char *data_source_names[nb_sources] = {
+  "L1", "LFB", "L2", "L3", "Local RAM", "Remote RAM", "Remote Cache", "Other"
+};
+
+enum data_source data_source_of(union perf_mem_data_src data_src) {
+  if (data_src.mem_lvl & PERF_MEM_LVL_HIT) {
+    if (data_src.mem_lvl & PERF_MEM_LVL_L1) {
+      return source_l1;
+    } else if (data_src.mem_lvl & PERF_MEM_LVL_LFB) {
+      return source_lfb;
+    } else if (data_src.mem_lvl & PERF_MEM_LVL_L2) {
+      return source_l2;
+    } else if (data_src.mem_lvl & PERF_MEM_LVL_L3) {
+      return source_l3;
+    } else if (data_src.mem_lvl & (PERF_MEM_LVL_LOC_RAM | PERF_MEM_LVL_UNC)) {
+      return source_local_dram;
+    } else if (data_src.mem_lvl & (PERF_MEM_LVL_REM_RAM1 | PERF_MEM_LVL_REM_RAM2)) {
+      return source_remote_dram;
+    } else if (data_src.mem_lvl & (PERF_MEM_LVL_REM_CCE1 | PERF_MEM_LVL_REM_CCE2)) {
+      return source_remote_cache;
+    }
+  } else if ((data_src.mem_lvl & PERF_MEM_LVL_MISS) && (data_src.mem_lvl & PERF_MEM_LVL_L3)) {
+    // Nehalem reports local DRAM accesses as L3 misses
+    return source_local_dram;
+  }
+  return source_other;
+}
+
+static inline uint64_t hash(uint64_t key, uint64_t capacity) {
+  return (key * 0x9E3779B97F4A7C15ULL) & (capacity - 1);
+}
+
+static void address_map_init(struct address_map *map, uint64_t capacity) {
+  map->entries = malloc(capacity * sizeof(struct address_stats));
+  assert(map->entries);
+  for (uint64_t i = 0; i < capacity; i++) {
+    map->entries[i].key = EMPTY_KEY;
+  }
+  map->capacity = capacity;
+  map->nb_entries = 0;
+}
+
+/**
+ * Returns the entry of key, inserted if needed.
+ */
+static struct address_stats *address_map_get(struct address_map *map, uint64_t key) {
+  uint64_t i = hash(key, map->capacity);
+  while (map->entries[i].key != key && map->entries[i].key != EMPTY_KEY) {
+    i = (i + 1) & (map->capacity - 1);
+  }
+  struct address_stats *entry = &map->entries[i];
+  if (entry->key == EMPTY_KEY) {
+    entry->key = key;
+    entry->nb_samples = 0;
+    entry->latency = 0;
+    map->nb_entries++;
+  }
+  return entry;
+}
+
+static void address_map_grow(struct address_map *map) {
+  struct address_map old = *map;
+  address_map_init(map, 2 * old.capacity);
+  for (uint64_t i = 0; i < old.capacity; i++) {
+    if (old.entries[i].key != EMPTY_KEY) {
+      *address_map_get(map, old.entries[i].key) = old.entries[i];
+    }
+  }
+  free(old.entries);
+}
+
+static void address_map_add(struct address_map *map, uint64_t key, uint64_t latency) {
+  if (2 * (map->nb_entries + 1) > map->capacity) {
+    address_map_grow(map);
+  }
+  struct address_stats *entry = address_map_get(map, key);
+  entry->nb_samples++;
+  entry->latency += latency;
+}
+
+static int latency_bucket(uint64_t latency) {
+  if (latency == 0) {
+    return 0;
+  }
+  int bucket = 64 - __builtin_clzll(latency);
+  return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+}
+
+uint64_t latency_bucket_low(int bucket) {
+  return bucket == 0 ? 0 : 1ULL << (bucket - 1);
+}
+
+void aggregate_init(struct sample_aggregate *aggregate, uint64_t start_addr, uint64_t end_addr, int track_lines) {
+  memset(aggregate, 0, sizeof(struct sample_aggregate));
+  aggregate->start_addr = start_addr;
+  aggregate->end_addr = end_addr;
+  aggregate->track_lines = track_lines;
+  address_map_init(&aggregate->pages, INITIAL_CAPACITY);
+  if (track_lines) {
+    address_map_init(&aggregate->lines, INITIAL_CAPACITY);
+  }
+}
+
+void aggregate_add(struct sample_aggregate *aggregate, const struct sample *sample) {
+  aggregate->nb_samples++;
+  aggregate->latency += sample->weight;
+  if (sample->addr >= aggregate->start_addr && sample->addr < aggregate->end_addr) {
+    uint64_t offset = sample->addr - aggregate->start_addr;
+    aggregate->heatmap[offset * HEATMAP_BINS / (aggregate->end_addr - aggregate->start_addr)]++;
+  } else {
+    aggregate->nb_out_of_range++;
+  }
+  address_map_add(&aggregate->pages, sample->addr >> PAGE_SHIFT, sample->weight);
+  if (aggregate->track_lines) {
+    address_map_add(&aggregate->lines, sample->addr >> LINE_SHIFT, sample->weight);
+  }
+  struct source_stats *source = &aggregate->sources[data_source_of(sample->data_src)];
+  source->nb_samples++;
+  source->latency += sample->weight;
+  source->histogram[latency_bucket(sample->weight)]++;
+}
+
+void aggregate_free(struct sample_aggregate *aggregate) {
+  free(aggregate->pages.entries);
+  free(aggregate->lines.entries);
+}
+
+static void swap(struct address_stats *a, struct address_stats *b) {
+  struct address_stats tmp = *a;
+  *a = *b;
+  *b = tmp;
+}
+
+/**
+ * Restores the min-heap property of heap below i.
+ */
+static void sift_down(struct address_stats *heap, int size, int i) {
+  for (;;) {
+    int smallest = i;
+    int left = 2 * i + 1;
+    int right = 2 * i + 2;
+    if (left < size && heap[left].nb_samples < heap[smallest].nb_samples) {
+      smallest = left;
+    }
+    if (right < size && heap[right].nb_samples < heap[smallest].nb_samples) {
+      smallest = right;
+    }
+    if (smallest == i) {
+      return;
+    }
+    swap(&heap[i], &heap[smallest]);
+    i = smallest;
+  }
+}
+
+int address_map_top(const struct address_map *map, struct address_stats *top, int k) {
+  int size = 0;
+  for (uint64_t i = 0; i < map->capacity && k > 0; i++) {
+    const struct address_stats *entry = &map->entries[i];
+    if (entry->key == EMPTY_KEY) {
+      continue;
+    }
+    if (size < k) {
+      int j = size++;
+      top[j] = *entry;
+      while (j > 0 && top[j].nb_samples < top[(j - 1) / 2].nb_samples) {
+	swap(&top[j], &top[(j - 1) / 2]);
+	j = (j - 1) / 2;
+      }
+    } else if (entry->nb_samples > top[0].nb_samples) {
+      top[0] = *entry;
+      sift_down(top, size, 0);
+    }
+  }
+
+  /**
+   * Heap sort of the k entries, the smallest going to the end.
+   */
+  for (int n = size; n > 1; n--) {
+    swap(&top[0], &top[n - 1]);
+    sift_down(top, n - 1, 0);
+  }
+  return size;
+}
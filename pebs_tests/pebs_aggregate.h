@@ -0,0 +1,97 @@
+#ifndef PEBS_AGGREGATE_H
+#define PEBS_AGGREGATE_H
+
+#include "pebs_bench.h"
+
+#define PAGE_SHIFT 12
+#define LINE_SHIFT 6
+#define HEATMAP_BINS 32
+#define LATENCY_BUCKETS 32
+
+/**
+ * Where the data of a sampled load came from, as decoded from its
+ * data_src.
+ */
+enum data_source {
+  source_l1,
+  source_lfb,
+  source_l2,
+  source_l3,
+  source_local_dram,
+  source_remote_dram,
+  source_remote_cache,
+  source_other,
+  nb_sources
+};
+
+extern const char *data_source_names[nb_sources];
+
+enum data_source data_source_of(union perf_mem_data_src data_src);
+
+/**
+ * Number of samples and sum of their latencies for a page or a line.
+ */
+struct address_stats {
+  uint64_t key;
+  uint64_t nb_samples;
+  uint64_t latency;
+};
+
+/**
+ * Open addressing hash map from page or line numbers to their stats,
+ * grown when half full.
+ */
+struct address_map {
+  struct address_stats *entries;
+  uint64_t capacity;
+  uint64_t nb_entries;
+};
+
+/**
+ * Latency histogram of a data source, bucket b counting the latencies in
+ * [2^(b-1), 2^b[, bucket 0 those of 0.
+ */
+struct source_stats {
+  uint64_t nb_samples;
+  uint64_t latency;
+  uint64_t histogram[LATENCY_BUCKETS];
+};
+
+/**
+ * Aggregates of a stream of samples, each one being added in constant
+ * time so that they are never stored nor sorted: samples per page and
+ * per line (if track_lines, lines being by far the largest map), per bin
+ * of the range [start_addr, end_addr[ (heatmap) and per data source.
+ */
+struct sample_aggregate {
+  uint64_t start_addr;
+  uint64_t end_addr;
+  uint64_t nb_samples;
+  uint64_t nb_out_of_range;
+  uint64_t latency;
+  uint64_t heatmap[HEATMAP_BINS];
+  int track_lines;
+  struct address_map pages;
+  struct address_map lines;
+  struct source_stats sources[nb_sources];
+};
+
+void aggregate_init(struct sample_aggregate *aggregate, uint64_t start_addr, uint64_t end_addr, int track_lines);
+
+void aggregate_add(struct sample_aggregate *aggregate, const struct sample *sample);
+
+void aggregate_free(struct sample_aggregate *aggregate);
+
+/**
+ * Fills top with the at most k entries of map with the most samples, in
+ * decreasing order, using a heap of k entries rather than sorting the
+ * map. Returns the number of entries filled.
+ */
+int address_map_top(const struct address_map *map, struct address_stats *top, int k);
+
+/**
+ * Returns the lowest latency of bucket.
+ */
+uint64_t latency_bucket_low(int bucket);
+
+#endif
@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "pebs_bench_ui.h"
+#include "pebs_file.h"
+
+#define DEFAULT_TOP_K 10
+
+void usage(const char *prog_name) {
+  printf("Usage: %s [-k <top_k>] [-l] [-p] <sample_file>\n"
+	 "\t -k: the number of hottest pages and lines printed (default is %d)\n"
+	 "\t -l: counts the samples per line too, which is several times slower\n"
+	 "\t -p: prints each sample too\n"
+	 "\tanalyzes the samples written by pebs_bench or pebs_profile to sample_file\n",
+	 prog_name, DEFAULT_TOP_K);
+}
+
+int main(int argc, char **argv) {
+  int top_k = DEFAULT_TOP_K;
+  int print = 0;
+  int track_lines = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "k:lp")) != -1) {
+    switch (opt) {
+    case 'k':
+      top_k = atoi(optarg);
+      break;
+    case 'l':
+      track_lines = 1;
+      break;
+    case 'p':
+      print = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return -1;
+    }
+  }
+  if (optind != argc - 1 || top_k <= 0) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  struct sample_file file;
+  if (sample_file_open(&file, argv[optind])) {
+    return -1;
+  }
+  const struct sample_file_header *header = file.header;
+  printf("%-80s = %15" PRIx64 "-%" PRIx64 "\n", "sampled memory", header->start_addr, header->end_addr);
+  printf("%-80s = %15" PRIu64 "\n", "sampling period", header->period);
+  printf("%-80s = %15" PRIu64 "\n", "samples lost by the kernel", header->nb_lost);
+
+  /**
+   * A single pass over the mapped records, nothing being allocated per
+   * sample.
+   */
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  struct sample_aggregate aggregate;
+  aggregate_init(&aggregate, header->start_addr, header->end_addr, track_lines);
+  for (uint64_t i = 0; i < header->nb_samples; i++) {
+    aggregate_add(&aggregate, &file.samples[i]);
+    if (print) {
+      print_sample(&file.samples[i], header->start_addr, header->end_addr);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1E9;
+  fprintf(stderr, "%" PRIu64 " samples analyzed in %.3f s (%.1f MB/s)\n", header->nb_samples, seconds,
+	  header->nb_samples * header->record_size / seconds / 1E6);
+
+  int nb_samples_estimated = header->period == 0 || header->end_addr == header->start_addr ? -1 :
+    (header->end_addr - header->start_addr) / sizeof(uint64_t) / header->period;
+  print_aggregate(&aggregate, nb_samples_estimated, top_k);
+  aggregate_free(&aggregate);
+  sample_file_unmap(&file);
+  return 0;
+}
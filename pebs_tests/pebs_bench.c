@@ -16,23 +16,48 @@
 #include "mem_alloc.h"
 #include "pebs_bench.h"
 #include "pebs_bench_ui.h"
+#include "pebs_ring.h"
+#include "pebs_events.h"
+#include "pebs_file.h"
 
 #define CPU 2
 #define NUMA_NODE 0
 #define NUMA_ALLOC 1 /* Set to one to use numa_alloc */
+#define RING_BUFFER_PAGES 64 /* Must be a power of two */
 
-/* Used to control what we count */
-// #define CORE_COUNT_INST
-// #define CORE_COUNT_LOADS
-/* #define CORE_MEM_UNCORE_RETIRED_LOCAL_DRAM_AND_REMOTE_CACHE_HIT*/
-// #define CORE_OFFCORE_COUNT_REMOTE_CACHE
-// #define CORE_OFFCORE_COUNT_LOCAL_DRAM
-// #define CORE_OFFCORE_COUNT_REMOTE_DRAM
-#define CORE_PEBS_SAMPLING
-// #define UNCORE_COUNT_READS
+#define DEFAULT_EVENTS "page-faults"
+#define TOP_K 10 /* Number of hottest pages and lines printed */
 
 #define ELEM_TYPE uint64_t
 
+/**
+ * Samples handed over by the ring buffer consumer are aggregated on the
+ * fly, written to the sample file if any, and printed one by one too if
+ * PRINT_SAMPLES is defined.
+ */
+// #define PRINT_SAMPLES
+
+/**
+ * The cpus the process could run on before being pinned on CPU.
+ */
+static cpu_set_t initial_cpus;
+
+struct sample_sink {
+  struct sample_aggregate aggregate;
+  struct sample_file_writer *writer;
+};
+
+static void add_sample(const struct sample *sample, void *arg) {
+  struct sample_sink *sink = arg;
+  aggregate_add(&sink->aggregate, sample);
+  if (sink->writer != NULL) {
+    sample_file_write(sink->writer, sample);
+  }
+#ifdef PRINT_SAMPLES
+  print_sample(sample, sink->aggregate.start_addr, sink->aggregate.end_addr);
+#endif
+}
+
 static long perf_event_open(struct perf_event_attr *hw_event,
 			    pid_t pid,
 			    int cpu,
@@ -73,9 +98,24 @@ void read_memory(uint64_t *memory, size_t size) {
   }
 }
 
+/**
+ * Returns the first cpu of the given NUMA node.
+ */
+static int first_cpu_of_node(int node) {
+  for (int cpu = 0; cpu < numa_num_configured_cpus(); cpu++) {
+    if (numa_node_of_cpu(cpu) == node) {
+      return cpu;
+    }
+  }
+  return 0;
+}
+
 int run_benchs(size_t size_in_bytes,
 	       enum access_mode_t access_mode,
-	       uint64_t period) {
+	       const struct fill_params *fill_params,
+	       uint64_t period,
+	       struct event_set *events,
+	       const char *sample_file) {
 
   /**
    * Allocates and fills memory. Because the memory is filled, all its
@@ -92,7 +132,19 @@ int run_benchs(size_t size_in_bytes,
   assert(memory);
   //memory = mmap(NULL, size_in_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, 0, 0);
   memset(memory, -1, size_in_bytes);
-  fill_memory(memory, size_in_bytes, access_mode);
+
+  /**
+   * The threads filling memory inherit the affinity of this one, so it
+   * is unpinned while they run, not to confine them to CPU.
+   */
+  cpu_set_t pinned_cpus;
+  sched_getaffinity(0, sizeof(pinned_cpus), &pinned_cpus);
+  sched_setaffinity(0, sizeof(initial_cpus), &initial_cpus);
+  fill_memory_params(memory, size_in_bytes, access_mode, 0, fill_params);
+  if (sched_setaffinity(0, sizeof(pinned_cpus), &pinned_cpus) == -1) {
+    printf("sched_setaffinity failed: %s\n", strerror(errno));
+    return -1;
+  }
 
   // Check where is located the memory
   void *to_chk = memory;
@@ -115,312 +167,113 @@ int run_benchs(size_t size_in_bytes,
   fprintf(stderr, "Running test with memory on node %d (%s)\n", NUMA_NODE, (numa_node_of_cpu(CPU) == NUMA_NODE ? "local" : "remote"));
 
   /**
-   * Profile memory and other things
+   * Counted events, the uncore ones on a cpu of the memory node
    */
-  struct perf_event_attr pe_attr_page_faults;
-  memset(&pe_attr_page_faults, 0, sizeof(pe_attr_page_faults));
-  pe_attr_page_faults.size = sizeof(pe_attr_page_faults);
-  pe_attr_page_faults.type =   PERF_TYPE_SOFTWARE;
-  pe_attr_page_faults.config = PERF_COUNT_SW_PAGE_FAULTS;
-  pe_attr_page_faults.disabled = 1;
-  pe_attr_page_faults.exclude_kernel = 1;
-  int page_faults_fd = perf_event_open(&pe_attr_page_faults, 0, CPU, -1, 0);
-  if (page_faults_fd == -1) {
-    printf("perf_event_open failed for page faults: %s\n", strerror(errno));
-    return -1;
-  }
-
-#ifdef UNCORE_COUNT_READS
-  struct perf_event_attr pe_attr_unc_memory;
-  memset(&pe_attr_unc_memory, 0, sizeof(pe_attr_unc_memory));
-  pe_attr_unc_memory.size = sizeof(pe_attr_unc_memory);
-  pe_attr_unc_memory.type = 6; // /sys/bus/event_source/devices/uncore/type
-  pe_attr_unc_memory.config = 0x072c; // QMC_NORMAL_READS.ANY
-  pe_attr_unc_memory.disabled = 1;
-  int memory_reads_fd = perf_event_open(&pe_attr_unc_memory, -1, NUMA_NODE, -1, 0);
-  if (memory_reads_fd == -1) {
-    printf("perf_event_open failed for uncore memory: %s\n", strerror(errno));
+  if (event_set_open(events, CPU, first_cpu_of_node(NUMA_NODE))) {
     return -1;
   }
-#endif
-
-#ifdef CORE_MEM_UNCORE_RETIRED_LOCAL_DRAM_AND_REMOTE_CACHE_HIT
-  struct perf_event_attr pe_attr_mem_uncore_loc_rem;
-  memset(&pe_attr_mem_uncore_loc_rem, 0, sizeof(pe_attr_mem_uncore_loc_rem));
-  pe_attr_mem_uncore_loc_rem.size = sizeof(pe_attr_mem_uncore_loc_rem);
-  pe_attr_mem_uncore_loc_rem.type = PERF_TYPE_RAW;
-  pe_attr_mem_uncore_loc_rem.config = 0x53080f; // MEM_UNCORE_RETIRED.LOCAL_DRAM_AND_REMOTE_CACHE_HIT
-  pe_attr_mem_uncore_loc_rem.disabled = 1;
-  pe_attr_mem_uncore_loc_rem.exclude_kernel = 1;
-  pe_attr_mem_uncore_loc_rem.exclude_hv = 1;
-  int mem_uncore_loc_rem_fd = perf_event_open(&pe_attr_mem_uncore_loc_rem, 0, CPU, -1, 0);
-  if (mem_uncore_loc_rem_fd == -1) {
-    printf("perf_event_open failed for core MEM_UNCORE_LOC_REM_FD: %s\n", strerror(errno));
-    return -1;
-  }
-#endif
-
-#ifdef CORE_COUNT_LOADS
-  struct perf_event_attr pe_attr_loads;
-  memset(&pe_attr_loads, 0, sizeof(pe_attr_loads));
-  pe_attr_loads.size = sizeof(pe_attr_loads);
-  pe_attr_loads.type = PERF_TYPE_RAW;
-  pe_attr_loads.config = 0x010b; // MEM_INST_RETIRED.LOADS
-  pe_attr_loads.disabled = 1;
-  pe_attr_loads.exclude_kernel = 1;
-  pe_attr_loads.exclude_hv = 1;
-  int loads_fd = perf_event_open(&pe_attr_loads, 0, CPU, -1, 0);
-  if (loads_fd == -1) {
-    printf("perf_event_open failed for core loads: %s\n", strerror(errno));
-    return -1;
-  }
-#endif
-
-#ifdef CORE_COUNT_INST
-  struct perf_event_attr pe_attr_inst;
-  memset(&pe_attr_inst, 0, sizeof(pe_attr_inst));
-  pe_attr_inst.size = sizeof(pe_attr_inst);
-  pe_attr_inst.type = PERF_TYPE_RAW;
-  pe_attr_inst.config = 0x00c0; // INST_RETIRED.ANY
-  pe_attr_inst.disabled = 1;
-  pe_attr_inst.exclude_kernel = 1;
-  pe_attr_inst.exclude_hv = 1;
-  int inst_fd = perf_event_open(&pe_attr_inst, 0, CPU, -1, 0);
-  if (inst_fd == -1) {
-    printf("perf_event_open failed for instructions: %s\n", strerror(errno));
-    return -1;
-  }
-#endif
-
-#ifdef CORE_OFFCORE_COUNT_REMOTE_CACHE
-  struct perf_event_attr pe_attr_remote_cache;
-  memset(&pe_attr_remote_cache, 0, sizeof(pe_attr_remote_cache));
-  pe_attr_remote_cache.size = sizeof(pe_attr_remote_cache);
-  pe_attr_remote_cache.type = PERF_TYPE_RAW;
-  pe_attr_remote_cache.config = 0x5301b7; // OFF_CORE_RESPONSE_0
-  pe_attr_remote_cache.config1 = 0x1011; // REMOTE_CACHE_FWD
-  pe_attr_remote_cache.disabled = 1;
-  pe_attr_remote_cache.exclude_kernel = 1;
-  pe_attr_remote_cache.exclude_hv = 1;
-  int remote_cache_fd = perf_event_open(&pe_attr_remote_cache, 0, CPU, -1, 0);
-  if (remote_cache_fd == -1) {
-    printf("perf_event_open failed for remote cache: %s\n", strerror(errno));
-    return -1;
-  }
-#endif
-
-#ifdef CORE_OFFCORE_COUNT_LOCAL_DRAM
-  struct perf_event_attr pe_attr_local_ram;
-  memset(&pe_attr_local_ram, 0, sizeof(pe_attr_local_ram));
-  pe_attr_local_ram.size = sizeof(pe_attr_local_ram);
-  pe_attr_local_ram.type = PERF_TYPE_RAW;
-  pe_attr_local_ram.config = 0x5301bb; // OFF_CORE_RESPONSE_1
-  pe_attr_local_ram.config1 = 0x4033; // LOCAL_DRAM
-  pe_attr_local_ram.disabled = 1;
-  pe_attr_local_ram.exclude_kernel = 1;
-  pe_attr_local_ram.exclude_hv = 1;
-  int local_ram_fd = perf_event_open(&pe_attr_local_ram, 0, CPU, -1, 0);
-  if (local_ram_fd == -1) {
-    printf("perf_event_open failed for local dram: %s\n", strerror(errno));
-    return -1;
-  }
-#endif
-
-#ifdef CORE_OFFCORE_COUNT_REMOTE_DRAM
-  struct perf_event_attr pe_attr_remote_ram;
-  memset(&pe_attr_remote_ram, 0, sizeof(pe_attr_remote_ram));
-  pe_attr_remote_ram.size = sizeof(pe_attr_remote_ram);
-  pe_attr_remote_ram.type = PERF_TYPE_RAW;
-  pe_attr_remote_ram.config = 0x5301bb; // OFF_CORE_RESPONSE_1
-  pe_attr_remote_ram.config1 = 0x2033; // REMOTE_DRAM
-  pe_attr_remote_ram.disabled = 1;
-  pe_attr_remote_ram.exclude_kernel = 1;
-  pe_attr_remote_ram.exclude_hv = 1;
-  int remote_ram_fd = perf_event_open(&pe_attr_remote_ram, 0, CPU, -1, 0);
-  if (remote_ram_fd == -1) {
-    printf("perf_event_open failed for remote dram: %s\n", strerror(errno));
-    return -1;
-  }
-#endif
 
-#ifdef CORE_PEBS_SAMPLING
-  struct perf_event_attr pe_attr_sampling;
-  memset(&pe_attr_sampling, 0, sizeof(pe_attr_sampling));
-  pe_attr_sampling.size = sizeof(pe_attr_sampling);
-  pe_attr_sampling.type = PERF_TYPE_RAW;
-  pe_attr_sampling.config = 0x100b; // MEM_INST_RETIRED.LATENCY_ABOVE_THRESHOLD
-
-  pe_attr_sampling.config1 = 3; // latency threshold
-  pe_attr_sampling.sample_period = period;
-  pe_attr_sampling.precise_ip = 2;
-
-  pe_attr_sampling.sample_type = PERF_SAMPLE_IP | PERF_SAMPLE_ADDR | PERF_SAMPLE_WEIGHT | PERF_SAMPLE_DATA_SRC;
-
-  pe_attr_sampling.read_format = 0;
-  pe_attr_sampling.disabled = 1;
-  pe_attr_sampling.pinned = 1;
-  pe_attr_sampling.exclude_kernel = 1;
-  pe_attr_sampling.exclude_hv = 1;
-  pe_attr_sampling.wakeup_events = 1;
-
-  int memory_sampling_fd = perf_event_open(&pe_attr_sampling, 0, -1, -1, 0);
-  if (memory_sampling_fd == -1) {
-    printf("perf_event_open failed for sampling: %s\n", strerror(errno));
-    return -1;
-  }
-  long page_size = sysconf(_SC_PAGESIZE);
-  int nb_pages = 8;
-  size_t mmap_len = (1 + nb_pages) * page_size;
-  struct perf_event_mmap_page *metadata_page = mmap(NULL, mmap_len, PROT_WRITE, MAP_SHARED, memory_sampling_fd, 0);
-  if (metadata_page == MAP_FAILED) {
-    fprintf (stderr, "Couldn't mmap file descriptor: %s - errno = %d\n",
-  	     strerror (errno), errno);
-    return -1;
+  /**
+   * Memory sampling, unless the period is 0
+   */
+  int memory_sampling_fd = -1;
+  struct sample_sink sink = {.writer = NULL};
+  struct sample_file_writer writer;
+  aggregate_init(&sink.aggregate, (uint64_t)memory, (uint64_t)memory + size_in_bytes, 1);
+  struct pebs_ring ring;
+  if (period > 0) {
+    struct perf_event_attr pe_attr_sampling;
+    memset(&pe_attr_sampling, 0, sizeof(pe_attr_sampling));
+    pe_attr_sampling.size = sizeof(pe_attr_sampling);
+    pe_attr_sampling.type = PERF_TYPE_RAW;
+    pe_attr_sampling.config = 0x100b; // MEM_INST_RETIRED.LATENCY_ABOVE_THRESHOLD
+
+    pe_attr_sampling.config1 = 3; // latency threshold
+    pe_attr_sampling.sample_period = period;
+    pe_attr_sampling.precise_ip = 2;
+
+    pe_attr_sampling.sample_type = PERF_SAMPLE_IP | PERF_SAMPLE_ADDR | PERF_SAMPLE_WEIGHT | PERF_SAMPLE_DATA_SRC;
+
+    pe_attr_sampling.read_format = 0;
+    pe_attr_sampling.disabled = 1;
+    pe_attr_sampling.pinned = 1;
+    pe_attr_sampling.exclude_kernel = 1;
+    pe_attr_sampling.exclude_hv = 1;
+
+    // Wakes the consumer up each time a quarter of the ring buffer is filled
+    pe_attr_sampling.watermark = 1;
+    pe_attr_sampling.wakeup_watermark = RING_BUFFER_PAGES * sysconf(_SC_PAGESIZE) / 4;
+
+    if (sample_file != NULL) {
+      if (sample_file_create(&writer, sample_file, (uint64_t)memory, (uint64_t)memory + size_in_bytes, period)) {
+	return -1;
+      }
+      sink.writer = &writer;
+    }
+
+    memory_sampling_fd = perf_event_open(&pe_attr_sampling, 0, -1, -1, 0);
+    if (memory_sampling_fd == -1) {
+      printf("perf_event_open failed for sampling: %s\n", strerror(errno));
+      return -1;
+    }
+
+    // The consumer runs on any cpu the process was allowed on but the measured one
+    cpu_set_t consumer_cpus = initial_cpus;
+    CPU_CLR(CPU, &consumer_cpus);
+    if (pebs_ring_start(&ring, memory_sampling_fd, RING_BUFFER_PAGES,
+			CPU_COUNT(&consumer_cpus) > 0 ? &consumer_cpus : NULL, add_sample, &sink)) {
+      return -1;
+    }
   }
-#endif
 
   // Starts measuring
   struct timeval t1, t2;
   double elapsedTime;
   gettimeofday(&t1, NULL);
-#ifdef CORE_MEM_UNCORE_RETIRED_LOCAL_DRAM_AND_REMOTE_CACHE_HIT
-  ioctl(mem_uncore_loc_rem_fd, PERF_EVENT_IOC_RESET, 0);
-  ioctl(mem_uncore_loc_rem_fd, PERF_EVENT_IOC_ENABLE, 0);
-#endif
-#ifdef UNCORE_COUNT_READS
-  ioctl(memory_reads_fd, PERF_EVENT_IOC_RESET, 0);
-  ioctl(memory_reads_fd, PERF_EVENT_IOC_ENABLE, 0);
-#endif
-#ifdef CORE_COUNT_LOADS
-  ioctl(loads_fd, PERF_EVENT_IOC_RESET, 0);
-  ioctl(loads_fd, PERF_EVENT_IOC_ENABLE, 0);
-#endif
-#ifdef CORE_COUNT_INST
-  ioctl(inst_fd, PERF_EVENT_IOC_RESET, 0);
-  ioctl(inst_fd, PERF_EVENT_IOC_ENABLE, 0);
-#endif
-  ioctl(page_faults_fd, PERF_EVENT_IOC_RESET, 0);
-  ioctl(page_faults_fd, PERF_EVENT_IOC_ENABLE, 0);
-#ifdef CORE_PEBS_SAMPLING
-  ioctl(memory_sampling_fd, PERF_EVENT_IOC_RESET, 0);
-  ioctl(memory_sampling_fd, PERF_EVENT_IOC_ENABLE, 0);
-#endif
-#ifdef CORE_OFFCORE_COUNT_REMOTE_CACHE
-  ioctl(remote_cache_fd, PERF_EVENT_IOC_RESET, 0);
-  ioctl(remote_cache_fd, PERF_EVENT_IOC_ENABLE, 0);
-#endif
-#ifdef CORE_OFFCORE_COUNT_LOCAL_DRAM
-  ioctl(local_ram_fd, PERF_EVENT_IOC_RESET, 0);
-  ioctl(local_ram_fd, PERF_EVENT_IOC_ENABLE, 0);
-#endif
-#ifdef CORE_OFFCORE_COUNT_REMOTE_DRAM
-  ioctl(remote_ram_fd, PERF_EVENT_IOC_RESET, 0);
-  ioctl(remote_ram_fd, PERF_EVENT_IOC_ENABLE, 0);
-#endif
+  event_set_start(events);
+  if (period > 0) {
+    ioctl(memory_sampling_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(memory_sampling_fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
 
   // Access memory
   read_memory(memory, size_in_bytes);
 
   // Stop measuring
-#ifdef CORE_OFFCORE_COUNT_REMOTE_DRAM
-  ioctl(remote_ram_fd, PERF_EVENT_IOC_DISABLE, 0);
-#endif
-#ifdef CORE_MEM_UNCORE_RETIRED_LOCAL_DRAM_AND_REMOTE_CACHE_HIT
-  ioctl(mem_uncore_loc_rem_fd, PERF_EVENT_IOC_DISABLE, 0);
-#endif
-#ifdef UNCORE_COUNT_READS
-  ioctl(memory_reads_fd, PERF_EVENT_IOC_DISABLE, 0);
-#endif
-#ifdef CORE_COUNT_LOADS
-  ioctl(loads_fd, PERF_EVENT_IOC_DISABLE, 0);
-#endif
-#ifdef CORE_COUNT_INST
-  ioctl(inst_fd, PERF_EVENT_IOC_DISABLE, 0);
-#endif
-  ioctl(page_faults_fd, PERF_EVENT_IOC_DISABLE, 0);
-#ifdef CORE_PEBS_SAMPLING
-  ioctl(memory_sampling_fd, PERF_EVENT_IOC_DISABLE, 0);
-#endif
-#ifdef CORE_OFFCORE_COUNT_REMOTE_CACHE
-  ioctl(remote_cache_fd, PERF_EVENT_IOC_DISABLE, 0);
-#endif
-#ifdef CORE_OFFCORE_COUNT_LOCAL_DRAM
-  ioctl(local_ram_fd, PERF_EVENT_IOC_DISABLE, 0);
-#endif
+  if (period > 0) {
+    ioctl(memory_sampling_fd, PERF_EVENT_IOC_DISABLE, 0);
+  }
+  event_set_stop(events);
   gettimeofday(&t2, NULL);
   elapsedTime = (t2.tv_sec - t1.tv_sec) * 1000.0;
   elapsedTime += (t2.tv_usec - t1.tv_usec) / 1000.0;
 
   // Print results
-#ifdef CORE_MEM_UNCORE_RETIRED_LOCAL_DRAM_AND_REMOTE_CACHE_HIT
-  uint64_t mem_uncore_loc_rem_count;
-  read(mem_uncore_loc_rem_fd, &mem_uncore_loc_rem_count, sizeof(mem_uncore_loc_rem_count));
-#endif
-#ifdef CORE_OFFCORE_COUNT_REMOTE_DRAM
-  uint64_t remote_ram_count;
-  read(remote_ram_fd, &remote_ram_count, sizeof(remote_ram_count));
-#endif
-#ifdef CORE_OFFCORE_COUNT_LOCAL_DRAM
-  uint64_t local_ram_count;
-  read(local_ram_fd, &local_ram_count, sizeof(local_ram_count));
-#endif
-#ifdef CORE_OFFCORE_COUNT_REMOTE_CACHE
-  uint64_t remote_cache_count;
-  read(remote_cache_fd, &remote_cache_count, sizeof(remote_cache_count));
-#endif
-#ifdef UNCORE_COUNT_READS
-  uint64_t memory_reads_count;
-  read(memory_reads_fd, &memory_reads_count, sizeof(memory_reads_count));
-#endif
-#ifdef CORE_COUNT_LOADS
-  uint64_t loads_count;
-  read(loads_fd, &loads_count, sizeof(loads_count));
-#endif
-#ifdef CORE_COUNT_INST
-  uint64_t insts_count;
-  read(inst_fd, &insts_count, sizeof(insts_count));
-#endif
-  uint64_t page_faults_count;
-  read(page_faults_fd, &page_faults_count, sizeof(page_faults_count));
-  printf("\n");
-  printf("%-80s = %15.3f \n",       "time (milliseconds)", elapsedTime);
-  printf("%-80s = %15" PRIu64 "\n", "Page faults count (software event)", page_faults_count);
-#ifdef CORE_COUNT_INST
-  printf("%-80s = %15" PRId64 "\n", "instructions count (core event: INST_RETIRED.ANY)", insts_count);
-#endif
-#ifdef CORE_COUNT_LOADS
+  uint64_t counts[MAX_EVENTS];
+  if (event_set_read(events, counts)) {
+    fprintf(stderr, "Cannot read the counted events\n");
+    return -1;
+  }
+  event_set_close(events);
   int nb_elems = size_in_bytes / sizeof(ELEM_TYPE);
-  printf("%-80s = %15" PRId64 " (expected = %d)\n", "loads count (core event: MEM_INST_RETIRED.LOADS)", loads_count, nb_elems);
-#endif
-#ifdef UNCORE_COUNT_READS
-  if (access_mode == access_seq) {
-    printf("%-80s = %15" PRId64 " (expected = %" PRId64 " considering each cache line is loaded once only)\n", "64 bytes cache line reads from RAM count (uncore event: QMC_NORMAL_READS.ANY)", memory_reads_count, (size_in_bytes / 64));
-  } else {
-    printf("%-80s = %15" PRId64 "\n", "64 bytes cache line reads from RAM count (uncore event: QMC_NORMAL_READS.ANY)", memory_reads_count);
+  printf("\n");
+  printf("%-80s = %15.3f \n", "time (milliseconds)", elapsedTime);
+  printf("%-80s = %15d\n", "loads done by the benchmark", nb_elems);
+  for (int e = 0; e < events->nb_events; e++) {
+    printf("%-80s = %15" PRIu64 "\n", events->events[e].name, counts[e]);
   }
-#endif
-#ifdef CORE_MEM_UNCORE_RETIRED_LOCAL_DRAM_AND_REMOTE_CACHE_HIT
-  printf("%-80s = %15" PRId64 "\n", "local ram & remote cache count (core event: MEM_UNCORE_RETIRED:L_DRAM_REM_CACHE)", mem_uncore_loc_rem_count);
-#endif
-#ifdef CORE_OFFCORE_COUNT_REMOTE_CACHE
-  printf("%-80s = %15" PRId64 "\n", "remote cache count (core event: OFF_CORE_RESPONSE_0:REMOTE_CACHE_FWD)", remote_cache_count);
-#endif
-#ifdef CORE_OFFCORE_COUNT_LOCAL_DRAM
-  printf("%-80s = %15" PRId64 "\n", "local memory count (core event: OFF_CORE_RESPONSE_1:LOCAL_DRAM)", local_ram_count);
-#endif
-#ifdef CORE_OFFCORE_COUNT_REMOTE_DRAM
-  printf("%-80s = %15" PRId64 "\n", "remote memory count (core event: OFF_CORE_RESPONSE_1:REMOTE_DRAM)", remote_ram_count);
-#endif
 
-#ifdef CORE_PEBS_SAMPLING
-  if (metadata_page->data_head > mmap_len) {
-    printf("more samples than space in mmap allocated ring buffer\n");
-    return -1;
+  if (period > 0) {
+    pebs_ring_stop(&ring);
+    printf("%-80s = %15" PRIu64 " (%" PRIu64 " wake ups)\n", "samples lost by the kernel", ring.nb_lost, ring.nb_wakeups);
+    if (sink.writer != NULL && sample_file_close(sink.writer, ring.nb_lost)) {
+      return -1;
+    }
+    print_aggregate(&sink.aggregate, nb_elems / period, TOP_K);
+    close(memory_sampling_fd);
   }
-  int nb_elems2 = size_in_bytes / sizeof(ELEM_TYPE);
-  print_samples(metadata_page, ADDR, (uint64_t)memory, (uint64_t)memory + size_in_bytes, nb_elems2 / period);
-#endif
 
+  aggregate_free(&sink.aggregate);
   if (numa_available() == -1 && NUMA_ALLOC) {
     free(memory);
   } else {
@@ -430,7 +283,7 @@ int run_benchs(size_t size_in_bytes,
 }
 
 void usage(const char *prog_name) {
-  printf ("Usage %s size access_mode period\n\trun benchmarks where:\n\t\tsize is the size of the allocated and accessed memory in mega bytes\n\t\taccess_mode is either seq for sequential accesses or rand for random accesses\n\t\tperiod the sampling period in number of events\n", prog_name);
+  printf ("Usage %s size access_mode period [events [sample_file]]\n\trun benchmarks where:\n\t\tsize is the size of the allocated and accessed memory in mega bytes\n\t\taccess_mode is the access pattern " ACCESS_PATTERN_HELP "\t\tperiod the sampling period in number of events, 0 to disable sampling\n\t\tevents the counted events, " EVENT_SET_HELP "\t\tsample_file the file the samples are written to, for pebs_analyze\n", prog_name);
 }
 
 int main(int argc, char **argv) {
@@ -438,6 +291,7 @@ int main(int argc, char **argv) {
   /**
    * Pin process on core CPU
    */
+  sched_getaffinity(0, sizeof(initial_cpus), &initial_cpus);
   cpu_set_t mask;
   CPU_ZERO(&mask);
   CPU_SET(CPU, &mask);
@@ -455,15 +309,18 @@ int main(int argc, char **argv) {
   }
   size_t size_in_bytes = atol(argv[1]) * 1000000;
   enum access_mode_t access_mode;
-  if (!strcmp(argv[2], "seq")) {
-    access_mode = access_seq;
-  } else if (!strcmp(argv[2], "rand")) {
-    access_mode = access_rand;
-  } else {
-    printf("Unknown access_mode %s\n", argv[2]);
+  struct fill_params fill_params;
+  fill_params_init(&fill_params);
+  if (parse_access_pattern(argv[2], &access_mode, &fill_params)) {
+    printf("Unknown access pattern %s\n", argv[2]);
     usage(argv[0]);
     return -1;
   }
   uint64_t period = atol(argv[3]);
-  return run_benchs(size_in_bytes, access_mode, period);
+  struct event_set events;
+  if (event_set_parse(&events, argc > 4 ? argv[4] : DEFAULT_EVENTS)) {
+    usage(argv[0]);
+    return -1;
+  }
+  return run_benchs(size_in_bytes, access_mode, &fill_params, period, &events, argc > 5 ? argv[5] : NULL);
 }
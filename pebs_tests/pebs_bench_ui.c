@@ -4,85 +4,9 @@
 #include <string.h>
 #include <assert.h>
 
-//#define PRINT
+#define BAR_WIDTH 50
 
-static int is_served_by_local_memory(union perf_mem_data_src data_src) {
-  if (data_src.mem_lvl & PERF_MEM_LVL_MISS) {
-    if (data_src.mem_lvl & PERF_MEM_LVL_L3) {
-      return 1;
-    } else {
-      return 0;
-    }
-  } else if (data_src.mem_lvl & PERF_MEM_LVL_HIT) {
-    if (data_src.mem_lvl & PERF_MEM_LVL_LOC_RAM) {
-      return 1;
-    } else if (data_src.mem_lvl & PERF_MEM_LVL_UNC) {
-      return 1;
-    } else {
-      return 0;
-    }
-  } else {
-    return 0;
-  }
-}
-
-static int is_served_by_remote_memory(union perf_mem_data_src data_src) {
-  if (data_src.mem_lvl & PERF_MEM_LVL_HIT) {
-    if (data_src.mem_lvl & PERF_MEM_LVL_REM_RAM1) {
-      return 1;
-    } else if (data_src.mem_lvl & PERF_MEM_LVL_REM_RAM2) {
-      return 1;
-    } else {
-      return 0;
-    }
-  } else {
-    return 0;
-  }
-}
-
-static int is_served_by_remote_cache(union perf_mem_data_src data_src) {
-  if (data_src.mem_lvl & PERF_MEM_LVL_HIT) {
-    if (data_src.mem_lvl & PERF_MEM_LVL_REM_CCE1) {
-      return 1;
-    } else if (data_src.mem_lvl & PERF_MEM_LVL_REM_CCE2) {
-      return 1;
-    } else {
-      return 0;
-    }
-  } else {
-    return 0;
-  }
-}
-
-static int is_served_by_local_cache(union perf_mem_data_src data_src) {
-  if (data_src.mem_lvl & PERF_MEM_LVL_HIT) {
-    if (data_src.mem_lvl & PERF_MEM_LVL_L1) {
-      return 1;
-    } else if (data_src.mem_lvl & PERF_MEM_LVL_LFB) {
-      return 1;
-    }  else if (data_src.mem_lvl & PERF_MEM_LVL_L2) {
-      return 1;
-    }  else if (data_src.mem_lvl & PERF_MEM_LVL_L3) {
-      return 1;
-    } else {
-      return 0;
-    }
-  } else {
-    return 0;
-  }
-}
-
-char *concat(const char *s1, const char *s2) {
-  char *result = malloc(strlen(s1) + strlen(s2) + 1);
-  if (result == NULL) {
-    return "malloc failed in concat\n";
-  }
-  strcpy(result, s1);
-  strcat(result, s2);
-  return result;
-}
-
-char *get_snoop(union perf_mem_data_src data_src) {
+const char *get_snoop(union perf_mem_data_src data_src) {
   if (data_src.mem_snoop & PERF_MEM_SNOOP_NA) {
     return "NA";
   }
@@ -101,256 +25,228 @@ char *get_snoop(union perf_mem_data_src data_src) {
   return "NULL";
 }
 
-char *get_data_src_level(union perf_mem_data_src data_src) {
-  char *res = concat("", "");
-  char *old_res;
-  if (data_src.mem_lvl & PERF_MEM_LVL_NA) {
-    old_res = res;
-    res = concat(res, "NA");
-    free(old_res);
-  }
+static const char *get_level(union perf_mem_data_src data_src) {
   if (data_src.mem_lvl & PERF_MEM_LVL_L1) {
-    old_res = res;
-    res = concat(res, "L1");
-    free(old_res);
+    return "L1";
   } else if (data_src.mem_lvl & PERF_MEM_LVL_LFB) {
-    old_res = res;
-    res = concat(res, "LFB");
-    free(old_res);
+    return "LFB";
   } else if (data_src.mem_lvl & PERF_MEM_LVL_L2) {
-    old_res = res;
-    res = concat(res, "L2");
-    free(old_res);
+    return "L2";
   } else if (data_src.mem_lvl & PERF_MEM_LVL_L3) {
-    old_res = res;
-    res = concat(res, "L3");
-    free(old_res);
+    return "L3";
   } else if (data_src.mem_lvl & PERF_MEM_LVL_LOC_RAM) {
-    old_res = res;
-    res = concat(res, "Local RAM");
-    free(old_res);
+    return "Local RAM";
   } else if (data_src.mem_lvl & PERF_MEM_LVL_REM_RAM1) {
-    old_res = res;
-    res = concat(res, "Remote RAM 1 hop");
-    free(old_res);
+    return "Remote RAM 1 hop";
   } else if (data_src.mem_lvl & PERF_MEM_LVL_REM_RAM2) {
-    old_res = res;
-    res = concat(res, "Remote RAM 2 hops");
-    free(old_res);
+    return "Remote RAM 2 hops";
   } else if (data_src.mem_lvl & PERF_MEM_LVL_REM_CCE1) {
-    old_res = res;
-    res = concat(res, "Remote Cache 1 hop");
-    free(old_res);
+    return "Remote Cache 1 hop";
   } else if (data_src.mem_lvl & PERF_MEM_LVL_REM_CCE2) {
-    old_res = res;
-    res = concat(res, "Remote Cache 2 hops");
-    free(old_res);
+    return "Remote Cache 2 hops";
   } else if (data_src.mem_lvl & PERF_MEM_LVL_IO) {
-    old_res = res;
-    res = concat(res, "I/O Memory");
-    free(old_res);
+    return "I/O Memory";
   } else if (data_src.mem_lvl & PERF_MEM_LVL_UNC) {
-    old_res = res;
-    res = concat(res, "Uncached Memory");
-    free(old_res);
+    return "Uncached Memory";
   }
-  if (data_src.mem_lvl & PERF_MEM_LVL_HIT) {
-    old_res = res;
-    res = concat(res, " Hit");
-    free(old_res);
-  } else if (data_src.mem_lvl & PERF_MEM_LVL_MISS) {
-    old_res = res;
-    res = concat(res, " Miss");
-    free(old_res);
-  }
-  return res;
+  return "";
 }
 
-char *get_tlb_string(union perf_mem_data_src data_src) {
-  char *res = concat("", "");
-  char *old_res;
-  if (data_src.mem_dtlb & PERF_MEM_TLB_NA) {
-    old_res = res;
-    res = concat(res, "NA");
-    free(old_res);
+static const char *get_hit_or_miss(uint64_t flags, uint64_t hit, uint64_t miss) {
+  if (flags & hit) {
+    return " Hit";
+  } else if (flags & miss) {
+    return " Miss";
   }
+  return "";
+}
+
+const char *get_data_src_level(union perf_mem_data_src data_src, char *buffer, size_t size) {
+  snprintf(buffer, size, "%s%s%s", data_src.mem_lvl & PERF_MEM_LVL_NA ? "NA" : "", get_level(data_src),
+	   get_hit_or_miss(data_src.mem_lvl, PERF_MEM_LVL_HIT, PERF_MEM_LVL_MISS));
+  return buffer;
+}
+
+const char *get_tlb_string(union perf_mem_data_src data_src, char *buffer, size_t size) {
+  const char *level = "";
   if (data_src.mem_dtlb & PERF_MEM_TLB_L1) {
-    old_res = res;
-    res = concat(res, "DTLB");
-    free(old_res);
+    level = "DTLB";
   } else if (data_src.mem_dtlb & PERF_MEM_TLB_L2) {
-    old_res = res;
-    res = concat(res, "STLB");
-    free(old_res);
-  }
-  if (data_src.mem_dtlb & PERF_MEM_TLB_HIT) {
-    old_res = res;
-    res = concat(res, " Hit");
-    free(old_res);
-  } else if (data_src.mem_dtlb & PERF_MEM_TLB_MISS) {
-    old_res = res;
-    res = concat(res, " Miss");
-    free(old_res);
+    level = "STLB";
   }
+  const char *walker = "";
   if (data_src.mem_dtlb & PERF_MEM_TLB_WK) {
-    old_res = res;
-    res = concat(res, " hardware walker");
-    free(old_res);
+    walker = " hardware walker";
   } else if (data_src.mem_dtlb & PERF_MEM_TLB_OS) {
-    old_res = res;
-    res = concat(res, " OS fault handler");
-    free(old_res);
+    walker = " OS fault handler";
   }
-  return res;
+  snprintf(buffer, size, "%s%s%s%s", data_src.mem_dtlb & PERF_MEM_TLB_NA ? "NA" : "", level,
+	   get_hit_or_miss(data_src.mem_dtlb, PERF_MEM_TLB_HIT, PERF_MEM_TLB_MISS), walker);
+  return buffer;
 }
 
-int compar_addr(const void* a1, const void* a2) {
-  struct sample *a = (struct sample*) a1;
-  struct sample *b = (struct sample*) a2;
-  if (a->addr == b->addr) {
-    return 0;
-  } else if (a->addr < b->addr) {
-    return -1;
+void print_sample(const struct sample *sample, uint64_t start_addr, uint64_t end_addr) {
+  printf("%-20" PRIx64, sample -> ip);
+  printf("%-20" PRIx64, sample -> addr);
+  if (sample->addr >= start_addr && sample->addr < end_addr) {
+    printf("%-10s", "in");
   } else {
-    return 1;
+    printf("%-10s", "out");
   }
+  printf("%-10" PRIu64, sample -> weight);
+  char buffer[64];
+  printf("%-30s", get_data_src_level(sample -> data_src, buffer, sizeof(buffer)));
+  printf("%-10s", get_snoop(sample -> data_src));
+  printf("%-10s", get_tlb_string(sample -> data_src, buffer, sizeof(buffer)));
+  printf("\n");
 }
 
-int compar_latency(const void* a1, const void* a2) {
-  struct sample *a = (struct sample*) a1;
-  struct sample *b = (struct sample*) a2;
-  if (a->weight == b->weight) {
-    return 0;
-  } else if (a->weight < b->weight) {
-    return 1;
-  } else {
-    return -1;
+/**
+ * Prints a bar of width proportional to value / max.
+ */
+static void print_bar(uint64_t value, uint64_t max) {
+  int width = max == 0 ? 0 : value * BAR_WIDTH / max;
+  for (int i = 0; i < width; i++) {
+    putchar('#');
   }
 }
 
-void print_samples(struct perf_event_mmap_page *metadata_page, display_order order, uint64_t start_addr, uint64_t end_addr, int nb_samples_estimated) {
+static void print_top(const char *title, const struct address_map *map, int shift, uint64_t nb_samples, int top_k) {
+  struct address_stats *top = malloc(top_k * sizeof(struct address_stats));
+  assert(top);
+  int nb_top = address_map_top(map, top, top_k);
+  printf("%-20s %-10s %-10s %-14s %-14s\n", title, "Samples", "%", "Avg latency", "Total latency");
+  for (int i = 0; i < nb_top; i++) {
+    printf("%-20" PRIx64 " %-10" PRIu64 " %-10.3f %-14.2f %-14" PRIu64 "\n", top[i].key << shift, top[i].nb_samples,
+	   top[i].nb_samples * 100.0 / nb_samples, top[i].latency / (double)top[i].nb_samples, top[i].latency);
+  }
+  free(top);
+}
+
+/**
+ * Prints how many samples fall in each bin of the sampled range.
+ */
+static void print_heatmap(const struct sample_aggregate *aggregate) {
+  printf("%-8" PRIu64 " samples out of malloced memory on %" PRIu64 " samples (%.3f%%)\n", aggregate->nb_out_of_range, aggregate->nb_samples,
+	 (aggregate->nb_out_of_range / (float) aggregate->nb_samples * 100));
+  uint64_t size = aggregate->end_addr - aggregate->start_addr;
+  uint64_t max_bin = 0;
+  for (int b = 0; b < HEATMAP_BINS; b++) {
+    if (aggregate->heatmap[b] > max_bin) {
+      max_bin = aggregate->heatmap[b];
+    }
+  }
+  printf("%-26s %-10s %-10s\n", "Offset (KiB)", "Samples", "%");
+  for (int b = 0; b < HEATMAP_BINS; b++) {
+    char range[32];
+    snprintf(range, sizeof(range), "%" PRIu64 "-%" PRIu64, b * size / HEATMAP_BINS / 1024, (b + 1) * size / HEATMAP_BINS / 1024);
+    printf("%-26s %-10" PRIu64 " %-10.3f ", range, aggregate->heatmap[b], aggregate->heatmap[b] * 100.0 / aggregate->nb_samples);
+    print_bar(aggregate->heatmap[b], max_bin);
+    printf("\n");
+  }
+  printf("\n");
+}
 
-  int remote_cache_count = 0;
-  int local_memory_count = 0;
-  int remote_memory_count = 0;
-  int cache_count = 0;
-  int in_malloced_count = 0;
-  int in_malloced_count_4 = 0;
-  int in_malloced_count_3 = 0;
-  int in_malloced_count_2 = 0;
-  int nb_samples = 0;
-  uint64_t latency = 0;
-  uint64_t latency_local_memory = 0;
-  uint64_t latency_remote_memory = 0;
-  int served_by_cpt;
+void print_aggregate(const struct sample_aggregate *aggregate, int nb_samples_estimated, int top_k) {
+  uint64_t nb_samples = aggregate->nb_samples;
+  const struct source_stats *sources = aggregate->sources;
+  uint64_t cache_count = sources[source_l1].nb_samples + sources[source_lfb].nb_samples +
+    sources[source_l2].nb_samples + sources[source_l3].nb_samples;
 
-  if (metadata_page != NULL) {
-    uint64_t head = metadata_page->data_head;
-    rmb();
-    long page_size = sysconf(_SC_PAGESIZE);
-    struct perf_event_header *header = (struct perf_event_header *)((char *)metadata_page + page_size);
+  if (nb_samples_estimated >= 0) {
+    printf("%-80s = %15" PRIu64 " (expected = %d)\n", "samples count", nb_samples, nb_samples_estimated);
+  } else {
+    printf("%-80s = %15" PRIu64 "\n", "samples count", nb_samples);
+  }
+  printf("\n");
+
+  printf("----------------- Where are the samples -----------------\n");
+  if (aggregate->end_addr > aggregate->start_addr) {
+    print_heatmap(aggregate);
+  }
+  printf("%" PRIu64 " pages sampled\n", aggregate->pages.nb_entries);
+  print_top("Hottest pages", &aggregate->pages, PAGE_SHIFT, nb_samples, top_k);
+  printf("\n");
+  if (aggregate->track_lines) {
+    printf("%" PRIu64 " lines sampled\n", aggregate->lines.nb_entries);
+    print_top("Hottest lines", &aggregate->lines, LINE_SHIFT, nb_samples, top_k);
+    printf("\n");
+  }
 
-    // Creates a list of samples
-    uint64_t i = 0;
-    while (i < head) {
-      if (header -> type == PERF_RECORD_SAMPLE) {
-	nb_samples++;
+  printf("----------------- In which level of memory -----------------\n");
+  printf("%-8" PRIu64 " remote cache samples  on %" PRIu64 " samples (%.3f%%)\n", sources[source_remote_cache].nb_samples, nb_samples,
+	 (sources[source_remote_cache].nb_samples / (float) nb_samples * 100));
+  printf("%-8" PRIu64 " local  cache samples  on %" PRIu64 " samples (%.3f%%)\n", cache_count, nb_samples, (cache_count / (float) nb_samples * 100));
+  printf("%-8" PRIu64 " local memory samples  on %" PRIu64 " samples (%.3f%%)\n", sources[source_local_dram].nb_samples, nb_samples,
+	 (sources[source_local_dram].nb_samples / (float) nb_samples * 100));
+  printf("%-8" PRIu64 " remote memory samples on %" PRIu64 " samples (%.3f%%)\n", sources[source_remote_dram].nb_samples, nb_samples,
+	 (sources[source_remote_dram].nb_samples / (float) nb_samples * 100));
+  printf("\n");
+
+  printf("----------------- Latency per source -----------------\n");
+  for (int s = 0; s < nb_sources; s++) {
+    if (sources[s].nb_samples == 0) {
+      continue;
+    }
+    printf("%s: %" PRIu64 " samples, average latency %.2f\n", data_source_names[s], sources[s].nb_samples,
+	   sources[s].latency / (double)sources[s].nb_samples);
+    uint64_t max_bucket = 0;
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+      if (sources[s].histogram[b] > max_bucket) {
+	max_bucket = sources[s].histogram[b];
       }
-      i = i + header -> size;
-      header = (struct perf_event_header *)((char *)header + header -> size);
     }
-    struct sample *samples = malloc(nb_samples * sizeof(struct sample));
-    int index = 0;
-    i = 0;
-    header = (struct perf_event_header *)((char *)metadata_page + page_size);
-    while (i < head) {
-      if (header -> type == PERF_RECORD_SAMPLE) {
-	struct sample *sample = (struct sample *)((char *)(header) + 8);
-	memcpy(&samples[index], sample, sizeof(struct sample));
-	index++;
-	if (sample->addr >= start_addr && sample->addr <= start_addr + (end_addr - start_addr) / 4) {
-	  in_malloced_count_4++;
-	}
-	if (sample->addr >= start_addr && sample->addr <= start_addr + (end_addr - start_addr) / 3) {
-	  in_malloced_count_3++;
-	}
-	if (sample->addr >= start_addr && sample->addr <= start_addr + (end_addr - start_addr) / 2) {
-	  in_malloced_count_2++;
-	}
-	if (sample->addr >= start_addr && sample->addr <= end_addr) {
-	  in_malloced_count++;
-	}
-
-	served_by_cpt = 0;
-	if (is_served_by_remote_cache(sample->data_src)) {
-	  remote_cache_count++;
-	  served_by_cpt++;
-	}
-	if (is_served_by_local_cache(sample->data_src)) {
-	  cache_count++;
-	  served_by_cpt++;
-	}
-	if (is_served_by_local_memory(sample->data_src)) {
-	  local_memory_count++;
-	  latency_local_memory += sample->weight;
-	  served_by_cpt++;
-	}
-	if (is_served_by_remote_memory(sample->data_src)) {
-	  remote_memory_count++;
-	  latency_remote_memory += sample->weight;
-	  served_by_cpt++;
-	}
-	latency += sample->weight;
-	assert(served_by_cpt == 1);
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+      if (sources[s].histogram[b] == 0) {
+	continue;
       }
-      i = i + header -> size;
-      header = (struct perf_event_header *)((char *)header + header -> size);
+      char range[32];
+      snprintf(range, sizeof(range), "[%" PRIu64 ", %" PRIu64 "[", latency_bucket_low(b),
+	       b == LATENCY_BUCKETS - 1 ? UINT64_MAX : latency_bucket_low(b + 1));
+      printf("  %-24s %-10" PRIu64 " %-10.3f ", range, sources[s].histogram[b], sources[s].histogram[b] * 100.0 / sources[s].nb_samples);
+      print_bar(sources[s].histogram[b], max_bucket);
+      printf("\n");
     }
+  }
+  printf("\n");
 
-    // Sort the list if required
-    qsort(samples, nb_samples, sizeof(struct sample), compar_latency);
+  printf("----------------- Average latencies -----------------\n");
+  printf("Average latency               = %0.2f ns (%0.2f cycles for frequency = 2.668 Giga hertz)\n", (aggregate->latency / (float) nb_samples), (aggregate->latency / (float) nb_samples) * (1E9 / 266800000.0));
+  printf("Average local memory latency  = %0.2f ns\n", (sources[source_local_dram].latency / (float) sources[source_local_dram].nb_samples));
+  printf("Average remote memory latency = %0.2f ns\n", (sources[source_remote_dram].latency / (float) sources[source_remote_dram].nb_samples));
+}
 
-    printf("%-80s = %15d (expected = %d)\n", "samples count", nb_samples, nb_samples_estimated);
+static void print_top_symbols(const char *title, const struct address_space *space, int data, int top_k) {
+  const struct symbol **top = malloc(top_k * sizeof(struct symbol *));
+  assert(top);
+  int nb_top = address_space_top(space, data, top, top_k);
+  printf("%-14s %-10s %-12s %-10s %-40s %s\n", "Total latency", "Samples", "Avg latency", "% remote", title, "Module");
+  for (int i = 0; i < nb_top; i++) {
+    printf("%-14" PRIu64 " %-10" PRIu64 " %-12.2f %-10.3f %-40s %s\n", top[i]->latency, top[i]->nb_samples,
+	   top[i]->latency / (double)top[i]->nb_samples, top[i]->nb_remote * 100.0 / top[i]->nb_samples,
+	   top[i]->name, top[i]->module);
+  }
+  free(top);
+}
 
-    // Print the list of samples
-#ifdef PRINT
-    printf("\n");
-    for (int i = 0; i < nb_samples; i++) {
-      struct sample *sample = &samples[i];
-      printf("%-20" PRIx64, sample -> ip);
-      printf("%-20" PRIx64, sample -> addr);
-      if (sample->addr >= start_addr && sample->addr <= end_addr) {
-	printf("%-10s", "in");
-      } else {
-	printf("%-10s", "out");
-      }
-      printf("%-10" PRIu64, sample -> weight);
-      char *level = get_data_src_level(sample -> data_src);
-      printf("%-30s", level);
-      free(level);
-      printf("%-10s", get_snoop(sample -> data_src));
-      printf("%-10s", get_tlb_string(sample -> data_src));
-      printf("\n");
+void print_symbols(const struct address_space *space, int top_k) {
+  printf("\n");
+  printf("----------------- In which kind of memory -----------------\n");
+  printf("%-14s %-10s %-12s %s\n", "Kind", "Samples", "Avg latency", "% remote");
+  for (int k = 0; k < nb_region_kinds; k++) {
+    const struct region_stats *kind = &space->kinds[k];
+    if (kind->nb_samples == 0) {
+      continue;
     }
-#endif
+    printf("%-14s %-10" PRIu64 " %-12.2f %.3f\n", region_kind_names[k], kind->nb_samples,
+	   kind->latency / (double)kind->nb_samples, kind->nb_remote * 100.0 / kind->nb_samples);
   }
-
   printf("\n");
 
-  printf("----------------- Where are the samples -----------------\n"); 
-  printf("%-8d samples in                  malloced memory on %d samples (%.3f%%)\n", in_malloced_count, nb_samples, (in_malloced_count / (float) nb_samples * 100));
-  printf("%-8d samples in first half    of malloced memory on %d samples (%.3f%%)\n", in_malloced_count_2, nb_samples, (in_malloced_count_2 / (float) nb_samples * 100));
-  printf("%-8d samples in first third   of malloced memory on %d samples (%.3f%%)\n", in_malloced_count_3, nb_samples, (in_malloced_count_3 / (float) nb_samples * 100));
-  printf("%-8d samples in first quarter of malloced memory on %d samples (%.3f%%)\n", in_malloced_count_4, nb_samples, (in_malloced_count_4 / (float) nb_samples * 100));
+  printf("----------------- Which functions -----------------\n");
+  print_top_symbols("Function", space, 0, top_k);
   printf("\n");
-  printf("----------------- In which level of memory -----------------\n"); 
-  printf("%-8d remote cache samples  on %d samples (%.3f%%)\n", remote_cache_count, nb_samples, (remote_cache_count / (float) nb_samples * 100));
-  printf("%-8d local  cache samples  on %d samples (%.3f%%)\n", cache_count, nb_samples, (cache_count / (float) nb_samples * 100));
-  printf("%-8d local memory samples  on %d samples (%.3f%%)\n", local_memory_count, nb_samples, (local_memory_count / (float) nb_samples * 100));
-  printf("%-8d remote memory samples on %d samples (%.3f%%)\n", remote_memory_count, nb_samples, (remote_memory_count / (float) nb_samples * 100));
-  printf("\n");
-  printf("----------------- Average latencies -----------------\n"); 
-  printf("Average latency               = %0.2f ns (%0.2f cycles for frequency = 2.668 Giga hertz)\n", (latency / (float) nb_samples), (latency / (float) nb_samples) * (1E9 / 266800000.0));
-  printf("Average local memory latency  = %0.2f ns\n", (latency_local_memory / (float) local_memory_count));
-  printf("Average remote memory latency = %0.2f ns\n", (latency_remote_memory / (float) remote_memory_count));
+
+  printf("----------------- Which data objects -----------------\n");
+  print_top_symbols("Data object", space, 1, top_k);
 }
@@ -2,17 +2,33 @@
 #define PEBS_BENCH_UI_H
 
 #include "pebs_bench.h"
+#include "pebs_aggregate.h"
+#include "pebs_symbols.h"
 
-typedef enum {
-  IP,
-  ADDR,
-  IN_OUT_MEMORY,
-  WEIGHT,
-  SRC
-}
-display_order;
+/**
+ * Prints one line describing sample, in or out of [start_addr, end_addr[.
+ */
+void print_sample(const struct sample *sample, uint64_t start_addr, uint64_t end_addr);
 
-void print_samples(struct perf_event_mmap_page *metadata_page, display_order order, uint64_t start_addr, uint64_t end_addr, int nb_samples_estimated);
-char* concat(const char *s1, const char *s2);
+/**
+ * Prints the heatmap of the sampled range if any, the top_k hottest
+ * pages and lines, and the latency histogram of each data source. The
+ * number of samples expected is not printed if negative.
+ */
+void print_aggregate(const struct sample_aggregate *aggregate, int nb_samples_estimated, int top_k);
+
+/**
+ * Prints the samples per kind of memory, and the top_k functions and
+ * data objects with the highest total latency.
+ */
+void print_symbols(const struct address_space *space, int top_k);
+
+/**
+ * Describes the data source of a sample, in buffer for the last two
+ * ones, without allocating anything.
+ */
+const char *get_snoop(union perf_mem_data_src data_src);
+const char *get_data_src_level(union perf_mem_data_src data_src, char *buffer, size_t size);
+const char *get_tlb_string(union perf_mem_data_src data_src, char *buffer, size_t size);
 
 #endif
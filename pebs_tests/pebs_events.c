@@ -0,0 +1,261 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#ifdef HAVE_LIBPFM
+#include <perfmon/pfmlib_perf_event.h>
+#endif
+
+#include "pebs_events.h"
+
+/**
+ * Events known by name: the Nehalem events the benchmark used to be
+ * compiled with.
+ */
+static const struct {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+  uint64_t config1;
+  int uncore;
+} known_events[] = {
+  {"page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, 0, 0},
+  {"inst_retired.any", PERF_TYPE_RAW, 0x00c0, 0, 0},
+  {"mem_inst_retired.loads", PERF_TYPE_RAW, 0x010b, 0, 0},
+  {"mem_uncore_retired.local_dram_and_remote_cache_hit", PERF_TYPE_RAW, 0x53080f, 0, 0},
+  {"offcore_response_0.remote_cache_fwd", PERF_TYPE_RAW, 0x5301b7, 0x1011, 0},
+  {"offcore_response_1.local_dram", PERF_TYPE_RAW, 0x5301bb, 0x4033, 0},
+  {"offcore_response_1.remote_dram", PERF_TYPE_RAW, 0x5301bb, 0x2033, 0},
+  {"qmc_normal_reads.any", 6 /* /sys/bus/event_source/devices/uncore/type */, 0x072c, 0, 1}
+};
+
+#define NB_KNOWN_EVENTS (sizeof(known_events) / sizeof(known_events[0]))
+
+static long perf_event_open(struct perf_event_attr *hw_event, pid_t pid, int cpu,
+			    int group_fd, unsigned long flags) {
+  return syscall(__NR_perf_event_open, hw_event, pid, cpu, group_fd, flags);
+}
+
+static struct event *add_event(struct event_set *set, const char *name) {
+  if (set->nb_events == MAX_EVENTS) {
+    return NULL;
+  }
+  struct event *event = &set->events[set->nb_events++];
+  memset(event, 0, sizeof(struct event));
+  snprintf(event->name, sizeof(event->name), "%s", name);
+  event->attr.size = sizeof(event->attr);
+  event->fd = -1;
+  return event;
+}
+
+#ifdef HAVE_LIBPFM
+/**
+ * Returns the type of the core PMU, the events of the other dynamic PMUs
+ * being uncore ones.
+ */
+static uint32_t core_pmu_type() {
+  uint32_t type = PERF_TYPE_RAW;
+  FILE *f = fopen("/sys/bus/event_source/devices/cpu/type", "r");
+  if (f != NULL) {
+    if (fscanf(f, "%u", &type) != 1) {
+      type = PERF_TYPE_RAW;
+    }
+    fclose(f);
+  }
+  return type;
+}
+
+static int add_libpfm_event(struct event_set *set, const char *name) {
+  static int initialized = 0;
+  if (!initialized) {
+    if (pfm_initialize() != PFM_SUCCESS) {
+      fprintf(stderr, "Cannot initialize libpfm\n");
+      return -1;
+    }
+    initialized = 1;
+  }
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  pfm_perf_encode_arg_t arg;
+  memset(&arg, 0, sizeof(arg));
+  arg.attr = &attr;
+  arg.size = sizeof(arg);
+  int ret = pfm_get_os_event_encoding(name, PFM_PLM3, PFM_OS_PERF_EVENT_EXT, &arg);
+  if (ret != PFM_SUCCESS) {
+    fprintf(stderr, "Unknown event %s: %s\n", name, pfm_strerror(ret));
+    return -1;
+  }
+  struct event *event = add_event(set, name);
+  if (event == NULL) {
+    return -1;
+  }
+  event->attr.type = attr.type;
+  event->attr.config = attr.config;
+  event->attr.config1 = attr.config1;
+  event->uncore = attr.type >= PERF_TYPE_MAX && attr.type != core_pmu_type();
+  return 0;
+}
+#endif
+
+int event_set_parse(struct event_set *set, const char *spec) {
+  set->nb_events = 0;
+  char *copy = strdup(spec);
+  char *saveptr = NULL;
+  int ret = 0;
+  for (char *name = strtok_r(copy, ",", &saveptr); name != NULL && ret == 0; name = strtok_r(NULL, ",", &saveptr)) {
+    int found = 0;
+    for (int i = 0; i < NB_KNOWN_EVENTS && !found; i++) {
+      if (!strcasecmp(known_events[i].name, name)) {
+	struct event *event = add_event(set, known_events[i].name);
+	if (event == NULL) {
+	  ret = -1;
+	} else {
+	  event->attr.type = known_events[i].type;
+	  event->attr.config = known_events[i].config;
+	  event->attr.config1 = known_events[i].config1;
+	  event->uncore = known_events[i].uncore;
+	}
+	found = 1;
+      }
+    }
+    if (!found && name[0] == 'r' && name[1] != '\0') {
+      char *end;
+      uint64_t config = strtoull(name + 1, &end, 16);
+      uint64_t config1 = 0;
+      if (*end == ':' && end[1] != '\0') {
+	config1 = strtoull(end + 1, &end, 16);
+      }
+      if (*end == '\0') {
+	struct event *event = add_event(set, name);
+	if (event == NULL) {
+	  ret = -1;
+	} else {
+	  event->attr.type = PERF_TYPE_RAW;
+	  event->attr.config = config;
+	  event->attr.config1 = config1;
+	}
+	found = 1;
+      }
+    }
+#ifdef HAVE_LIBPFM
+    if (!found) {
+      ret = add_libpfm_event(set, name);
+      found = 1;
+    }
+#endif
+    if (!found) {
+      fprintf(stderr, "Unknown event %s\n", name);
+      ret = -1;
+    }
+  }
+  free(copy);
+  return ret;
+}
+
+/**
+ * Opens the events of set in the uncore group or not, the first one
+ * leading the group.
+ */
+static int open_group(struct event_set *set, int uncore, int cpu) {
+  int leader = -1;
+  for (int e = 0; e < set->nb_events; e++) {
+    struct event *event = &set->events[e];
+    if (event->uncore != uncore) {
+      continue;
+    }
+    event->attr.read_format = PERF_FORMAT_GROUP;
+    event->attr.disabled = leader == -1;
+    if (!uncore) {
+      event->attr.exclude_kernel = 1;
+      event->attr.exclude_hv = 1;
+    }
+    event->fd = perf_event_open(&event->attr, uncore ? -1 : 0, cpu, leader, 0);
+    if (event->fd == -1) {
+      fprintf(stderr, "perf_event_open failed for %s: %s\n", event->name, strerror(errno));
+      return -1;
+    }
+    if (leader == -1) {
+      leader = event->fd;
+    }
+  }
+  return 0;
+}
+
+int event_set_open(struct event_set *set, int cpu, int uncore_cpu) {
+  if (open_group(set, 0, cpu) || open_group(set, 1, uncore_cpu)) {
+    event_set_close(set);
+    return -1;
+  }
+  return 0;
+}
+
+void event_set_close(struct event_set *set) {
+  for (int e = 0; e < set->nb_events; e++) {
+    if (set->events[e].fd != -1) {
+      close(set->events[e].fd);
+      set->events[e].fd = -1;
+    }
+  }
+}
+
+/**
+ * Returns the index of the leader of the uncore group or not, or -1 if
+ * the group is empty.
+ */
+static int group_leader(const struct event_set *set, int uncore) {
+  for (int e = 0; e < set->nb_events; e++) {
+    if (set->events[e].uncore == uncore) {
+      return e;
+    }
+  }
+  return -1;
+}
+
+void event_set_start(const struct event_set *set) {
+  for (int uncore = 0; uncore <= 1; uncore++) {
+    int leader = group_leader(set, uncore);
+    if (leader != -1) {
+      ioctl(set->events[leader].fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ioctl(set->events[leader].fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+  }
+}
+
+void event_set_stop(const struct event_set *set) {
+  for (int uncore = 1; uncore >= 0; uncore--) {
+    int leader = group_leader(set, uncore);
+    if (leader != -1) {
+      ioctl(set->events[leader].fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    }
+  }
+}
+
+int event_set_read(const struct event_set *set, uint64_t *values) {
+  for (int uncore = 0; uncore <= 1; uncore++) {
+    int leader = group_leader(set, uncore);
+    if (leader == -1) {
+      continue;
+    }
+
+    /**
+     * Group read format: number of events, then the count of each one
+     * in the order they were opened.
+     */
+    uint64_t buffer[1 + MAX_EVENTS];
+    if (read(set->events[leader].fd, buffer, sizeof(buffer)) < (ssize_t)sizeof(uint64_t)) {
+      return -1;
+    }
+    int index = 0;
+    for (int e = 0; e < set->nb_events; e++) {
+      if (set->events[e].uncore == uncore) {
+	if (index == buffer[0]) {
+	  return -1;
+	}
+	values[e] = buffer[1 + index++];
+      }
+    }
+  }
+  return 0;
+}
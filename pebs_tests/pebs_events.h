@@ -0,0 +1,75 @@
+#ifndef PEBS_EVENTS_H
+#define PEBS_EVENTS_H
+
+#include "pebs_bench.h"
+
+#define MAX_EVENTS 8
+
+#ifdef HAVE_LIBPFM
+#define EVENT_SET_LIBPFM_HELP "\t\t\tor any event known by libpfm4 (e.g. MEM_LOAD_RETIRED:L3_MISS)\n"
+#else
+#define EVENT_SET_LIBPFM_HELP ""
+#endif
+
+/**
+ * Syntax of the events accepted by event_set_parse, to be printed in the
+ * usage.
+ */
+#define EVENT_SET_HELP							\
+  "comma separated events among page-faults, inst_retired.any, mem_inst_retired.loads,\n" \
+  "\t\t\tmem_uncore_retired.local_dram_and_remote_cache_hit, offcore_response_0.remote_cache_fwd,\n" \
+  "\t\t\toffcore_response_1.local_dram, offcore_response_1.remote_dram, qmc_normal_reads.any\n" \
+  "\t\t\t(uncore), raw events rXXXX or rXXXX:YYYY with YYYY the extra register (config1)\n" \
+  EVENT_SET_LIBPFM_HELP							\
+  "\t\t\t(default is page-faults)\n"
+
+struct event {
+  char name[64];
+  struct perf_event_attr attr;
+  int uncore;
+  int fd;
+};
+
+/**
+ * Events chosen at runtime. Core events are opened as one group for the
+ * calling thread, and uncore events, counted for a whole socket, as
+ * another group, so that they are all enabled and disabled together.
+ */
+struct event_set {
+  int nb_events;
+  struct event events[MAX_EVENTS];
+};
+
+/**
+ * Sets set to the events described by spec as described by
+ * EVENT_SET_HELP. Returns 0 on success and -1 if an event is unknown or
+ * there are more than MAX_EVENTS events.
+ */
+int event_set_parse(struct event_set *set, const char *spec);
+
+/**
+ * Opens the core events of set on cpu and the uncore ones on
+ * uncore_cpu. Returns 0 on success, and -1 if an event cannot be
+ * opened, all the events being then closed.
+ */
+int event_set_open(struct event_set *set, int cpu, int uncore_cpu);
+
+void event_set_close(struct event_set *set);
+
+/**
+ * Resets and enables all the events.
+ */
+void event_set_start(const struct event_set *set);
+
+/**
+ * Disables all the events.
+ */
+void event_set_stop(const struct event_set *set);
+
+/**
+ * Reads the count of each event in values. Returns 0 on success and -1
+ * on failure.
+ */
+int event_set_read(const struct event_set *set, uint64_t *values);
+
+#endif
@@ -0,0 +1,122 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pebs_file.h"
+
+#define WRITE_BUFFER_SIZE (1 << 20)
+
+int sample_file_create(struct sample_file_writer *writer, const char *path, uint64_t start_addr,
+		       uint64_t end_addr, uint64_t period) {
+  writer->file = fopen(path, "w");
+  if (writer->file == NULL) {
+    fprintf(stderr, "Cannot create %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  setvbuf(writer->file, NULL, _IOFBF, WRITE_BUFFER_SIZE);
+  struct sample_file_header *header = &writer->header;
+  memset(header, 0, sizeof(struct sample_file_header));
+  memcpy(header->magic, SAMPLE_FILE_MAGIC, sizeof(header->magic));
+  header->version = SAMPLE_FILE_VERSION;
+  header->header_size = sizeof(struct sample_file_header);
+  header->record_size = sizeof(struct sample);
+  header->sample_type = SAMPLE_FILE_SAMPLE_TYPE;
+  header->start_addr = start_addr;
+  header->end_addr = end_addr;
+  header->period = period;
+
+  /**
+   * The header is written again once the number of samples is known.
+   */
+  if (fwrite(header, sizeof(struct sample_file_header), 1, writer->file) != 1) {
+    fprintf(stderr, "Cannot write to %s: %s\n", path, strerror(errno));
+    fclose(writer->file);
+    return -1;
+  }
+  return 0;
+}
+
+void sample_file_write(struct sample_file_writer *writer, const struct sample *sample) {
+  if (fwrite(sample, sizeof(struct sample), 1, writer->file) == 1) {
+    writer->header.nb_samples++;
+  }
+}
+
+int sample_file_close(struct sample_file_writer *writer, uint64_t nb_lost) {
+  writer->header.nb_lost = nb_lost;
+  int ret = 0;
+  if (fseek(writer->file, 0, SEEK_SET) == -1 ||
+      fwrite(&writer->header, sizeof(struct sample_file_header), 1, writer->file) != 1) {
+    fprintf(stderr, "Cannot write the sample file header: %s\n", strerror(errno));
+    ret = -1;
+  }
+  if (fclose(writer->file) == EOF) {
+    fprintf(stderr, "Cannot close the sample file: %s\n", strerror(errno));
+    ret = -1;
+  }
+  return ret;
+}
+
+int sample_file_open(struct sample_file *file, const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1 || st.st_size < sizeof(struct sample_file_header)) {
+    fprintf(stderr, "%s is not a sample file\n", path);
+    close(fd);
+    return -1;
+  }
+  file->size = st.st_size;
+  void *address = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (address == MAP_FAILED) {
+    fprintf(stderr, "Cannot map %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  /**
+   * The samples are read once, in order.
+   */
+  madvise(address, file->size, MADV_SEQUENTIAL);
+  madvise(address, file->size, MADV_WILLNEED);
+  file->header = address;
+  const struct sample_file_header *header = file->header;
+  if (memcmp(header->magic, SAMPLE_FILE_MAGIC, sizeof(header->magic)) || header->version != SAMPLE_FILE_VERSION) {
+    fprintf(stderr, "%s is not a sample file\n", path);
+    sample_file_unmap(file);
+    return -1;
+  }
+  if (header->record_size != sizeof(struct sample) || header->sample_type != SAMPLE_FILE_SAMPLE_TYPE) {
+    fprintf(stderr, "%s has records of %u bytes for sample type 0x%" PRIx64 ", 0x%" PRIx64 " expected\n",
+	    path, header->record_size, header->sample_type, (uint64_t)SAMPLE_FILE_SAMPLE_TYPE);
+    sample_file_unmap(file);
+    return -1;
+  }
+  if (header->header_size < sizeof(struct sample_file_header) || header->header_size > file->size) {
+    fprintf(stderr, "%s has an invalid header size of %u bytes\n", path, header->header_size);
+    sample_file_unmap(file);
+    return -1;
+  }
+
+  /**
+   * Compared by division so that a corrupted number of samples cannot
+   * overflow.
+   */
+  if (header->nb_samples > (file->size - header->header_size) / header->record_size) {
+    fprintf(stderr, "%s is truncated\n", path);
+    sample_file_unmap(file);
+    return -1;
+  }
+  file->samples = (const struct sample *)((const char *)address + header->header_size);
+  return 0;
+}
+
+void sample_file_unmap(struct sample_file *file) {
+  munmap((void *)file->header, file->size);
+}
@@ -0,0 +1,72 @@
+#ifndef PEBS_FILE_H
+#define PEBS_FILE_H
+
+#include <stdio.h>
+
+#include "pebs_bench.h"
+
+#define SAMPLE_FILE_MAGIC "PEBSSMPL"
+#define SAMPLE_FILE_VERSION 1
+
+/**
+ * Layout of the records of a sample file: the fields of struct sample.
+ */
+#define SAMPLE_FILE_SAMPLE_TYPE (PERF_SAMPLE_IP | PERF_SAMPLE_ADDR | PERF_SAMPLE_WEIGHT | PERF_SAMPLE_DATA_SRC)
+
+/**
+ * A sample file is this header followed by nb_samples fixed size
+ * records, each one a struct sample, so that it can be mapped and
+ * walked as an array.
+ */
+struct sample_file_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t record_size;
+  uint32_t reserved;
+  uint64_t sample_type;
+  uint64_t start_addr;
+  uint64_t end_addr;
+  uint64_t period;
+  uint64_t nb_samples;
+  uint64_t nb_lost;
+};
+
+struct sample_file_writer {
+  FILE *file;
+  struct sample_file_header header;
+};
+
+/**
+ * A sample file mapped read only.
+ */
+struct sample_file {
+  const struct sample_file_header *header;
+  const struct sample *samples;
+  size_t size;
+};
+
+/**
+ * Creates the file at path for the samples of the range [start_addr,
+ * end_addr[ taken every period events. Returns -1 on error.
+ */
+int sample_file_create(struct sample_file_writer *writer, const char *path, uint64_t start_addr,
+		       uint64_t end_addr, uint64_t period);
+
+void sample_file_write(struct sample_file_writer *writer, const struct sample *sample);
+
+/**
+ * Writes the final header, with the number of samples lost by the
+ * kernel, and closes the file. Returns -1 on error.
+ */
+int sample_file_close(struct sample_file_writer *writer, uint64_t nb_lost);
+
+/**
+ * Maps the file at path, checking that its records are laid out as
+ * struct sample. Returns -1 on error.
+ */
+int sample_file_open(struct sample_file *file, const char *path);
+
+void sample_file_unmap(struct sample_file *file);
+
+#endif
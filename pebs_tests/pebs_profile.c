@@ -0,0 +1,504 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#include <signal.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+
+#include "pebs_bench.h"
+#include "pebs_bench_ui.h"
+#include "pebs_ring.h"
+#include "pebs_file.h"
+#include "pebs_symbols.h"
+
+#define RING_BUFFER_PAGES 64 /* Must be a power of two */
+#define POLL_TIMEOUT_MS 100
+
+#define DEFAULT_PERIOD 1000
+#define DEFAULT_CONFIG 0x100b /* MEM_INST_RETIRED.LATENCY_ABOVE_THRESHOLD */
+#define DEFAULT_THRESHOLD 3
+#define DEFAULT_TOP_K 10
+#define SPARE_FDS 32 /* For the standard streams, the epoll set and the files read */
+
+/**
+ * The sampling events of a profiled pid or of the whole system: one
+ * event per cpu and per thread of the pid (a single one per cpu for the
+ * whole system), all those of a cpu writing to the ring buffer of its
+ * first event, the leader.
+ */
+struct profile {
+  int nb_cpus;
+  int *leaders;
+  struct pebs_ring *rings;
+  int *fds;
+  int *fd_cpus;
+  int nb_fds;
+  int max_fds;
+};
+
+/**
+ * The samples of a pid are attributed to its functions and data objects
+ * too, its address space being followed through the mmap records.
+ */
+struct sample_sink {
+  struct sample_aggregate aggregate;
+  struct sample_file_writer *writer;
+  struct address_space *space;
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int signum) {
+  stop = 1;
+}
+
+static void add_sample(const struct sample *sample, void *arg) {
+  struct sample_sink *sink = arg;
+  aggregate_add(&sink->aggregate, sample);
+  if (sink->writer != NULL) {
+    sample_file_write(sink->writer, sample);
+  }
+  if (sink->space != NULL) {
+    address_space_add(sink->space, sample);
+  }
+}
+
+static void add_record(const struct perf_event_header *header, void *arg) {
+  struct sample_sink *sink = arg;
+  address_space_mmap_record(sink->space, header);
+}
+
+static long perf_event_open(struct perf_event_attr *hw_event,
+			    pid_t pid,
+			    int cpu,
+			    int group_fd,
+			    unsigned long flags) {
+  int ret = syscall(__NR_perf_event_open, hw_event, pid, cpu,
+		    group_fd, flags);
+  return ret;
+}
+
+/**
+ * Returns the number of threads of pid, whose ids are put in *tids, or
+ * -1 if pid does not exist.
+ */
+static int get_threads(pid_t pid, pid_t **tids) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/task", pid);
+  DIR *dir = opendir(path);
+  if (dir == NULL) {
+    fprintf(stderr, "Cannot list the threads of %d: %s\n", pid, strerror(errno));
+    return -1;
+  }
+  int nb_tids = 0;
+  int max_tids = 16;
+  *tids = malloc(max_tids * sizeof(pid_t));
+  assert(*tids);
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    if (nb_tids == max_tids) {
+      max_tids *= 2;
+      *tids = realloc(*tids, max_tids * sizeof(pid_t));
+      assert(*tids);
+    }
+    (*tids)[nb_tids++] = atoi(entry->d_name);
+  }
+  closedir(dir);
+  return nb_tids;
+}
+
+static void add_fd(struct profile *profile, int fd, int cpu) {
+  if (profile->nb_fds == profile->max_fds) {
+    profile->max_fds = profile->max_fds == 0 ? 64 : 2 * profile->max_fds;
+    profile->fds = realloc(profile->fds, profile->max_fds * sizeof(int));
+    assert(profile->fds);
+    profile->fd_cpus = realloc(profile->fd_cpus, profile->max_fds * sizeof(int));
+    assert(profile->fd_cpus);
+  }
+  profile->fds[profile->nb_fds] = fd;
+  profile->fd_cpus[profile->nb_fds] = cpu;
+  profile->nb_fds++;
+}
+
+/**
+ * Opens the events of tid (-1 for every task) on cpu. The first one
+ * becomes the leader of cpu and gets its ring buffer, the following ones
+ * are redirected to it. Threads exited since they were listed and cpus
+ * offline are skipped. Returns -1 on error.
+ */
+static int open_event(struct profile *profile, struct perf_event_attr *attr, pid_t tid, int cpu,
+		      sample_handler handler, void *arg) {
+  int fd = perf_event_open(attr, tid, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+  if (fd == -1) {
+    if (errno == ESRCH || errno == ENODEV) {
+      return 0;
+    }
+    fprintf(stderr, "perf_event_open failed for thread %d on cpu %d: %s\n", tid, cpu, strerror(errno));
+    return -1;
+  }
+  add_fd(profile, fd, cpu);
+  if (profile->leaders[cpu] == -1) {
+    if (pebs_ring_map(&profile->rings[cpu], fd, RING_BUFFER_PAGES, handler, arg)) {
+      return -1;
+    }
+    profile->leaders[cpu] = fd;
+  } else if (ioctl(fd, PERF_EVENT_IOC_SET_OUTPUT, profile->leaders[cpu]) == -1) {
+    fprintf(stderr, "Cannot redirect the samples of thread %d on cpu %d: %s\n", tid, cpu, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Raises the soft limit of open files to the hard one, as there is an
+ * event per thread and per cpu. Returns -1 if nb_fds events would still
+ * not fit.
+ */
+static int reserve_fds(uint64_t nb_fds) {
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == -1) {
+    return 0;
+  }
+  if (limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    getrlimit(RLIMIT_NOFILE, &limit);
+  }
+  if (limit.rlim_cur != RLIM_INFINITY && nb_fds + SPARE_FDS > limit.rlim_cur) {
+    fprintf(stderr, "%" PRIu64 " events are needed, one per thread and per cpu, but at most %lu files can be open"
+	    " (ulimit -n)\n", nb_fds, (unsigned long)limit.rlim_cur);
+    return -1;
+  }
+  return 0;
+}
+
+static int profile_open(struct profile *profile, struct perf_event_attr *attr, pid_t pid,
+			sample_handler handler, void *arg) {
+  memset(profile, 0, sizeof(struct profile));
+  profile->nb_cpus = sysconf(_SC_NPROCESSORS_CONF);
+  profile->leaders = malloc(profile->nb_cpus * sizeof(int));
+  assert(profile->leaders);
+  profile->rings = malloc(profile->nb_cpus * sizeof(struct pebs_ring));
+  assert(profile->rings);
+  for (int cpu = 0; cpu < profile->nb_cpus; cpu++) {
+    profile->leaders[cpu] = -1;
+  }
+
+  /**
+   * inherit only follows the threads created after the events are
+   * opened, the existing ones are attached one by one.
+   */
+  pid_t all = -1;
+  pid_t *tids = &all;
+  int nb_tids = 1;
+  if (pid != -1) {
+    nb_tids = get_threads(pid, &tids);
+    if (nb_tids == -1) {
+      return -1;
+    }
+  }
+  int ret = reserve_fds((uint64_t)nb_tids * profile->nb_cpus);
+  for (int cpu = 0; cpu < profile->nb_cpus && ret == 0; cpu++) {
+    for (int t = 0; t < nb_tids && ret == 0; t++) {
+      ret = open_event(profile, attr, tids[t], cpu, handler, arg);
+    }
+  }
+  if (pid != -1) {
+    free(tids);
+  }
+  if (ret == 0 && profile->nb_fds == 0) {
+    fprintf(stderr, "No event could be opened\n");
+    ret = -1;
+  }
+  return ret;
+}
+
+static void profile_ioctl(struct profile *profile, unsigned long request) {
+  for (int i = 0; i < profile->nb_fds; i++) {
+    ioctl(profile->fds[i], request, 0);
+  }
+}
+
+static void profile_drain(struct profile *profile) {
+  for (int cpu = 0; cpu < profile->nb_cpus; cpu++) {
+    if (profile->leaders[cpu] != -1) {
+      pebs_ring_drain(&profile->rings[cpu]);
+    }
+  }
+}
+
+static void profile_close(struct profile *profile) {
+  for (int cpu = 0; cpu < profile->nb_cpus; cpu++) {
+    if (profile->leaders[cpu] != -1) {
+      pebs_ring_unmap(&profile->rings[cpu]);
+    }
+  }
+  for (int i = 0; i < profile->nb_fds; i++) {
+    close(profile->fds[i]);
+  }
+  free(profile->fds);
+  free(profile->fd_cpus);
+  free(profile->rings);
+  free(profile->leaders);
+}
+
+/**
+ * Replaces the watched event of cpu, whose thread exited, by the next
+ * event of cpu, any event redirected to a ring buffer being woken up by
+ * it too. The hung up event is removed from the epoll set, for its hang
+ * up not to wake the loop up over and over. Returns -1 if there is no
+ * event of cpu left.
+ */
+static int watch_next(struct profile *profile, int epoll_fd, int *watched, int cpu) {
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, profile->fds[watched[cpu]], NULL);
+  for (int i = watched[cpu] + 1; i < profile->nb_fds; i++) {
+    if (profile->fd_cpus[i] != cpu) {
+      continue;
+    }
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = &profile->rings[cpu]};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, profile->fds[i], &event) == 0) {
+      watched[cpu] = i;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Drains the ring buffers of the cpus woken up by their watermark until
+ * SIGINT, the end of the duration (if not 0) or the exit of pid. When
+ * all the threads with an event on a cpu exited, the threads they
+ * created may still write to its ring buffer, which is then drained at
+ * each turn of the loop.
+ */
+static int profile_run(struct profile *profile, pid_t pid, int duration) {
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd == -1) {
+    fprintf(stderr, "epoll_create1 failed: %s\n", strerror(errno));
+    return -1;
+  }
+  int *watched = malloc(profile->nb_cpus * sizeof(int));
+  int *unwatched = calloc(profile->nb_cpus, sizeof(int));
+  assert(watched);
+  assert(unwatched);
+  for (int i = profile->nb_fds - 1; i >= 0; i--) {
+    watched[profile->fd_cpus[i]] = i;
+  }
+  for (int cpu = 0; cpu < profile->nb_cpus; cpu++) {
+    if (profile->leaders[cpu] == -1) {
+      continue;
+    }
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = &profile->rings[cpu]};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, profile->leaders[cpu], &event) == -1) {
+      fprintf(stderr, "epoll_ctl failed on cpu %d: %s\n", cpu, strerror(errno));
+      close(epoll_fd);
+      free(unwatched);
+      free(watched);
+      return -1;
+    }
+  }
+
+  struct timespec now, deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += duration;
+  struct epoll_event events[64];
+  profile_ioctl(profile, PERF_EVENT_IOC_ENABLE);
+  while (!stop) {
+    int nb_ready = epoll_wait(epoll_fd, events, 64, POLL_TIMEOUT_MS);
+    if (nb_ready == -1 && errno != EINTR) {
+      fprintf(stderr, "epoll_wait failed: %s\n", strerror(errno));
+      break;
+    }
+    for (int i = 0; i < nb_ready; i++) {
+      struct pebs_ring *ring = events[i].data.ptr;
+      ring->nb_wakeups++;
+      pebs_ring_drain(ring);
+      int cpu = ring - profile->rings;
+      if ((events[i].events & (EPOLLHUP | EPOLLERR)) && watch_next(profile, epoll_fd, watched, cpu)) {
+	unwatched[cpu] = 1;
+      }
+    }
+    for (int cpu = 0; cpu < profile->nb_cpus; cpu++) {
+      if (unwatched[cpu]) {
+	pebs_ring_drain(&profile->rings[cpu]);
+      }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (duration > 0 && (now.tv_sec > deadline.tv_sec ||
+			 (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec))) {
+      break;
+    }
+    if (pid != -1 && kill(pid, 0) == -1 && errno == ESRCH) {
+      fprintf(stderr, "Process %d exited\n", pid);
+      break;
+    }
+  }
+  profile_ioctl(profile, PERF_EVENT_IOC_DISABLE);
+  free(unwatched);
+  free(watched);
+
+  /**
+   * Records written since the last wake up.
+   */
+  profile_drain(profile);
+  close(epoll_fd);
+  return 0;
+}
+
+void usage(const char *prog_name) {
+  printf("Usage: %s (-p <pid> | -a) [-d <seconds>] [-c <period>] [-r <config>] [-l <threshold>] [-o <sample_file>] [-k <top_k>]\n"
+	 "\t -p: profiles the threads of pid and those they create, attributing the samples to its functions and data objects\n"
+	 "\t     (the samples of the child processes it forks are counted too, but attributed as if in pid)\n"
+	 "\t -a: profiles every cpu, which usually needs root\n"
+	 "\t -d: stops after the given number of seconds, otherwise on SIGINT or when pid exits\n"
+	 "\t -c: the sampling period in number of events (default is %d)\n"
+	 "\t -r: the raw config of the sampled event, in hexadecimal (default is %x)\n"
+	 "\t -l: the load latency threshold in cycles (default is %d)\n"
+	 "\t -o: the file the samples are written to, for pebs_analyze\n"
+	 "\t -k: the number of hottest pages, functions and data objects printed (default is %d)\n",
+	 prog_name, DEFAULT_PERIOD, DEFAULT_CONFIG, DEFAULT_THRESHOLD, DEFAULT_TOP_K);
+}
+
+int main(int argc, char **argv) {
+  pid_t pid = -1;
+  int system_wide = 0;
+  int duration = 0;
+  uint64_t period = DEFAULT_PERIOD;
+  uint64_t config = DEFAULT_CONFIG;
+  uint64_t threshold = DEFAULT_THRESHOLD;
+  const char *sample_file = NULL;
+  int top_k = DEFAULT_TOP_K;
+  int opt;
+  while ((opt = getopt(argc, argv, "p:ad:c:r:l:o:k:")) != -1) {
+    switch (opt) {
+    case 'p':
+      pid = atoi(optarg);
+      break;
+    case 'a':
+      system_wide = 1;
+      break;
+    case 'd':
+      duration = atoi(optarg);
+      break;
+    case 'c':
+      period = strtoull(optarg, NULL, 0);
+      break;
+    case 'r':
+      config = strtoull(optarg, NULL, 16);
+      break;
+    case 'l':
+      threshold = strtoull(optarg, NULL, 0);
+      break;
+    case 'o':
+      sample_file = optarg;
+      break;
+    case 'k':
+      top_k = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return -1;
+    }
+  }
+  if (optind != argc || (pid == -1) == !system_wide || pid == 0 || period == 0 || top_k <= 0 || duration < 0) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_RAW;
+  attr.config = config;
+  attr.config1 = threshold;
+  attr.sample_period = period;
+  attr.precise_ip = 2;
+  attr.sample_type = PERF_SAMPLE_IP | PERF_SAMPLE_ADDR | PERF_SAMPLE_WEIGHT | PERF_SAMPLE_DATA_SRC;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.inherit = !system_wide;
+  attr.mmap = !system_wide;
+  attr.mmap_data = !system_wide;
+
+  // Wakes the main loop up each time a quarter of a ring buffer is filled
+  attr.watermark = 1;
+  attr.wakeup_watermark = RING_BUFFER_PAGES * sysconf(_SC_PAGESIZE) / 4;
+
+  /**
+   * The whole address space is sampled, there is no range to draw a
+   * heatmap of.
+   */
+  struct sample_sink sink = {.writer = NULL, .space = NULL};
+  struct sample_file_writer writer;
+  aggregate_init(&sink.aggregate, 0, 0, 0);
+  if (sample_file != NULL) {
+    if (sample_file_create(&writer, sample_file, 0, 0, period)) {
+      return -1;
+    }
+    sink.writer = &writer;
+  }
+
+  struct profile profile;
+  if (profile_open(&profile, &attr, pid, add_sample, &sink)) {
+    return -1;
+  }
+
+  /**
+   * The mappings created between the read of the maps and the enabling
+   * of the events are found by reading the maps again.
+   */
+  struct address_space space;
+  if (!system_wide) {
+    address_space_init(&space, pid);
+    if (address_space_load_maps(&space)) {
+      return -1;
+    }
+    sink.space = &space;
+    for (int cpu = 0; cpu < profile.nb_cpus; cpu++) {
+      if (profile.leaders[cpu] != -1) {
+	profile.rings[cpu].record_handler = add_record;
+      }
+    }
+  }
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  if (system_wide) {
+    fprintf(stderr, "Profiling %d cpus, interrupt to stop\n", profile.nb_cpus);
+  } else {
+    fprintf(stderr, "Profiling %d (%d events), interrupt to stop\n", pid, profile.nb_fds);
+  }
+  if (profile_run(&profile, pid, duration)) {
+    return -1;
+  }
+
+  uint64_t nb_lost = 0;
+  uint64_t nb_wakeups = 0;
+  for (int cpu = 0; cpu < profile.nb_cpus; cpu++) {
+    if (profile.leaders[cpu] != -1) {
+      nb_lost += profile.rings[cpu].nb_lost;
+      nb_wakeups += profile.rings[cpu].nb_wakeups;
+    }
+  }
+  profile_close(&profile);
+  printf("%-80s = %15" PRIu64 " (%" PRIu64 " wake ups)\n", "samples lost by the kernel", nb_lost, nb_wakeups);
+  if (sink.writer != NULL && sample_file_close(sink.writer, nb_lost)) {
+    return -1;
+  }
+  print_aggregate(&sink.aggregate, -1, top_k);
+  aggregate_free(&sink.aggregate);
+  if (sink.space != NULL) {
+    print_symbols(&space, top_k);
+    address_space_free(&space);
+  }
+  return 0;
+}
@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <poll.h>
+#include <sys/mman.h>
+
+#include "pebs_ring.h"
+
+#define mb() asm volatile("mfence" ::: "memory")
+
+/**
+ * Records are at most as large as their 16 bits size field allows.
+ */
+#define MAX_RECORD_SIZE (1 << 16)
+
+struct lost_record {
+  struct perf_event_header header;
+  uint64_t id;
+  uint64_t lost;
+};
+
+/**
+ * Handles the records between data_tail and data_head, then gives their
+ * space back to the kernel. A record wrapping around the end of the
+ * buffer is first copied in one piece to the record buffer.
+ */
+void pebs_ring_drain(struct pebs_ring *ring) {
+  char *record = ring->record;
+  uint64_t head = ring->metadata_page->data_head;
+  rmb();
+  uint64_t tail = ring->metadata_page->data_tail;
+  while (tail < head) {
+    uint64_t offset = tail & (ring->data_size - 1);
+    struct perf_event_header *header = (struct perf_event_header *)(ring->data + offset);
+    if (offset + header->size > ring->data_size) {
+      uint64_t first_part = ring->data_size - offset;
+      memcpy(record, ring->data + offset, first_part);
+      memcpy(record + first_part, ring->data, header->size - first_part);
+      header = (struct perf_event_header *)record;
+    }
+    switch (header->type) {
+    case PERF_RECORD_SAMPLE:
+      ring->nb_samples++;
+      ring->handler((const struct sample *)(header + 1), ring->handler_arg);
+      break;
+    case PERF_RECORD_LOST:
+      ring->nb_lost += ((struct lost_record *)header)->lost;
+      break;
+    default:
+      if (ring->record_handler != NULL) {
+	ring->record_handler(header, ring->handler_arg);
+      }
+      break;
+    }
+    tail += header->size;
+  }
+
+  /**
+   * The records must have been read before the kernel may overwrite
+   * them.
+   */
+  mb();
+  ring->metadata_page->data_tail = tail;
+}
+
+static void *consume(void *arg) {
+  struct pebs_ring *ring = arg;
+  struct pollfd fds[2] = {{ring->fd, POLLIN, 0}, {ring->stop_pipe[0], POLLIN, 0}};
+  for (;;) {
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR) {
+	continue;
+      }
+      fprintf(stderr, "poll failed on the ring buffer: %s\n", strerror(errno));
+      break;
+    }
+    ring->nb_wakeups++;
+    pebs_ring_drain(ring);
+    if (fds[1].revents & POLLIN) {
+      break;
+    }
+    if (fds[0].revents & (POLLHUP | POLLERR)) {
+      fds[0].fd = -1;
+    }
+  }
+
+  /**
+   * Records written since the last wake up.
+   */
+  pebs_ring_drain(ring);
+  return NULL;
+}
+
+int pebs_ring_map(struct pebs_ring *ring, int fd, int nb_pages, sample_handler handler, void *arg) {
+  if (nb_pages <= 0 || (nb_pages & (nb_pages - 1))) {
+    fprintf(stderr, "The number of ring buffer pages must be a power of two: %d\n", nb_pages);
+    return -1;
+  }
+  memset(ring, 0, sizeof(struct pebs_ring));
+  long page_size = sysconf(_SC_PAGESIZE);
+  ring->fd = fd;
+  ring->data_size = (uint64_t)nb_pages * page_size;
+  ring->mmap_len = (1 + nb_pages) * page_size;
+  ring->handler = handler;
+  ring->handler_arg = arg;
+
+  /**
+   * The mapping is writable for the kernel to honour data_tail and never
+   * overwrite records not read yet.
+   */
+  ring->metadata_page = mmap(NULL, ring->mmap_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (ring->metadata_page == MAP_FAILED) {
+    fprintf(stderr, "Couldn't mmap file descriptor: %s - errno = %d\n", strerror(errno), errno);
+    return -1;
+  }
+  ring->data = (char *)ring->metadata_page + page_size;
+  ring->record = malloc(MAX_RECORD_SIZE);
+  assert(ring->record);
+  return 0;
+}
+
+void pebs_ring_unmap(struct pebs_ring *ring) {
+  munmap(ring->metadata_page, ring->mmap_len);
+  free(ring->record);
+}
+
+int pebs_ring_start(struct pebs_ring *ring, int fd, int nb_pages, const cpu_set_t *cpus,
+		    sample_handler handler, void *arg) {
+  if (pebs_ring_map(ring, fd, nb_pages, handler, arg)) {
+    return -1;
+  }
+  if (pipe(ring->stop_pipe) == -1) {
+    fprintf(stderr, "pipe failed: %s\n", strerror(errno));
+    pebs_ring_unmap(ring);
+    return -1;
+  }
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  if (cpus != NULL) {
+    pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), cpus);
+  }
+  int ret = pthread_create(&ring->thread, &attr, consume, ring);
+  pthread_attr_destroy(&attr);
+  if (ret) {
+    fprintf(stderr, "Cannot create the ring buffer consumer: %s\n", strerror(ret));
+    close(ring->stop_pipe[0]);
+    close(ring->stop_pipe[1]);
+    pebs_ring_unmap(ring);
+    return -1;
+  }
+  return 0;
+}
+
+void pebs_ring_stop(struct pebs_ring *ring) {
+  char stop = 1;
+  if (write(ring->stop_pipe[1], &stop, sizeof(stop)) != sizeof(stop)) {
+    fprintf(stderr, "Cannot stop the ring buffer consumer: %s\n", strerror(errno));
+  }
+  pthread_join(ring->thread, NULL);
+  close(ring->stop_pipe[0]);
+  close(ring->stop_pipe[1]);
+  pebs_ring_unmap(ring);
+}
@@ -0,0 +1,71 @@
+#ifndef PEBS_RING_H
+#define PEBS_RING_H
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "pebs_bench.h"
+
+/**
+ * Called by the consumer thread for each sample record read from the
+ * ring buffer.
+ */
+typedef void (*sample_handler)(const struct sample *sample, void *arg);
+
+/**
+ * Called for the records other than samples and lost records, such as
+ * PERF_RECORD_MMAP, if set after the ring buffer is mapped.
+ */
+typedef void (*record_handler)(const struct perf_event_header *header, void *arg);
+
+/**
+ * Consumer of the ring buffer of a sampling event: a thread woken up by
+ * poll() when the buffer fills up drains the records, even those
+ * wrapping around its end, and gives the space back to the kernel by
+ * moving data_tail, so that sampling can go on for as long as needed.
+ */
+struct pebs_ring {
+  int fd;
+  struct perf_event_mmap_page *metadata_page;
+  char *data;
+  uint64_t data_size;
+  size_t mmap_len;
+  sample_handler handler;
+  void *handler_arg;
+  record_handler record_handler;
+  char *record;
+  pthread_t thread;
+  int stop_pipe[2];
+  uint64_t nb_samples;
+  uint64_t nb_lost;
+  uint64_t nb_wakeups;
+};
+
+/**
+ * Maps nb_pages data pages, a power of two, for the ring buffer of fd,
+ * whose samples will be given to handler. Returns -1 on error.
+ */
+int pebs_ring_map(struct pebs_ring *ring, int fd, int nb_pages, sample_handler handler, void *arg);
+
+/**
+ * Handles the records written since the last call, for callers waiting
+ * for the ring buffer themselves.
+ */
+void pebs_ring_drain(struct pebs_ring *ring);
+
+void pebs_ring_unmap(struct pebs_ring *ring);
+
+/**
+ * Maps the ring buffer of fd as pebs_ring_map and starts the consumer
+ * thread, on cpus if not NULL. Returns -1 on error.
+ */
+int pebs_ring_start(struct pebs_ring *ring, int fd, int nb_pages, const cpu_set_t *cpus,
+		    sample_handler handler, void *arg);
+
+/**
+ * Stops the consumer thread once it has drained all the records left,
+ * the event having to be disabled first, and unmaps the ring buffer.
+ */
+void pebs_ring_stop(struct pebs_ring *ring);
+
+#endif
@@ -0,0 +1,604 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <assert.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pebs_symbols.h"
+#include "pebs_aggregate.h"
+
+#define RELOAD_INTERVAL_MS 1000
+
+/**
+ * Addresses below are never mapped (vm.mmap_min_addr), those of the
+ * samples without a data address being 0, so they are not worth reading
+ * /proc/pid/maps again.
+ */
+#define MIN_MAPPED_ADDRESS 4096
+
+const char *region_kind_names[nb_region_kinds] = {
+  "heap", "stack", "file", "anonymous", "unmapped"
+};
+
+struct mmap_record {
+  struct perf_event_header header;
+  uint32_t pid;
+  uint32_t tid;
+  uint64_t addr;
+  uint64_t len;
+  uint64_t pgoff;
+  char filename[];
+};
+
+struct mmap2_record {
+  struct perf_event_header header;
+  uint32_t pid;
+  uint32_t tid;
+  uint64_t addr;
+  uint64_t len;
+  uint64_t pgoff;
+  uint32_t maj;
+  uint32_t min;
+  uint64_t ino;
+  uint64_t ino_generation;
+  uint32_t prot;
+  uint32_t flags;
+  char filename[];
+};
+
+static void symbol_init(struct symbol *symbol, const char *name, const char *module) {
+  memset(symbol, 0, sizeof(struct symbol));
+  symbol->name = name;
+  symbol->module = module;
+}
+
+static uint64_t now_ms() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+void address_space_init(struct address_space *space, pid_t pid) {
+  memset(space, 0, sizeof(struct address_space));
+  space->pid = pid;
+  symbol_init(&space->unknown_function, "?", "[anon]");
+  symbol_init(&space->unmapped, "?", "[unmapped]");
+}
+
+static int compare_symbols(const void *a, const void *b) {
+  const struct symbol *sa = a;
+  const struct symbol *sb = b;
+  return sa->start < sb->start ? -1 : sa->start > sb->start;
+}
+
+/**
+ * Sorts symbols by address, keeping one of the aliases of an address.
+ * Returns the number of symbols left.
+ */
+static int sort_symbols(struct symbol *symbols, int nb_symbols) {
+  qsort(symbols, nb_symbols, sizeof(struct symbol), compare_symbols);
+  int nb_unique = 0;
+  for (int i = 0; i < nb_symbols; i++) {
+    if (nb_unique == 0 || symbols[i].start != symbols[nb_unique - 1].start) {
+      symbols[nb_unique++] = symbols[i];
+    }
+  }
+  return nb_unique;
+}
+
+/**
+ * Reads the functions and data objects of the symbol table section,
+ * their names pointing to the mapped file.
+ */
+static void read_symbols(struct elf_image *image, const Elf64_Shdr *symtab, const Elf64_Shdr *strtab) {
+  const char *file = image->file;
+  if (symtab->sh_offset + symtab->sh_size > image->file_size ||
+      strtab->sh_offset + strtab->sh_size > image->file_size) {
+    return;
+  }
+  const Elf64_Sym *symbols = (const Elf64_Sym *)(file + symtab->sh_offset);
+  int nb_symbols = symtab->sh_size / sizeof(Elf64_Sym);
+  image->functions = malloc(nb_symbols * sizeof(struct symbol));
+  assert(image->functions);
+  image->objects = malloc(nb_symbols * sizeof(struct symbol));
+  assert(image->objects);
+  for (int i = 0; i < nb_symbols; i++) {
+    const Elf64_Sym *sym = &symbols[i];
+    int type = ELF64_ST_TYPE(sym->st_info);
+    if (sym->st_size == 0 || sym->st_shndx == SHN_UNDEF || sym->st_name >= strtab->sh_size) {
+      continue;
+    }
+    struct symbol *symbol;
+    if (type == STT_FUNC || type == STT_GNU_IFUNC) {
+      symbol = &image->functions[image->nb_functions++];
+    } else if (type == STT_OBJECT) {
+      symbol = &image->objects[image->nb_objects++];
+    } else {
+      continue;
+    }
+    symbol_init(symbol, file + strtab->sh_offset + sym->st_name, image->name);
+    symbol->start = sym->st_value;
+    symbol->size = sym->st_size;
+  }
+  image->nb_functions = sort_symbols(image->functions, image->nb_functions);
+  image->nb_objects = sort_symbols(image->objects, image->nb_objects);
+}
+
+/**
+ * Maps the ELF file of image, from the root of the profiled process so
+ * that containers are handled too, and reads its program headers and
+ * its symbol table, the dynamic one if it is stripped. Returns -1 if
+ * the file cannot be read.
+ */
+static int image_load(struct elf_image *image, pid_t pid) {
+  if (image->loaded) {
+    return image->file == NULL ? -1 : 0;
+  }
+  image->loaded = 1;
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "/proc/%d/root%s", pid, image->path);
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    fd = open(image->path, O_RDONLY);
+  }
+  if (fd == -1) {
+    fprintf(stderr, "Cannot open %s, its symbols are unknown: %s\n", image->path, strerror(errno));
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1 || st.st_size < sizeof(Elf64_Ehdr)) {
+    close(fd);
+    return -1;
+  }
+  void *file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (file == MAP_FAILED) {
+    fprintf(stderr, "Cannot map %s: %s\n", image->path, strerror(errno));
+    return -1;
+  }
+
+  const Elf64_Ehdr *ehdr = file;
+  if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) || ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+      ehdr->e_phoff + ehdr->e_phnum * sizeof(Elf64_Phdr) > st.st_size ||
+      ehdr->e_shoff + ehdr->e_shnum * sizeof(Elf64_Shdr) > st.st_size) {
+    munmap(file, st.st_size);
+    return -1;
+  }
+  image->file = file;
+  image->file_size = st.st_size;
+  image->segments = (const Elf64_Phdr *)((char *)file + ehdr->e_phoff);
+  image->nb_segments = ehdr->e_phnum;
+
+  const Elf64_Shdr *sections = (const Elf64_Shdr *)((char *)file + ehdr->e_shoff);
+  const Elf64_Shdr *symtab = NULL;
+  for (int i = 0; i < ehdr->e_shnum; i++) {
+    if (sections[i].sh_type == SHT_SYMTAB || (sections[i].sh_type == SHT_DYNSYM && symtab == NULL)) {
+      symtab = &sections[i];
+    }
+  }
+  if (symtab != NULL && symtab->sh_link < ehdr->e_shnum) {
+    read_symbols(image, symtab, &sections[symtab->sh_link]);
+  }
+  return 0;
+}
+
+static struct elf_image *get_image(struct address_space *space, const char *path) {
+  for (struct elf_image *image = space->images; image != NULL; image = image->next) {
+    if (strcmp(image->path, path) == 0) {
+      return image;
+    }
+  }
+  struct elf_image *image = calloc(1, sizeof(struct elf_image));
+  assert(image);
+  image->path = strdup(path);
+  assert(image->path);
+  const char *slash = strrchr(image->path, '/');
+  image->name = slash == NULL ? image->path : slash + 1;
+  symbol_init(&image->unknown_function, "?", image->name);
+  symbol_init(&image->unknown_object, "?", image->name);
+  image->next = space->images;
+  space->images = image;
+  return image;
+}
+
+static uint64_t hash_label(const char *label) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (const char *c = label; *c != '\0'; c++) {
+    hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+/**
+ * Returns the slot of the hash table of the regions holding label, or
+ * the empty slot where it belongs. The table is at most half full.
+ */
+static struct symbol **region_slot(struct symbol **table, int table_size, const char *label) {
+  int i = hash_label(label) & (table_size - 1);
+  while (table[i] != NULL && strcmp(table[i]->name, label) != 0) {
+    i = (i + 1) & (table_size - 1);
+  }
+  return &table[i];
+}
+
+/**
+ * Returns the region named label, created if needed, so that the
+ * mappings of a region seen several times share its samples.
+ */
+static struct symbol *get_region(struct address_space *space, const char *label) {
+  if (space->region_table_size > 0) {
+    struct symbol *region = *region_slot(space->region_table, space->region_table_size, label);
+    if (region != NULL) {
+      return region;
+    }
+  }
+  if (space->nb_regions == space->max_regions) {
+    space->max_regions = space->max_regions == 0 ? 64 : 2 * space->max_regions;
+    space->regions = realloc(space->regions, space->max_regions * sizeof(struct symbol *));
+    assert(space->regions);
+  }
+  if (2 * (space->nb_regions + 1) > space->region_table_size) {
+    free(space->region_table);
+    space->region_table_size = space->region_table_size == 0 ? 128 : 2 * space->region_table_size;
+    space->region_table = calloc(space->region_table_size, sizeof(struct symbol *));
+    assert(space->region_table);
+    for (int i = 0; i < space->nb_regions; i++) {
+      *region_slot(space->region_table, space->region_table_size, space->regions[i]->name) = space->regions[i];
+    }
+  }
+  struct symbol *region = malloc(sizeof(struct symbol));
+  assert(region);
+  char *name = strdup(label);
+  assert(name);
+  symbol_init(region, name, "");
+  space->regions[space->nb_regions++] = region;
+  *region_slot(space->region_table, space->region_table_size, name) = region;
+  return region;
+}
+
+static enum region_kind kind_of(const char *path) {
+  if (strcmp(path, "[heap]") == 0) {
+    return region_heap;
+  } else if (strncmp(path, "[stack", 6) == 0) {
+    return region_stack;
+  } else if (path[0] == '/' && path[1] != '/') {
+    return region_file;
+  }
+
+  // Anonymous mappings are named //anon in the records, nothing in maps
+  return region_anon;
+}
+
+static void push_mapping(struct mapping *mappings, int *nb_mappings, const struct mapping *mapping) {
+  mappings[(*nb_mappings)++] = *mapping;
+}
+
+/**
+ * Sets mapping to the mapping of path at [start, end[, with its image or
+ * region.
+ */
+static void make_mapping(struct address_space *space, uint64_t start, uint64_t end, uint64_t pgoff, const char *path,
+			 struct mapping *mapping) {
+  *mapping = (struct mapping){start, end, pgoff, kind_of(path), NULL, NULL};
+  if (mapping->kind == region_file) {
+    mapping->image = get_image(space, path);
+  } else if (mapping->kind == region_anon && path[0] != '[') {
+    char label[64];
+    snprintf(label, sizeof(label), "anon %" PRIx64 "-%" PRIx64, start, end);
+    mapping->region = get_region(space, label);
+  } else {
+    mapping->region = get_region(space, mapping->kind == region_stack ? "[stack]" : path);
+  }
+}
+
+/**
+ * Inserts the mapping of path at [start, end[, cutting the mappings it
+ * overlaps.
+ */
+static void insert_mapping(struct address_space *space, uint64_t start, uint64_t end, uint64_t pgoff, const char *path) {
+  if (start >= end) {
+    return;
+  }
+  struct mapping mapping;
+  make_mapping(space, start, end, pgoff, path, &mapping);
+
+  /**
+   * Each existing mapping is kept, dropped or cut in at most two parts.
+   */
+  struct mapping *mappings = malloc((2 * space->nb_mappings + 1) * sizeof(struct mapping));
+  assert(mappings);
+  int nb_mappings = 0;
+  int inserted = 0;
+  for (int i = 0; i < space->nb_mappings; i++) {
+    struct mapping old = space->mappings[i];
+    if (!inserted && old.end > start) {
+      if (old.start < start) {
+	struct mapping left = old;
+	left.end = start;
+	push_mapping(mappings, &nb_mappings, &left);
+      }
+      push_mapping(mappings, &nb_mappings, &mapping);
+      inserted = 1;
+    }
+    if (old.end <= start || old.start >= end) {
+      push_mapping(mappings, &nb_mappings, &old);
+    } else if (old.end > end) {
+      struct mapping right = old;
+      right.pgoff += end - old.start;
+      right.start = end;
+      push_mapping(mappings, &nb_mappings, &right);
+    }
+  }
+  if (!inserted) {
+    push_mapping(mappings, &nb_mappings, &mapping);
+  }
+  free(space->mappings);
+  space->mappings = mappings;
+  space->nb_mappings = nb_mappings;
+}
+
+/**
+ * The lines of /proc/pid/maps are sorted and never overlap, so they are
+ * appended in one pass and the array swapped in at the end, the records
+ * only being inserted one by one.
+ */
+int address_space_load_maps(struct address_space *space) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/maps", space->pid);
+  FILE *maps = fopen(path, "r");
+  if (maps == NULL) {
+    fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  int max_mappings = space->nb_mappings > 64 ? space->nb_mappings : 64;
+  struct mapping *mappings = malloc(max_mappings * sizeof(struct mapping));
+  assert(mappings);
+  int nb_mappings = 0;
+  char line[PATH_MAX + 128];
+  while (fgets(line, sizeof(line), maps) != NULL) {
+    uint64_t start, end, pgoff;
+    int name_offset = 0;
+    if (sscanf(line, "%" SCNx64 "-%" SCNx64 " %*s %" SCNx64 " %*s %*s %n", &start, &end, &pgoff, &name_offset) < 3 ||
+	name_offset == 0 || start >= end || (nb_mappings > 0 && start < mappings[nb_mappings - 1].end)) {
+      continue;
+    }
+    char *name = line + name_offset;
+    name[strcspn(name, "\n")] = '\0';
+    if (nb_mappings == max_mappings) {
+      max_mappings *= 2;
+      mappings = realloc(mappings, max_mappings * sizeof(struct mapping));
+      assert(mappings);
+    }
+    make_mapping(space, start, end, pgoff, name, &mappings[nb_mappings++]);
+  }
+  fclose(maps);
+  free(space->mappings);
+  space->mappings = mappings;
+  space->nb_mappings = nb_mappings;
+  space->last_reload_ms = now_ms();
+  return 0;
+}
+
+void address_space_mmap_record(struct address_space *space, const struct perf_event_header *header) {
+  if (header->type == PERF_RECORD_MMAP) {
+    const struct mmap_record *record = (const struct mmap_record *)header;
+    if (record->pid == space->pid) {
+      insert_mapping(space, record->addr, record->addr + record->len, record->pgoff, record->filename);
+    }
+  } else if (header->type == PERF_RECORD_MMAP2) {
+    const struct mmap2_record *record = (const struct mmap2_record *)header;
+    if (record->pid == space->pid) {
+      insert_mapping(space, record->addr, record->addr + record->len, record->pgoff, record->filename);
+    }
+  }
+}
+
+static struct mapping *search_mapping(struct address_space *space, uint64_t addr) {
+  int low = 0;
+  int high = space->nb_mappings - 1;
+  while (low <= high) {
+    int middle = (low + high) / 2;
+    struct mapping *mapping = &space->mappings[middle];
+    if (addr < mapping->start) {
+      high = middle - 1;
+    } else if (addr >= mapping->end) {
+      low = middle + 1;
+    } else {
+      return mapping;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Returns the mapping of addr. The records of the mappings created
+ * since /proc/pid/maps was read may not have been drained yet from
+ * the ring buffer of another cpu, so it is read again on a miss of a
+ * mappable address, at most every RELOAD_INTERVAL_MS.
+ */
+static struct mapping *find_mapping(struct address_space *space, uint64_t addr) {
+  struct mapping *mapping = search_mapping(space, addr);
+  if (mapping == NULL && addr >= MIN_MAPPED_ADDRESS && now_ms() - space->last_reload_ms >= RELOAD_INTERVAL_MS) {
+    space->last_reload_ms = now_ms();
+    address_space_load_maps(space);
+    mapping = search_mapping(space, addr);
+  }
+  return mapping;
+}
+
+/**
+ * Converts addr to the virtual address of the ELF image it belongs to,
+ * through the segment containing its file offset. The anonymous mapping
+ * right after the last segment of an image holds its bss, past the end
+ * of the file. Returns NULL if addr belongs to no image.
+ */
+static struct elf_image *to_image(struct address_space *space, const struct mapping *mapping, uint64_t addr,
+				  uint64_t *vaddr) {
+  const struct mapping *file_mapping = mapping;
+  if (mapping->kind != region_file) {
+    file_mapping = mapping - 1;
+    if (mapping == space->mappings || file_mapping->end != mapping->start || file_mapping->kind != region_file) {
+      return NULL;
+    }
+  }
+  struct elf_image *image = file_mapping->image;
+  if (image_load(image, space->pid)) {
+    return NULL;
+  }
+  uint64_t offset = addr - file_mapping->start + file_mapping->pgoff;
+  for (int i = 0; i < image->nb_segments; i++) {
+    const Elf64_Phdr *segment = &image->segments[i];
+    if (segment->p_type != PT_LOAD || offset < segment->p_offset || offset - segment->p_offset >= segment->p_memsz) {
+      continue;
+    }
+    if (mapping != file_mapping && offset - segment->p_offset < segment->p_filesz) {
+      return NULL;
+    }
+    *vaddr = offset - segment->p_offset + segment->p_vaddr;
+    return image;
+  }
+  return NULL;
+}
+
+static struct symbol *search_symbol(struct symbol *symbols, int nb_symbols, uint64_t vaddr) {
+  int low = 0;
+  int high = nb_symbols - 1;
+  while (low <= high) {
+    int middle = (low + high) / 2;
+    if (symbols[middle].start <= vaddr) {
+      low = middle + 1;
+    } else {
+      high = middle - 1;
+    }
+  }
+  if (high >= 0 && vaddr - symbols[high].start < symbols[high].size) {
+    return &symbols[high];
+  }
+  return NULL;
+}
+
+static struct symbol *find_function(struct address_space *space, uint64_t ip) {
+  struct mapping *mapping = find_mapping(space, ip);
+  if (mapping == NULL || mapping->kind != region_file) {
+    return &space->unknown_function;
+  }
+  uint64_t vaddr;
+  struct elf_image *image = to_image(space, mapping, ip, &vaddr);
+  if (image == NULL) {
+    return &mapping->image->unknown_function;
+  }
+  struct symbol *function = search_symbol(image->functions, image->nb_functions, vaddr);
+  return function == NULL ? &image->unknown_function : function;
+}
+
+static struct symbol *find_object(struct address_space *space, uint64_t addr, enum region_kind *kind) {
+  struct mapping *mapping = find_mapping(space, addr);
+  if (mapping == NULL) {
+    *kind = region_unmapped;
+    return &space->unmapped;
+  }
+  *kind = mapping->kind;
+  uint64_t vaddr;
+  struct elf_image *image = to_image(space, mapping, addr, &vaddr);
+  struct symbol *object = NULL;
+  if (image != NULL) {
+    object = search_symbol(image->objects, image->nb_objects, vaddr);
+  }
+  if (object != NULL) {
+    return object;
+  }
+  return mapping->kind == region_file ? &mapping->image->unknown_object : mapping->region;
+}
+
+void address_space_add(struct address_space *space, const struct sample *sample) {
+  enum data_source source = data_source_of(sample->data_src);
+  int remote = source == source_remote_dram || source == source_remote_cache;
+  enum region_kind kind;
+  struct symbol *symbols[2] = {find_function(space, sample->ip), find_object(space, sample->addr, &kind)};
+  for (int i = 0; i < 2; i++) {
+    symbols[i]->nb_samples++;
+    symbols[i]->nb_remote += remote;
+    symbols[i]->latency += sample->weight;
+  }
+  space->kinds[kind].nb_samples++;
+  space->kinds[kind].nb_remote += remote;
+  space->kinds[kind].latency += sample->weight;
+}
+
+static int compare_latencies(const void *a, const void *b) {
+  const struct symbol *sa = *(const struct symbol **)a;
+  const struct symbol *sb = *(const struct symbol **)b;
+  if (sa->latency != sb->latency) {
+    return sa->latency > sb->latency ? -1 : 1;
+  }
+  return sa->nb_samples > sb->nb_samples ? -1 : sa->nb_samples < sb->nb_samples;
+}
+
+static void collect(const struct symbol **sampled, int *nb_sampled, const struct symbol *symbol) {
+  if (symbol->nb_samples > 0) {
+    sampled[(*nb_sampled)++] = symbol;
+  }
+}
+
+int address_space_top(const struct address_space *space, int data, const struct symbol **top, int k) {
+  /**
+   * Only the symbols with samples are sorted, a small part of them.
+   */
+  int nb_sampled = 0;
+  int max_sampled = 0;
+  for (const struct elf_image *image = space->images; image != NULL; image = image->next) {
+    max_sampled += 1 + (data ? image->nb_objects : image->nb_functions);
+  }
+  max_sampled += 1 + space->nb_regions;
+  const struct symbol **sampled = malloc(max_sampled * sizeof(struct symbol *));
+  assert(sampled);
+  for (const struct elf_image *image = space->images; image != NULL; image = image->next) {
+    const struct symbol *symbols = data ? image->objects : image->functions;
+    int nb_symbols = data ? image->nb_objects : image->nb_functions;
+    for (int i = 0; i < nb_symbols; i++) {
+      collect(sampled, &nb_sampled, &symbols[i]);
+    }
+    collect(sampled, &nb_sampled, data ? &image->unknown_object : &image->unknown_function);
+  }
+  if (data) {
+    for (int i = 0; i < space->nb_regions; i++) {
+      collect(sampled, &nb_sampled, space->regions[i]);
+    }
+    collect(sampled, &nb_sampled, &space->unmapped);
+  } else {
+    collect(sampled, &nb_sampled, &space->unknown_function);
+  }
+
+  qsort(sampled, nb_sampled, sizeof(struct symbol *), compare_latencies);
+  int nb_top = nb_sampled < k ? nb_sampled : k;
+  memcpy(top, sampled, nb_top * sizeof(struct symbol *));
+  free(sampled);
+  return nb_top;
+}
+
+void address_space_free(struct address_space *space) {
+  struct elf_image *image = space->images;
+  while (image != NULL) {
+    struct elf_image *next = image->next;
+    if (image->file != NULL) {
+      munmap(image->file, image->file_size);
+    }
+    free(image->functions);
+    free(image->objects);
+    free(image->path);
+    free(image);
+    image = next;
+  }
+  for (int i = 0; i < space->nb_regions; i++) {
+    free((char *)space->regions[i]->name);
+    free(space->regions[i]);
+  }
+  free(space->regions);
+  free(space->region_table);
+  free(space->mappings);
+}
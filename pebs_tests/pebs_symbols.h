@@ -0,0 +1,129 @@
+#ifndef PEBS_SYMBOLS_H
+#define PEBS_SYMBOLS_H
+
+#include <sys/types.h>
+#include <elf.h>
+
+#include "pebs_bench.h"
+
+/**
+ * What a sampled data address points to.
+ */
+enum region_kind {
+  region_heap,
+  region_stack,
+  region_file,
+  region_anon,
+  region_unmapped,
+  nb_region_kinds
+};
+
+extern const char *region_kind_names[nb_region_kinds];
+
+/**
+ * A function or data object of a binary, or a whole region when no
+ * symbol covers the address, with the samples attributed to it. Remote
+ * samples are those served by a remote DRAM or cache.
+ */
+struct symbol {
+  uint64_t start;
+  uint64_t size;
+  const char *name;
+  const char *module;
+  uint64_t nb_samples;
+  uint64_t nb_remote;
+  uint64_t latency;
+};
+
+/**
+ * Symbol tables of a mapped ELF file, read the first time an address of
+ * one of its mappings is looked up, sorted by virtual address.
+ */
+struct elf_image {
+  char *path;
+  const char *name;
+  int loaded;
+  void *file;
+  size_t file_size;
+  const Elf64_Phdr *segments;
+  int nb_segments;
+  struct symbol *functions;
+  int nb_functions;
+  struct symbol *objects;
+  int nb_objects;
+  struct symbol unknown_function;
+  struct symbol unknown_object;
+  struct elf_image *next;
+};
+
+/**
+ * A range of the address space, an ELF image being attached to the
+ * file mappings.
+ */
+struct mapping {
+  uint64_t start;
+  uint64_t end;
+  uint64_t pgoff;
+  enum region_kind kind;
+  struct elf_image *image;
+  struct symbol *region;
+};
+
+struct region_stats {
+  uint64_t nb_samples;
+  uint64_t nb_remote;
+  uint64_t latency;
+};
+
+/**
+ * Address space of a profiled process, built from /proc/pid/maps and
+ * kept up to date with the PERF_RECORD_MMAP records of its events. The
+ * mappings are sorted and never overlap, a new one replacing what it
+ * covers, so that the sample addresses are looked up by binary search.
+ */
+struct address_space {
+  pid_t pid;
+  struct mapping *mappings;
+  int nb_mappings;
+  struct elf_image *images;
+  struct symbol **regions;
+  int nb_regions;
+  int max_regions;
+  struct symbol **region_table;
+  int region_table_size;
+  struct symbol unknown_function;
+  struct symbol unmapped;
+  struct region_stats kinds[nb_region_kinds];
+  uint64_t last_reload_ms;
+};
+
+void address_space_init(struct address_space *space, pid_t pid);
+
+/**
+ * Replaces the mappings by those listed in /proc/pid/maps. Returns -1
+ * on error.
+ */
+int address_space_load_maps(struct address_space *space);
+
+/**
+ * Adds the mapping of a PERF_RECORD_MMAP or PERF_RECORD_MMAP2 record,
+ * ignoring those of other processes.
+ */
+void address_space_mmap_record(struct address_space *space, const struct perf_event_header *header);
+
+/**
+ * Attributes sample to the function its ip belongs to and to the data
+ * object or region its addr belongs to.
+ */
+void address_space_add(struct address_space *space, const struct sample *sample);
+
+/**
+ * Fills top with the at most k functions, or data objects and regions,
+ * with the highest total latency, in decreasing order. Returns the
+ * number of symbols filled.
+ */
+int address_space_top(const struct address_space *space, int data, const struct symbol **top, int k);
+
+void address_space_free(struct address_space *space);
+
+#endif
@@ -58,11 +58,28 @@ void read_memory(uint64_t *memory, size_t size) {
   }
 }
 
+void usage(const char *prog_name) {
+  printf ("Usage %s [pattern]\n\t pattern: access pattern (default is rand) " ACCESS_PATTERN_HELP, prog_name);
+}
+
 int main(int argc, char **argv) {
 
+  /**
+   * Check and get arguments.
+   */
+  enum access_mode_t access_mode = access_rand;
+  struct fill_params fill_params;
+  fill_params_init(&fill_params);
+  if (argc > 2 || (argc == 2 && parse_access_pattern(argv[1], &access_mode, &fill_params))) {
+    usage(argv[0]);
+    return -1;
+  }
+
   /**
    * Pin process on core CPU
    */
+  cpu_set_t initial_cpus;
+  sched_getaffinity(0, sizeof(initial_cpus), &initial_cpus);
   cpu_set_t mask;
   CPU_ZERO(&mask);
   CPU_SET(CPU, &mask);
@@ -86,7 +103,17 @@ int main(int argc, char **argv) {
   }
   assert(memory);
   memset(memory, -1, size_in_bytes);
-  fill_memory(memory, size_in_bytes, access_rand);
+
+  /**
+   * The threads filling memory inherit the affinity of this one, so it
+   * is unpinned while they run, not to confine them to CPU.
+   */
+  sched_setaffinity(0, sizeof(initial_cpus), &initial_cpus);
+  fill_memory_params(memory, size_in_bytes, access_mode, 0, &fill_params);
+  if (sched_setaffinity(0, sizeof(mask), &mask) == -1) {
+    printf("sched_setaffinity failed: %s\n", strerror(errno));
+    return -1;
+  }
 
 
   /**